@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+//bump allocator: hands out memory from large blocks and only gives it back all at once
+//for many short lived arrays (a batch of chains, a verification pass) that die together
+class Arena {
+
+	std::vector<char*> m_blocks;
+	size_t m_blockSize;
+	char* m_next;
+	size_t m_left;
+	size_t m_used;
+
+public:
+
+	static const size_t DEFAULT_BLOCK = 1 << 20;
+
+	explicit Arena(size_t blockSize = DEFAULT_BLOCK) {
+		m_blockSize = blockSize ? blockSize : DEFAULT_BLOCK;
+		m_next = NULL;
+		m_left = 0;
+		m_used = 0;
+	}
+	~Arena() {
+		release();
+	}
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t bytes, size_t align) {
+		size_t pad = (align - (uintptr_t)m_next % align) % align;
+		if (m_next == NULL || pad + bytes > m_left) {
+			//requests bigger than a block get a block of their own
+			size_t size = bytes + align > m_blockSize ? bytes + align : m_blockSize;
+			m_next = new char[size];
+			m_blocks.push_back(m_next);
+			m_left = size;
+			pad = (align - (uintptr_t)m_next % align) % align;
+		}
+		void* p = m_next + pad;
+		m_next += pad + bytes;
+		m_left -= pad + bytes;
+		m_used += bytes;
+		return p;
+	}
+
+	//frees every block, anything allocated from the arena is gone
+	void release() {
+		for (char* b : m_blocks)
+			delete[] b;
+		m_blocks.clear();
+		m_next = NULL;
+		m_left = 0;
+		m_used = 0;
+	}
+
+	size_t used() const { return m_used; }
+	size_t blocks() const { return m_blocks.size(); }
+
+};
+
+//standard allocator interface over an Arena, for Array<T, ArenaAllocator<T>> and std containers
+//deallocate is a no-op, the memory comes back when the arena is released
+template<class T>
+struct ArenaAllocator {
+
+	using value_type = T;
+
+	Arena* arena;
+
+	explicit ArenaAllocator(Arena& a) : arena(&a) {}
+	template<class U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t n) {
+		return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+	}
+	void deallocate(T*, size_t) {}
+
+	template<class U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template<class U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+};
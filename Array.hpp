@@ -1,12 +1,20 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
 #include <stdexcept>
 #include <initializer_list>
 #include <string>
 #include <sstream>
 #include <ostream>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-#pragma warning(disable:4244) 
+#pragma warning(disable:4244)
 
 /*
 Author: Timothy Williams
@@ -14,142 +22,242 @@ Created On       : 10-14-2018
 Last Modified On : 12-22-2018
 */
 
-template<class T>
+//growable array, storage comes from Alloc so an Array can live in an arena or pool (see Arena.hpp)
+//trivially copyable element types are copied and regrown with memcpy instead of element by element
+//elements that can't be moved (mutexes, atomics) are fine as long as the array is only ever sized once
+template<class T, class Alloc = std::allocator<T>>
 class Array {
 
+	using Traits = std::allocator_traits<Alloc>;
+	static const bool TRIVIAL = std::is_trivially_copyable<T>::value;
+	static const uintmax_t PARALLEL_SORT_MIN = 1 << 14; //elements per thread before sorting in parallel pays
+
 	T* arr;
 	uintmax_t m_length;
+	uintmax_t m_capacity;
+	Alloc m_alloc;
 
-	void alloc();
-	void dealloc();
-
-	void sort(uintmax_t start, uintmax_t end);
-	void swap(T& a, T& b);
+	void alloc();   //room for m_length elements, all value initialised
+	void dealloc(); //destroys the elements and frees the storage
+	void copyFrom(const T* src, uintmax_t n); //into the unconstructed front of arr
+	void reallocate(uintmax_t capacity);
+	void grow(uintmax_t minCapacity);
 
 public:
 
 	Array();
-	Array(uintmax_t size);
-	Array(std::initializer_list<T> il);
-	Array(const Array<T>& other);
-	Array(Array<T>&& other);
+	explicit Array(const Alloc& alloc);
+	Array(uintmax_t size, const Alloc& alloc = Alloc());
+	Array(std::initializer_list<T> il, const Alloc& alloc = Alloc());
+	Array(const Array& other);
+	Array(Array&& other);
 	~Array();
 
-	Array<T>& operator=(const Array<T>& rhs);
-	Array<T>& operator=(Array<T>&& rhs);
+	Array& operator=(const Array& rhs);
+	Array& operator=(Array&& rhs);
 
 	T& operator[](uintmax_t i);
 	const T& operator[](uintmax_t i) const;
 
 	T* begin();
 	T* end();
+	const T* begin() const;
+	const T* end() const;
+	T* data();
+	const T* data() const;
+	T& back();
+	const T& back() const;
 
 	uintmax_t length() const;
 	uintmax_t size() const;
+	uintmax_t capacity() const;
 	bool empty() const;
 
+	//capacity at least doubles when it runs out, so push_back is amortised O(1)
+	void reserve(uintmax_t capacity);
+	void resize(uintmax_t size); //new elements are value initialised
+	void push_back(const T& val);
+	void push_back(T&& val);
+	template<class... Args>
+	T& emplace_back(Args&&... args);
+	void pop_back();
+	void clear(); //keeps the storage
+
 	bool in(const T& val) const;
 
-	Array<T> clone() const;
-	void swap(Array<T>& other);
+	Array clone() const;
+	void swap(Array& other);
 
-	Array<T> splice(uintmax_t start, uintmax_t end) const;
+	Array splice(uintmax_t start, uintmax_t end) const;
 
-	void sort();
+	//introsort (std::sort) of up to threads equal slices at once, then the slices are merged pairwise in parallel
+	//less has to be a strict weak ordering, the plain version uses operator<
+	void sort(unsigned threads = 1);
+	template<class Compare, class = typename std::enable_if<!std::is_arithmetic<Compare>::value>::type>
+	void sort(Compare less, unsigned threads = 1);
 
 	std::string toString() const;
 
+	Alloc get_allocator() const;
+
 };
 
 
-template<class T>
-void Array<T>::alloc() {
-	if (m_length > 0)
-		arr = new T[m_length];
-	else
+template<class T, class Alloc>
+void Array<T, Alloc>::alloc() {
+	m_capacity = m_length;
+	if (m_length > 0) {
+		arr = Traits::allocate(m_alloc, m_length);
+		for (uintmax_t i = 0; i < m_length; i++)
+			Traits::construct(m_alloc, arr + i);
+	} else {
 		arr = NULL;
+	}
+}
+template<class T, class Alloc>
+void Array<T, Alloc>::dealloc() {
+	if (arr != NULL) {
+		if (!std::is_trivially_destructible<T>::value)
+			for (uintmax_t i = 0; i < m_length; i++)
+				Traits::destroy(m_alloc, arr + i);
+		Traits::deallocate(m_alloc, arr, m_capacity);
+	}
+	arr = NULL;
+	m_capacity = 0;
+}
+
+template<class T, class Alloc>
+void Array<T, Alloc>::copyFrom(const T* src, uintmax_t n) {
+	if (TRIVIAL) {
+		if (n > 0)
+			memcpy((void*)arr, (const void*)src, n * sizeof(T));
+	} else {
+		for (uintmax_t i = 0; i < n; i++)
+			Traits::construct(m_alloc, arr + i, src[i]);
+	}
 }
-template<class T>
-void Array<T>::dealloc() {
+
+template<class T, class Alloc>
+void Array<T, Alloc>::reallocate(uintmax_t capacity) {
+	T* fresh = Traits::allocate(m_alloc, capacity);
+	if (TRIVIAL) {
+		if (m_length > 0)
+			memcpy((void*)fresh, (const void*)arr, m_length * sizeof(T));
+	} else {
+		for (uintmax_t i = 0; i < m_length; i++) {
+			Traits::construct(m_alloc, fresh + i, std::move_if_noexcept(arr[i]));
+			Traits::destroy(m_alloc, arr + i);
+		}
+	}
 	if (arr != NULL)
-		delete[] arr;
+		Traits::deallocate(m_alloc, arr, m_capacity);
+	arr = fresh;
+	m_capacity = capacity;
 }
 
-template<class T>
-Array<T>::Array() {
+template<class T, class Alloc>
+void Array<T, Alloc>::grow(uintmax_t minCapacity) {
+	if (minCapacity <= m_capacity)
+		return;
+	uintmax_t capacity = m_capacity * 2 > minCapacity ? m_capacity * 2 : minCapacity;
+	reallocate(capacity < 4 ? 4 : capacity);
+}
+
+template<class T, class Alloc>
+Array<T, Alloc>::Array() : m_alloc() {
 	m_length = 0;
+	m_capacity = 0;
 	arr = NULL;
 }
 
-template<class T>
-Array<T>::Array(uintmax_t size) {
+template<class T, class Alloc>
+Array<T, Alloc>::Array(const Alloc& alloc) : m_alloc(alloc) {
+	m_length = 0;
+	m_capacity = 0;
+	arr = NULL;
+}
+
+template<class T, class Alloc>
+Array<T, Alloc>::Array(uintmax_t size, const Alloc& alloc) : m_alloc(alloc) {
 	m_length = size;
-	alloc();
+	this->alloc();
 }
 
-template<class T>
-Array<T>::Array(std::initializer_list<T> il) {
-	this->m_length = il.size();
-	alloc();
-	for (int i = 0; i < this->m_length; i++)
-		arr[i] = il.begin()[i];
+template<class T, class Alloc>
+Array<T, Alloc>::Array(std::initializer_list<T> il, const Alloc& alloc) : m_alloc(alloc) {
+	m_length = il.size();
+	m_capacity = m_length;
+	arr = m_length > 0 ? Traits::allocate(m_alloc, m_length) : NULL;
+	copyFrom(il.begin(), m_length);
 }
 
-template<class T>
-Array<T>::Array(const Array<T>& other) {
+template<class T, class Alloc>
+Array<T, Alloc>::Array(const Array& other) : m_alloc(Traits::select_on_container_copy_construction(other.m_alloc)) {
 	m_length = other.m_length;
-	alloc();
-	for (int i = 0; i < m_length; i++)
-		arr[i] = other.arr[i];
+	m_capacity = m_length;
+	arr = m_length > 0 ? Traits::allocate(m_alloc, m_length) : NULL;
+	copyFrom(other.arr, m_length);
 }
 
-template<class T>
-Array<T>::Array(Array<T>&& other) {
+template<class T, class Alloc>
+Array<T, Alloc>::Array(Array&& other) : m_alloc(std::move(other.m_alloc)) {
 	m_length = other.m_length;
+	m_capacity = other.m_capacity;
 	this->arr = other.arr;
 	other.arr = NULL;
+	other.m_length = 0;
+	other.m_capacity = 0;
 }
 
-template<class T>
-Array<T>::~Array() {
+template<class T, class Alloc>
+Array<T, Alloc>::~Array() {
 	dealloc();
 }
 
-template<class T>
-Array<T>& Array<T>::operator=(const Array<T>& rhs) {
-	m_length = rhs.m_length;
+template<class T, class Alloc>
+Array<T, Alloc>& Array<T, Alloc>::operator=(const Array& rhs) {
+	if (this == &rhs)
+		return *this;
 	dealloc();
-	alloc();
-	for (int i = 0; i < m_length; i++) {
-		arr[i] = rhs.arr[i];
-	}
+	m_length = rhs.m_length;
+	m_capacity = m_length;
+	arr = m_length > 0 ? Traits::allocate(m_alloc, m_length) : NULL;
+	copyFrom(rhs.arr, m_length);
 	return *this;
 }
 
-template<class T>
-Array<T>& Array<T>::operator=(Array<T>&& rhs) {
+template<class T, class Alloc>
+Array<T, Alloc>& Array<T, Alloc>::operator=(Array&& rhs) {
+	if (this == &rhs)
+		return *this;
+	//the old buffer has to go back to the allocator it came from before taking rhs's
+	dealloc();
+	m_alloc = std::move(rhs.m_alloc);
 	m_length = rhs.m_length;
+	m_capacity = rhs.m_capacity;
 	arr = rhs.arr;
 	rhs.arr = NULL;
+	rhs.m_length = 0;
+	rhs.m_capacity = 0;
 	return *this;
 }
 
-template<class T>
-T& Array<T>::operator[](uintmax_t i) {
+template<class T, class Alloc>
+T& Array<T, Alloc>::operator[](uintmax_t i) {
 	if (i >= m_length)
 		throw std::out_of_range("index out of range");
 	return arr[i];
 }
 
-template<class T>
-const T& Array<T>::operator[](uintmax_t i) const {
+template<class T, class Alloc>
+const T& Array<T, Alloc>::operator[](uintmax_t i) const {
 	if (i >= m_length)
 		throw std::out_of_range("index out of range");
 	return arr[i];
 }
 
-template<class T>
-std::ostream& operator<<(std::ostream& os, const Array<T>& a) {
+template<class T, class Alloc>
+std::ostream& operator<<(std::ostream& os, const Array<T, Alloc>& a) {
 	os << "[";
 	for (uintmax_t i = 0; i < a.size(); i++) {
 		if (i == 0)
@@ -164,133 +272,220 @@ std::ostream& operator<<(std::ostream& os, const Array<T>& a) {
 	return os;
 }
 
-template<class T>
-T* Array<T>::begin() {
+template<class T, class Alloc>
+T* Array<T, Alloc>::begin() {
 	return arr;
 }
 
-template<class T>
-T* Array<T>::end() {
+template<class T, class Alloc>
+T* Array<T, Alloc>::end() {
 	return arr + m_length;
 }
 
-template<class T>
-uintmax_t Array<T>::length() const {
+template<class T, class Alloc>
+const T* Array<T, Alloc>::begin() const {
+	return arr;
+}
+
+template<class T, class Alloc>
+const T* Array<T, Alloc>::end() const {
+	return arr + m_length;
+}
+
+template<class T, class Alloc>
+T* Array<T, Alloc>::data() {
+	return arr;
+}
+
+template<class T, class Alloc>
+const T* Array<T, Alloc>::data() const {
+	return arr;
+}
+
+template<class T, class Alloc>
+T& Array<T, Alloc>::back() {
+	if (m_length == 0)
+		throw std::out_of_range("back of an empty array");
+	return arr[m_length - 1];
+}
+
+template<class T, class Alloc>
+const T& Array<T, Alloc>::back() const {
+	if (m_length == 0)
+		throw std::out_of_range("back of an empty array");
+	return arr[m_length - 1];
+}
+
+template<class T, class Alloc>
+uintmax_t Array<T, Alloc>::length() const {
 	return m_length;
 }
-template<class T>
-uintmax_t Array<T>::size() const {
+template<class T, class Alloc>
+uintmax_t Array<T, Alloc>::size() const {
 	return m_length;
 }
 
-template<class T>
-bool Array<T>::empty() const {
+template<class T, class Alloc>
+uintmax_t Array<T, Alloc>::capacity() const {
+	return m_capacity;
+}
+
+template<class T, class Alloc>
+bool Array<T, Alloc>::empty() const {
 	return m_length == 0;
 }
 
-template<class T>
-bool Array<T>::in(const T& val) const {
+template<class T, class Alloc>
+void Array<T, Alloc>::reserve(uintmax_t capacity) {
+	//exactly what was asked for, doubling is only for push_back
+	if (capacity > m_capacity)
+		reallocate(capacity);
+}
+
+template<class T, class Alloc>
+void Array<T, Alloc>::resize(uintmax_t size) {
+	if (size > m_capacity)
+		grow(size);
+	for (uintmax_t i = m_length; i < size; i++)
+		Traits::construct(m_alloc, arr + i);
+	if (!std::is_trivially_destructible<T>::value)
+		for (uintmax_t i = size; i < m_length; i++)
+			Traits::destroy(m_alloc, arr + i);
+	m_length = size;
+}
+
+template<class T, class Alloc>
+void Array<T, Alloc>::push_back(const T& val) {
+	emplace_back(val);
+}
+
+template<class T, class Alloc>
+void Array<T, Alloc>::push_back(T&& val) {
+	emplace_back(std::move(val));
+}
+
+template<class T, class Alloc>
+template<class... Args>
+T& Array<T, Alloc>::emplace_back(Args&&... args) {
+	if (m_length == m_capacity) {
+		//args may point into the array, so build the element before the storage moves
+		T val(std::forward<Args>(args)...);
+		grow(m_length + 1);
+		Traits::construct(m_alloc, arr + m_length, std::move(val));
+	} else {
+		Traits::construct(m_alloc, arr + m_length, std::forward<Args>(args)...);
+	}
+	return arr[m_length++];
+}
+
+template<class T, class Alloc>
+void Array<T, Alloc>::pop_back() {
+	if (m_length == 0)
+		throw std::out_of_range("pop_back on an empty array");
+	Traits::destroy(m_alloc, arr + --m_length);
+}
+
+template<class T, class Alloc>
+void Array<T, Alloc>::clear() {
+	if (!std::is_trivially_destructible<T>::value)
+		for (uintmax_t i = 0; i < m_length; i++)
+			Traits::destroy(m_alloc, arr + i);
+	m_length = 0;
+}
+
+template<class T, class Alloc>
+bool Array<T, Alloc>::in(const T& val) const {
 	for (uintmax_t i = 0; i < m_length; i++)
 		if (arr[i] == val)
 			return 1;
 	return 0;
 }
 
-template<class T>
-Array<T> Array<T>::clone() const {
+template<class T, class Alloc>
+Array<T, Alloc> Array<T, Alloc>::clone() const {
 	return *this;
 }
 
-template<class T>
-void Array<T>::swap(Array<T>& other) {
-	int tmpLength = m_length;
-	m_length = other.m_length;
-	other.m_length = tmpLength;
-
-	T* tmpArr = arr;
-	arr = other.arr;
-	other.arr = tmpArr;
+template<class T, class Alloc>
+void Array<T, Alloc>::swap(Array& other) {
+	std::swap(m_length, other.m_length);
+	std::swap(m_capacity, other.m_capacity);
+	std::swap(arr, other.arr);
+	std::swap(m_alloc, other.m_alloc);
 }
 
-template<class T>
-Array<T> Array<T>::splice(uintmax_t start, uintmax_t end) const {
+template<class T, class Alloc>
+Array<T, Alloc> Array<T, Alloc>::splice(uintmax_t start, uintmax_t end) const {
 	if (start >= m_length)
 		throw std::out_of_range("start index out of range");
 	if (end > m_length)
 		throw std::out_of_range("end index out of range");
 	if (start > end)
-		return Array<T>();
-	Array<T> sub(end - start);
-	for (uintmax_t i = start; i < end; i++)
-		sub[i - start] = arr[i];
+		return Array(m_alloc);
+	Array sub(m_alloc);
+	sub.reserve(end - start);
+	sub.m_length = end - start;
+	sub.copyFrom(arr + start, end - start);
 	return sub;
 }
 
-template <class T>
-std::string Array<T>::toString() const {
+template <class T, class Alloc>
+std::string Array<T, Alloc>::toString() const {
 	std::stringstream ss;
 	ss << *this;
 	return ss.str();
 }
 
-template <class T>
-void Array<T>::swap(T& a, T& b) {
-	T tmp = a;
-	a = b;
-	b = tmp;
+template <class T, class Alloc>
+Alloc Array<T, Alloc>::get_allocator() const {
+	return m_alloc;
 }
 
-template <class T>
-void Array<T>::sort() {
-	sort(0, m_length - 1);
+template <class T, class Alloc>
+void Array<T, Alloc>::sort(unsigned threads) {
+	sort([](const T& a, const T& b) { return a < b; }, threads);
 }
 
-template <class T>
-void Array<T>::sort(uintmax_t start, uintmax_t end) {
-	//end is inclusive
-	if (m_length == 0)
+template <class T, class Alloc>
+template <class Compare, class>
+void Array<T, Alloc>::sort(Compare less, unsigned threads) {
+	uintmax_t n = m_length;
+	if (threads > n / PARALLEL_SORT_MIN)
+		threads = (unsigned)(n / PARALLEL_SORT_MIN);
+	if (threads <= 1) {
+		std::sort(arr, arr + n, less);
 		return;
-	if (start == end) //size == 1
-		return;
-	if (start == end - 1) //size == 2
-		if (arr[start] <= arr[end])
-			return;
-		else {
-			swap(arr[start], arr[end]);
-			return;
-		}
-	//pivot
-	uintmax_t lastSwap = (end + start) / 2;
-	if (arr[start] > arr[lastSwap])
-		swap(arr[start], arr[lastSwap]);
-	if (arr[lastSwap] > arr[end])
-		swap(arr[lastSwap], arr[end]);
-	if (arr[start] > arr[lastSwap])
-		swap(arr[start], arr[lastSwap]);
-	T comp = arr[lastSwap];
-	lastSwap--;
-	uintmax_t j;
-	bool j_init = 0;
-	//sort
-	for (uintmax_t i = start; i <= end; i++) {
-		if (arr[i] >= comp) {
-			bool swapped = false;
-			if (!j_init) {
-				j = i + 1;
-				j_init = 1;
-			}
-			for (; j <= end; j++) {
-				if (arr[j] <= comp) {
-					swap(arr[i], arr[j++]);
-					lastSwap = i;
-					swapped = true;
-					break;
-				}
-			}
-			if (!swapped)
-				break;
+	}
+
+	std::vector<uintmax_t> bounds(threads + 1);
+	for (unsigned i = 0; i <= threads; i++)
+		bounds[i] = n * i / threads;
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < threads; i++)
+		workers.emplace_back([this, &bounds, less, i] { std::sort(arr + bounds[i], arr + bounds[i + 1], less); });
+	std::sort(arr, arr + bounds[1], less);
+	for (auto& w : workers)
+		w.join();
+
+	//merge neighbouring runs, doubling their width each round, bouncing between arr and a scratch buffer
+	std::vector<T> scratch(n);
+	T* src = arr;
+	T* dst = scratch.data();
+	for (unsigned width = 1; width < threads; width *= 2) {
+		workers.clear();
+		for (unsigned i = 0; i < threads; i += 2 * width) {
+			uintmax_t lo = bounds[i];
+			uintmax_t mid = bounds[i + width < threads ? i + width : threads];
+			uintmax_t hi = bounds[i + 2 * width < threads ? i + 2 * width : threads];
+			workers.emplace_back([src, dst, lo, mid, hi, less] {
+				std::merge(std::make_move_iterator(src + lo), std::make_move_iterator(src + mid),
+					std::make_move_iterator(src + mid), std::make_move_iterator(src + hi), dst + lo, less);
+			});
 		}
+		for (auto& w : workers)
+			w.join();
+		std::swap(src, dst);
 	}
-	sort(start, lastSwap);
-	sort(lastSwap + 1, end);
+	if (src != arr)
+		std::move(src, src + n, arr);
 }
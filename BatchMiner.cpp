@@ -0,0 +1,149 @@
+#include "BatchMiner.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "Block.hpp"
+#include "NonceScheduler.hpp"
+#include "ThreadMine.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+struct ChainState {
+	Block tip;
+	unsigned mined;
+	int64_t finishedAt;
+};
+
+//the block every chain's first block builds on, same as the interactive miner
+Block genesis(size_t startHash) {
+	return Block(0, 0, startHash, 0, 0, 0);
+}
+
+}
+
+double mineChains(const Array<ChainJob> &jobs, Array<ChainResult> &results, MinerPool &pool, MinerMetrics *metrics) {
+	size_t count = jobs.size();
+	std::vector<ChainState> chains(count);
+	for (size_t i = 0; i < count; i++)
+		chains[i] = {genesis(jobs[i].startHash), 0, 0};
+
+	int64_t started = MinerPool::now();
+	if (count < pool.size()) {
+		//too few chains to give every worker its own, so share the pool round robin
+		NonceScheduler scheduler(pool.size());
+		bool left = true;
+		while (left) {
+			left = false;
+			for (size_t i = 0; i < count; i++) {
+				ChainState &c = chains[i];
+				if (c.mined == jobs[i].length)
+					continue;
+				c.tip = Block(c.mined, c.tip.getSolvedHash(), jobs[i].difficulty);
+				threadMine(c.tip, pool, scheduler, MINE_LOWEST_NONCE, metrics);
+				if (++c.mined == jobs[i].length)
+					c.finishedAt = MinerPool::now();
+				else
+					left = true;
+			}
+		}
+	} else {
+		//chains waiting for a worker, each worker takes one, mines its next block and puts it back
+		std::mutex mtx;
+		std::condition_variable ready;
+		std::deque<size_t> queue;
+		size_t unfinished = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (jobs[i].length == 0)
+				continue;
+			queue.push_back(i);
+			unfinished++;
+		}
+		pool.run([&](unsigned threadNum, unsigned) {
+			std::unique_lock<std::mutex> lock(mtx);
+			while (true) {
+				int64_t waiting = metrics ? MinerPool::now() : 0;
+				ready.wait(lock, [&] { return !queue.empty() || unfinished == 0; });
+				if (unfinished == 0)
+					return;
+				size_t i = queue.front();
+				queue.pop_front();
+				lock.unlock();
+
+				ChainState &c = chains[i];
+				int64_t mining = metrics ? MinerPool::now() : 0;
+				c.tip = Block(c.mined, c.tip.getSolvedHash(), jobs[i].difficulty);
+				{
+					BC_TRACE_SPAN_ARG("mineBlock", i);
+					mineBlock(c.tip);
+				}
+				bool done = ++c.mined == jobs[i].length;
+				int64_t solved = MinerPool::now();
+				if (done)
+					c.finishedAt = solved;
+				if (metrics) {
+					//mineBlock walks up from nonce 0, so the solving nonce tells how many were tried
+					//without one it went through all 2^64, one more than the counter holds, so the count saturates
+					ThreadCounters &t = metrics->counters(threadNum);
+					t.idleNanos += mining - waiting;
+					t.busyNanos += solved - mining;
+					size_t tried = c.tip.hasNoSolution() ? SIZE_MAX : c.tip.getNonce() + 1;
+					t.noncesTried += std::min(tried, SIZE_MAX - t.noncesTried);
+					t.hits += !c.tip.hasNoSolution();
+					metrics->flush(threadNum);
+					metrics->recordBlock(solved - mining);
+				}
+
+				lock.lock();
+				if (done) {
+					if (--unfinished == 0)
+						ready.notify_all();
+				} else {
+					queue.push_back(i);
+					ready.notify_one();
+				}
+			}
+		});
+	}
+	int64_t finished = MinerPool::now();
+
+	results = Array<ChainResult>(count);
+	for (size_t i = 0; i < count; i++) {
+		ChainState &c = chains[i];
+		double secs = c.mined ? (c.finishedAt - started) / 1e9 : 0;
+		results[i] = {c.mined ? c.tip.getSolvedHash() : jobs[i].startHash, c.mined, secs, secs > 0 ? c.mined / secs : 0};
+	}
+	return (finished - started) / 1e9;
+}
+
+bool loadChainJobs(const std::string &path, Array<ChainJob> &jobs, std::string &error) {
+	std::ifstream in(path);
+	if (!in) {
+		error = "cannot open " + path;
+		return false;
+	}
+	Array<ChainJob> list;
+	std::string line;
+	unsigned lineNum = 0;
+	while (std::getline(in, line)) {
+		lineNum++;
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+		std::istringstream ss(line);
+		ChainJob job;
+		std::string extra;
+		if (!(ss >> job.startHash >> job.difficulty >> job.length) || (ss >> extra) || job.difficulty > 16) {
+			error = path + ":" + std::to_string(lineNum) + ": expected <start hash> <difficulty 0-16> <length>";
+			return false;
+		}
+		list.push_back(job);
+	}
+	jobs = std::move(list);
+	return true;
+}
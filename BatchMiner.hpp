@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "Array.hpp"
+#include "Metrics.hpp"
+#include "MinerPool.hpp"
+
+struct ChainJob {
+	size_t startHash;
+	unsigned difficulty;
+	unsigned length;
+};
+
+struct ChainResult {
+	size_t tipHash;     //solved hash of the last block
+	unsigned blocks;    //blocks mined
+	double seconds;     //from the start of the batch until the chain's last block was solved
+	double blocksPerSec;
+};
+
+//mines many independent chains together on one pool
+//with at least as many chains as threads every worker mines whole blocks of whichever chain is ready next,
+//with fewer the chains take turns and each block is mined by the whole pool
+//blocks use the lowest valid nonce either way, so every chain matches a serial mineBlock run
+//returns the wall time of the whole batch in seconds, metrics (one slot per pool thread) gets per thread counters and block latencies
+double mineChains(const Array<ChainJob> &jobs, Array<ChainResult> &results, MinerPool &pool, MinerMetrics *metrics = NULL);
+
+//one job per line: <start hash> <difficulty> <length>, blank lines and lines starting with # are skipped
+//returns false if the file can't be read or a line is malformed
+bool loadChainJobs(const std::string &path, Array<ChainJob> &jobs, std::string &error);
@@ -1,96 +1,142 @@
 #include "Block.hpp"
+#include "HashPolicy.hpp"
+#include "NonceHasher.hpp"
 
-std::hash<std::string> Block::hasher;
+#include <chrono>
+#include <cmath>
 
 Block::Block() {
 	this->id = 1;
-	this->difficulty = DEFAULT_DIFFICULTY;
 	this->previousHash = 0;
 	this->solvedHash = 0;
 	this->nonce = 0;
-	this->timeCreated = clock();
+	this->timeCreated = blockClock();
 	this->timeSolved = 0;
 	this->threshold = DIFFICULTY_VALUES[DEFAULT_DIFFICULTY];
 	this->nSol = 0;
+	this->solved = 0;
+	this->hashPolicy = HASH_STD;
 };
 
 Block::Block(unsigned id, size_t previousHash, unsigned difficulty) {
 	this->id = id;
-	this->difficulty = difficulty <= 16 ? difficulty : DEFAULT_DIFFICULTY;
+	if (difficulty > 16)
+		difficulty = DEFAULT_DIFFICULTY;
 	this->previousHash = previousHash;
 	this->solvedHash = 0;
 	this->nonce = 0;
-	this->timeCreated = clock();
+	this->timeCreated = blockClock();
 	this->timeSolved = 0;
 	this->threshold = DIFFICULTY_VALUES[difficulty];
 	this->nSol = 0;
+	this->solved = 0;
+	this->hashPolicy = HASH_STD;
 }
-Block::Block(unsigned id, size_t previousHash, size_t solvedHash, size_t nonce, clock_t timeCreated, clock_t timeSolved, unsigned difficulty) {
+Block::Block(unsigned id, size_t previousHash, size_t solvedHash, size_t nonce, int64_t timeCreated, int64_t timeSolved, unsigned difficulty) {
 	this->id = id;
+	if (difficulty > 16)
+		difficulty = DEFAULT_DIFFICULTY;
 	this->previousHash = previousHash;
 	this->solvedHash = solvedHash;
 	this->nonce = nonce;
 	this->timeCreated = timeCreated;
 	this->timeSolved = timeSolved;
-	this->difficulty = difficulty;
 	this->threshold = DIFFICULTY_VALUES[difficulty];
 	this->nSol = 1;
+	this->solved = 1;
+	this->hashPolicy = HASH_STD;
 };
 
 bool Block::isSolved() const {
-	return timeSolved || nSol;
+	return solved || nSol;
 };
 
 bool Block::tryNonce(size_t nonce) {
-	size_t attempt = hasher(std::to_string(this->previousHash) + std::to_string(nonce));
+	size_t attempt = hashWith(this->hashPolicy, this->previousHash, nonce, this->id);
 	if (attempt > this->threshold || this->nSol)
 		return 0;
-	if (timeSolved)
+	if (solved)
 		return 0;
 	this->solvedHash = attempt;
 	this->nonce = nonce;
-	this->timeSolved = clock();
+	this->timeSolved = blockClock();
+	this->solved = 1;
 	return 1;
 };
 
 bool Block::tryNonce(size_t nonce) const {
-	size_t attempt = hasher(std::to_string(this->previousHash) + std::to_string(nonce));
+	size_t attempt = hashWith(this->hashPolicy, this->previousHash, nonce, this->id);
 	if (attempt > this->threshold || this->nSol)
 		return 0;
-	if (timeSolved)
+	if (solved)
 		return 0;
 	return 1;
 };
 
+int Block::tryNonceBatch(size_t nonceStart, unsigned count) {
+	int hit = static_cast<const Block &>(*this).tryNonceBatch(nonceStart, count);
+	if (hit >= 0)
+		tryNonce(nonceStart + hit);
+	return hit;
+};
+
+int Block::tryNonceBatch(size_t nonceStart, unsigned count) const {
+	if (this->nSol || solved)
+		return -1;
+	unsigned hit = withHashPolicy(this->hashPolicy, [&](auto policy) {
+		typename decltype(policy)::Cursor cursor(this->previousHash, this->id);
+		cursor.seek(nonceStart);
+		size_t hash;
+		return cursor.scan(count, RuntimeTarget{this->threshold}, hash);
+	});
+	return hit < count ? (int)hit : -1;
+};
 
-bool Block::operator==(Block b) const { return this->id == b.id && this->nonce == b.nonce; };
-bool Block::operator!=(Block b) const { return this->id != b.id || this->nonce != b.nonce; };
-bool Block::operator>=(Block b) const { return this->id >= b.id ? (this->nonce >= b.nonce) : false; };
-bool Block::operator<=(Block b) const { return this->id <= b.id ? (this->nonce <= b.nonce) : false; };
-bool Block::operator>(Block b) const { return this->id > b.id ? (this->nonce > b.nonce) : false; };
-bool Block::operator<(Block b) const { return this->id < b.id ? (this->nonce < b.nonce) : false; };
+bool Block::operator==(const Block &b) const { return this->id == b.id && this->nonce == b.nonce; };
+bool Block::operator!=(const Block &b) const { return this->id != b.id || this->nonce != b.nonce; };
+bool Block::operator>=(const Block &b) const { return this->id >= b.id ? (this->nonce >= b.nonce) : false; };
+bool Block::operator<=(const Block &b) const { return this->id <= b.id ? (this->nonce <= b.nonce) : false; };
+bool Block::operator>(const Block &b) const { return this->id > b.id ? (this->nonce > b.nonce) : false; };
+bool Block::operator<(const Block &b) const { return this->id < b.id ? (this->nonce < b.nonce) : false; };
 
 void Block::setNoSolution() {
-	if (timeSolved)
+	if (solved)
 		return;
-	this->solvedHash = hasher(std::to_string(previousHash));
-	this->timeSolved = clock();
+	this->solvedHash = noSolutionWith(this->hashPolicy, this->previousHash, this->id);
+	this->timeSolved = blockClock();
 	this->nSol = 1;
 };
 
 unsigned Block::getId() const { return this->id; };
-unsigned Block::getDifficulty() const { return this->difficulty; };
+unsigned Block::getDifficulty() const { return thresholdDifficulty(this->threshold); };
 size_t Block::getPreviousHash() const { return this->previousHash; };
 size_t Block::getSolvedHash() const { return this->solvedHash; };
 size_t Block::getNonce() const { return this->nonce; };
-clock_t Block::getTimeCreated() const { return this->timeCreated; };
-clock_t Block::getTimeSolved() const { return this->timeSolved; };
+size_t Block::getThreshold() const { return this->threshold; };
+int64_t Block::getTimeCreated() const { return this->timeCreated; };
+int64_t Block::getTimeSolved() const { return this->timeSolved; };
+int64_t Block::getSolveNanos() const { return isSolved() ? this->timeSolved - this->timeCreated : 0; };
 bool Block::hasNoSolution() const { return this->nSol; };
+int Block::getHashPolicy() const { return this->hashPolicy; };
 
 bool Block::editDifficulty(unsigned difficulty) {
 	if (difficulty > 16)
 		return 0;
-	this->difficulty = difficulty;
+	this->threshold = DIFFICULTY_VALUES[difficulty];
+	return 1;
+};
+
+bool Block::setThreshold(size_t threshold) {
+	if (isSolved())
+		return 0;
+	this->threshold = threshold;
+	return 1;
+};
+
+bool Block::setHashPolicy(int policy) {
+	if (isSolved() || policy < 0 || policy >= HASH_POLICIES)
+		return 0;
+	this->hashPolicy = (uint8_t)policy;
 	return 1;
 };
 
@@ -111,15 +157,106 @@ std::string Block::toString(bool abridged) const {
 };
 
 
+BlockRecord Block::toRecord() const {
+	BlockRecord r;
+	r.previousHash = this->previousHash;
+	r.solvedHash = this->solvedHash;
+	r.nonce = this->nonce;
+	r.timeCreated = this->timeCreated;
+	r.timeSolved = this->timeSolved;
+	r.threshold = this->threshold;
+	r.id = this->id;
+	r.difficulty = (uint8_t)getDifficulty();
+	r.flags = (this->nSol ? BlockRecord::NO_SOLUTION : 0) | (this->solved ? BlockRecord::SOLVED : 0) | this->hashPolicy << BlockRecord::HASH_SHIFT;
+	r.check = r.checksum();
+	return r;
+};
 
-int mineBlock(Block &block, size_t nonceStart, int nonceIncrement, size_t nonceEnd) {
+Block Block::fromRecord(const BlockRecord &record) {
+	Block b;
+	b.id = record.id;
+	b.previousHash = record.previousHash;
+	b.solvedHash = record.solvedHash;
+	b.nonce = record.nonce;
+	b.timeCreated = record.timeCreated;
+	b.timeSolved = record.timeSolved;
+	b.threshold = record.threshold;
+	b.nSol = (record.flags & BlockRecord::NO_SOLUTION) != 0;
+	b.solved = (record.flags & BlockRecord::SOLVED) != 0;
+	b.hashPolicy = (record.flags & BlockRecord::HASH_MASK) >> BlockRecord::HASH_SHIFT;
+	return b;
+};
+
+//fnv-1a over the 64 bit words, folded to 16 bits; never 0 so an all zero record doesn't pass
+uint16_t BlockRecord::checksum() const {
+	uint64_t words[] = {previousHash, solvedHash, nonce, (uint64_t)timeCreated, (uint64_t)timeSolved, threshold,
+		(uint64_t)id | (uint64_t)difficulty << 32 | (uint64_t)flags << 40};
+	uint64_t h = 0xcbf29ce484222325;
+	for (unsigned i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		h ^= words[i];
+		h *= 0x100000001b3;
+	}
+	uint16_t c = (uint16_t)(h ^ h >> 16 ^ h >> 32 ^ h >> 48);
+	return c ? c : 1;
+};
+
+bool BlockRecord::valid() const {
+	return check == checksum() && difficulty == thresholdDifficulty(threshold) && (flags & HASH_MASK) >> HASH_SHIFT < HASH_POLICIES;
+};
+
+
+int64_t blockClock() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned thresholdDifficulty(size_t threshold) {
+	unsigned zeroBits = 0;
+	while (zeroBits < 64 && !(threshold >> (63 - zeroBits) & 1))
+		zeroBits++;
+	return zeroBits / 4 < 16 ? zeroBits / 4 : 16;
+}
+
+double thresholdBits(size_t threshold) {
+	//2^64 / (threshold + 1) tries on average, without overflowing at SIZE_MAX
+	return 64 - std::log2((double)threshold + 1.0);
+}
+
+size_t bitsThreshold(double bits) {
+	if (bits <= 0)
+		return SIZE_MAX;
+	if (bits >= 64)
+		return 0;
+	double t = std::exp2(64 - bits);
+	if (t >= 18446744073709551616.0)
+		return SIZE_MAX;
+	return t <= 1 ? 0 : (size_t)t - 1;
+}
+
+
+
+template<class Hash, class Target>
+static int mineBlockWith(Block &block, size_t nonceStart, size_t nonceEnd, const Target &target) {
 	size_t i;
-	for (i = nonceStart; i <= nonceEnd; i++) {
+	typename Hash::Cursor hasher(block.getPreviousHash(), block.getId());
+	hasher.seek(nonceStart);
+	for (i = nonceStart; i <= nonceEnd; i += NonceHasher::MAX_BATCH) {
 		if (block.isSolved())
 			return 2; //already done
-		else if (block.tryNonce(i))
+		unsigned count = nonceEnd - i >= NonceHasher::MAX_BATCH - 1 ? NonceHasher::MAX_BATCH : (unsigned)(nonceEnd - i) + 1;
+		size_t hash;
+		unsigned hit = hasher.scan(count, target, hash);
+		if (hit < count && block.tryNonce(i + hit))
 			return 1; //mined
-		if (i == nonceEnd)
+		if (nonceEnd - i < NonceHasher::MAX_BATCH)
 			return 0; //no solution
 	}
+	return 0;
+};
+
+int mineBlock(Block &block, size_t nonceStart, int nonceIncrement, size_t nonceEnd) {
+	return withHashPolicy(block.getHashPolicy(), [&](auto policy) {
+		return withTarget(block.getThreshold(), [&](auto target) {
+			return mineBlockWith<decltype(policy)>(block, nonceStart, nonceEnd, target);
+		});
+	});
 };
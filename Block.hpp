@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <ctime>
 #include <functional>
 #include <string>
@@ -26,38 +27,73 @@ const size_t DIFFICULTY_VALUES[] = {
 	0x0000000000000000
 };
 
+//difficulty in bits: a hash has to have this many leading zero bits to pass, fractions fall between powers of two
+//bits 4 * d is the same as DIFFICULTY_VALUES[d], anything in between works too
+double thresholdBits(size_t threshold);
+unsigned thresholdDifficulty(size_t threshold); //whole zero nibbles, the DIFFICULTY_VALUES index at or above threshold
+size_t bitsThreshold(double bits);
+
+//steady_clock nanoseconds, what block timestamps are taken in
+//wall time that never goes backwards, unlike clock() which is cpu time and runs N times too fast with N miners
+int64_t blockClock();
+
+//fixed size on-disk form of a Block, little endian as laid out in memory on every supported target
+struct BlockRecord {
+	uint64_t previousHash;
+	uint64_t solvedHash;
+	uint64_t nonce;
+	int64_t timeCreated;
+	int64_t timeSolved;
+	uint64_t threshold;
+	uint32_t id;
+	uint8_t difficulty;
+	uint8_t flags;
+	uint16_t check; //over every other field, catches records that were only partly written
+
+	static const uint8_t NO_SOLUTION = 1;
+	static const uint8_t SOLVED = 2;
+	static const unsigned HASH_SHIFT = 2; //flags bits 2-3 hold the hash policy, 0 (std) in records older than the choice
+	static const uint8_t HASH_MASK = 3 << HASH_SHIFT;
+
+	uint16_t checksum() const;
+	bool valid() const;
+};
+static_assert(sizeof(BlockRecord) == 56, "BlockRecord is stored as is");
 
-
+//wide fields first so nothing pads, difficulty is worked out from threshold instead of being stored
 class Block {
 
-	unsigned id;
-	unsigned difficulty;
 	size_t previousHash;
 	size_t solvedHash;
 	size_t nonce;
-	clock_t timeCreated;
-	clock_t timeSolved;
 	size_t threshold;
+	int64_t timeCreated; //blockClock() nanoseconds
+	int64_t timeSolved;  //0 until solved
+	unsigned id;
 	bool nSol; //no solutions, true only if the hash is impossible at current difficulty
-
-	static std::hash<std::string> hasher;
+	bool solved;
+	uint8_t hashPolicy; //one of the HASH_ policies in HashPolicy.hpp
 
 public:
 
 	Block();
 	Block(unsigned id, size_t previousHash, unsigned difficulty = DEFAULT_DIFFICULTY);
-	Block(unsigned id, size_t previousHash, size_t solvedHash, size_t nonce, clock_t timeCreated, clock_t timeSolved, unsigned difficulty = DEFAULT_DIFFICULTY);
+	Block(unsigned id, size_t previousHash, size_t solvedHash, size_t nonce, int64_t timeCreated, int64_t timeSolved, unsigned difficulty = DEFAULT_DIFFICULTY);
 
 	bool isSolved() const;
 	bool tryNonce(size_t nonce);
 	bool tryNonce(size_t nonce) const;
-
-	bool operator==(Block) const;
-	bool operator!=(Block) const;
-	bool operator>=(Block) const;
-	bool operator<=(Block) const;
-	bool operator>(Block) const;
-	bool operator<(Block) const;
+	//tries nonceStart .. nonceStart + count - 1 (count <= NonceHasher::MAX_BATCH) with the batch kernel
+	//returns the offset of the first nonce that solves the block or -1, the non-const version keeps the solution
+	int tryNonceBatch(size_t nonceStart, unsigned count);
+	int tryNonceBatch(size_t nonceStart, unsigned count) const;
+
+	bool operator==(const Block &other) const;
+	bool operator!=(const Block &other) const;
+	bool operator>=(const Block &other) const;
+	bool operator<=(const Block &other) const;
+	bool operator>(const Block &other) const;
+	bool operator<(const Block &other) const;
 
 	//if the miner has checked all possible nonces andthere is no solution at this difficulty
 	//sets timeSolved, sets solvedHash to hash of previousHash, sets nonce to 0, and sets nSol to true
@@ -68,19 +104,31 @@ public:
 	size_t getPreviousHash() const;
 	size_t getSolvedHash() const;
 	size_t getNonce() const;
-	clock_t getTimeCreated() const;
-	clock_t getTimeSolved() const;
+	size_t getThreshold() const;
+	int64_t getTimeCreated() const;
+	int64_t getTimeSolved() const;
+	int64_t getSolveNanos() const; //timeSolved - timeCreated, 0 while unsolved
+	int getHashPolicy() const;
 	bool hasNoSolution() const;
 
 	bool editDifficulty(unsigned difficulty);
+	//any 64 bit target instead of one of DIFFICULTY_VALUES, getDifficulty then gives the whole zero nibbles it implies
+	//false once the block is solved
+	bool setThreshold(size_t threshold);
+	//how nonces are hashed, see HashPolicy.hpp; false once the block is solved or for an unknown policy
+	bool setHashPolicy(int policy);
 
 	std::string toString(bool abridged = true) const;
 
+	BlockRecord toRecord() const;
+	static Block fromRecord(const BlockRecord &record);
+
 };
 
 //0 => no solution
 //1 => found solution (mined)
 //2 => solution already found (already mined)
+//runs a loop instantiated for the block's hash policy and, when the threshold is a whole difficulty, for that difficulty
 int mineBlock(Block &block, size_t nonceStart = 0, int nonceIncrement = 1, size_t nonceEnd = -1);
 
 #ifdef COMPARE_BLOCK_STRUCT
@@ -93,7 +141,17 @@ public:
 
 	int mode = COMPARE_DEFAULT;
 
-	bool eq(Block b1, Block b2) {
+	//strict ordering for sorting, e.g. blocks.sort(CompareBlock{CompareBlock::COMPARE_NONCE}, threads)
+	//default orders by id then nonce, since Block's own < is not a strict weak ordering
+	bool operator()(const Block &b1, const Block &b2) const {
+		if (mode == COMPARE_ID)
+			return b1.getId() < b2.getId();
+		if (mode == COMPARE_NONCE)
+			return b1.getNonce() < b2.getNonce();
+		return b1.getId() != b2.getId() ? b1.getId() < b2.getId() : b1.getNonce() < b2.getNonce();
+	};
+
+	bool eq(const Block &b1, const Block &b2) const {
 		if (mode == COMPARE_DEFAULT)
 			return b1 == b2;
 		if (mode == COMPARE_ID)
@@ -103,7 +161,7 @@ public:
 		return false;
 	};
 
-	bool ne(Block b1, Block b2) {
+	bool ne(const Block &b1, const Block &b2) const {
 		if (mode == COMPARE_DEFAULT)
 			return b1 != b2;
 		if (mode == COMPARE_ID)
@@ -113,7 +171,7 @@ public:
 		return false;
 	};
 
-	bool ge(Block b1, Block b2) {
+	bool ge(const Block &b1, const Block &b2) const {
 		if (mode == COMPARE_DEFAULT)
 			return b1 >= b2;
 		if (mode == COMPARE_ID)
@@ -123,7 +181,7 @@ public:
 		return false;
 	};
 
-	bool le(Block b1, Block b2) {
+	bool le(const Block &b1, const Block &b2) const {
 		if (mode == COMPARE_DEFAULT)
 			return b1 <= b2;
 		if (mode == COMPARE_ID)
@@ -133,7 +191,7 @@ public:
 		return false;
 	};
 
-	bool gt(Block b1, Block b2) {
+	bool gt(const Block &b1, const Block &b2) const {
 		if (mode == COMPARE_DEFAULT)
 			return b1 > b2;
 		if (mode == COMPARE_ID)
@@ -143,7 +201,7 @@ public:
 		return false;
 	};
 
-	bool lt(Block b1, Block b2) {
+	bool lt(const Block &b1, const Block &b2) const {
 		if (mode == COMPARE_DEFAULT)
 			return b1 < b2;
 		if (mode == COMPARE_ID)
@@ -0,0 +1,226 @@
+#include "BlockIndex.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <sys/stat.h>
+#include <vector>
+#include "Trace.hpp"
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "slots are saved as they sit in memory");
+
+static const char MAGIC[8] = {'B', 'C', 'I', 'N', 'D', 'E', 'X', '1'};
+static const uint32_t VERSION = 1;
+static const size_t PARALLEL_MIN = 1 << 16; //blocks per thread before building in parallel pays
+
+struct IndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t firstId;
+	uint64_t count;
+	uint64_t tail;
+	uint64_t solvedCapacity;
+	uint64_t solvedUsed;
+	uint64_t idCapacity;
+	uint64_t idUsed;
+};
+
+BlockIndex::Table::Table() {
+	m_used = 0;
+	reset(0);
+}
+
+size_t BlockIndex::Table::capacityFor(size_t expected) {
+	unsigned bits = 4;
+	while (((size_t)1 << bits) * 3 < expected * 5)
+		bits++;
+	return (size_t)1 << bits;
+}
+
+void BlockIndex::Table::reset(size_t expected) {
+	size_t capacity = capacityFor(expected);
+	unsigned bits = 0;
+	while (((size_t)1 << bits) < capacity)
+		bits++;
+	m_slots = Array<std::atomic<uint64_t>>(capacity);
+	m_mask = capacity - 1;
+	m_shift = 64 - bits;
+	m_used = 0;
+}
+
+bool BlockIndex::Table::full() const {
+	return m_used.load(std::memory_order_relaxed) * 4 >= m_slots.size() * 3;
+}
+
+size_t BlockIndex::Table::used() const {
+	return m_used.load(std::memory_order_relaxed);
+}
+
+size_t BlockIndex::Table::capacity() const {
+	return m_slots.size();
+}
+
+void BlockIndex::Table::insert(uint64_t key, size_t pos) {
+	uint64_t m = mix(key);
+	uint64_t slot = (uint64_t)(uint32_t)m << 32 | (uint32_t)(pos + 1);
+	for (uint64_t i = m >> m_shift; ; i = (i + 1) & m_mask) {
+		uint64_t empty = 0;
+		if (m_slots[i].load(std::memory_order_relaxed) == 0 && m_slots[i].compare_exchange_strong(empty, slot, std::memory_order_relaxed))
+			break;
+	}
+	m_used.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool BlockIndex::Table::write(FILE *f) const {
+	return fwrite((const void *)m_slots.data(), sizeof(uint64_t), m_slots.size(), f) == m_slots.size();
+}
+
+//the caller has bounded capacity, every slot is checked so a lookup can't be sent past the chain or probe forever
+bool BlockIndex::Table::read(FILE *f, size_t capacity, size_t used, size_t positions) {
+	if (capacity < 16 || (capacity & (capacity - 1)) != 0 || used >= capacity)
+		return false;
+	unsigned bits = 0;
+	while (((size_t)1 << bits) < capacity)
+		bits++;
+	m_slots = Array<std::atomic<uint64_t>>(capacity);
+	m_mask = capacity - 1;
+	m_shift = 64 - bits;
+	m_used = used;
+	if (fread((void *)m_slots.data(), sizeof(uint64_t), capacity, f) != capacity)
+		return false;
+	size_t occupied = 0;
+	for (size_t i = 0; i < capacity; i++) {
+		uint64_t slot = m_slots[i].load(std::memory_order_relaxed);
+		if (slot == 0)
+			continue;
+		if ((uint32_t)slot == 0 || (uint32_t)slot - 1 >= positions)
+			return false;
+		occupied++;
+	}
+	return occupied == used;
+}
+
+
+
+BlockIndex::BlockIndex() {
+	m_count = 0;
+	m_firstId = 0;
+}
+
+void BlockIndex::clear() {
+	m_bySolved.reset(0);
+	m_byId.reset(0);
+	m_count = 0;
+	m_firstId = 0;
+}
+
+size_t BlockIndex::size() const {
+	return m_count;
+}
+
+bool BlockIndex::full() const {
+	return m_bySolved.full() || m_byId.full();
+}
+
+size_t BlockIndex::memoryBytes() const {
+	return (m_bySolved.capacity() + m_byId.capacity()) * sizeof(uint64_t);
+}
+
+void BlockIndex::add(const BlockRecord &record) {
+	if (m_count == 0)
+		m_firstId = record.id;
+	m_bySolved.insert(record.solvedHash, m_count);
+	if (record.id != m_firstId + m_count)
+		m_byId.insert(record.id, m_count);
+	m_count++;
+}
+
+void BlockIndex::build(const BlockRecord *records, size_t count, unsigned threads) {
+	BC_TRACE_SPAN_ARG("index.build", count);
+	m_bySolved.reset(count);
+	m_byId.reset(0);
+	m_count = count;
+	m_firstId = count ? records[0].id : 0;
+	if (threads > count / PARALLEL_MIN)
+		threads = (unsigned)(count / PARALLEL_MIN);
+	if (threads == 0)
+		threads = 1;
+
+	//out of sequence ids are rare, so they are only collected here and inserted afterwards
+	std::vector<std::vector<size_t>> strays(threads);
+	auto work = [&](unsigned t) {
+		size_t begin = count * t / threads;
+		size_t end = count * (t + 1) / threads;
+		for (size_t i = begin; i < end; i++) {
+			m_bySolved.insert(records[i].solvedHash, i);
+			if (records[i].id != m_firstId + i)
+				strays[t].push_back(i);
+		}
+	};
+	std::vector<std::thread> workers;
+	for (unsigned t = 1; t < threads; t++)
+		workers.emplace_back(work, t);
+	work(0);
+	for (auto &w : workers)
+		w.join();
+
+	size_t strayCount = 0;
+	for (auto &s : strays)
+		strayCount += s.size();
+	m_byId.reset(strayCount);
+	for (auto &s : strays)
+		for (size_t i : s)
+			m_byId.insert(records[i].id, i);
+}
+
+//written through a temporary file, like the metrics and checkpoints
+bool BlockIndex::save(const std::string &path, uint64_t tail) const {
+	IndexHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MAGIC, sizeof(MAGIC));
+	h.version = VERSION;
+	h.firstId = m_firstId;
+	h.count = m_count;
+	h.tail = tail;
+	h.solvedCapacity = m_bySolved.capacity();
+	h.solvedUsed = m_bySolved.used();
+	h.idCapacity = m_byId.capacity();
+	h.idUsed = m_byId.used();
+	std::string tmp = path + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (f == NULL)
+		return false;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && m_bySolved.write(f) && m_byId.write(f);
+	ok = fclose(f) == 0 && ok;
+	return ok && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool BlockIndex::load(const std::string &path, const BlockRecord *records, size_t count) {
+	FILE *f = fopen(path.c_str(), "rb");
+	if (f == NULL)
+		return false;
+	//anything that doesn't add up is refused before it's allocated or trusted, the caller rebuilds instead
+	IndexHeader h;
+	struct stat st;
+	bool ok = fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0 && h.version == VERSION
+		&& h.count <= count && (h.count == 0 || records[h.count - 1].solvedHash == h.tail);
+	size_t most = ok ? Table::capacityFor(h.count) : 0;
+	ok = ok && h.solvedCapacity <= most && h.idCapacity <= most && h.solvedUsed <= h.count && h.idUsed <= h.count
+		&& fstat(fileno(f), &st) == 0 && (uint64_t)st.st_size == sizeof(h) + (h.solvedCapacity + h.idCapacity) * sizeof(uint64_t)
+		&& m_bySolved.read(f, h.solvedCapacity, h.solvedUsed, h.count) && m_byId.read(f, h.idCapacity, h.idUsed, h.count);
+	fclose(f);
+	if (!ok) {
+		clear();
+		return false;
+	}
+	m_count = h.count;
+	m_firstId = h.firstId;
+	//blocks appended since the index was saved
+	for (size_t i = h.count; i < count && !full(); i++)
+		add(records[i]);
+	if (m_count < count) {
+		clear();
+		return false;
+	}
+	return true;
+}
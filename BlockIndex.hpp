@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "Array.hpp"
+#include "Block.hpp"
+
+//open addressing index from solvedHash and from id to a block's position in a chain
+//a slot is 8 bytes, a 32 bit fingerprint of the key and the position, and hits are confirmed against the chain
+//itself, so the index costs about 13 bytes a block and a lookup is one probe run plus one record read
+//ids normally count up by one from the first block and need no slots at all, only blocks out of sequence are
+//put in the id table
+class BlockIndex {
+
+public:
+
+	static const size_t NPOS = SIZE_MAX;
+	static const size_t MAX_BLOCKS = 0xfffffffe; //positions are kept in 32 bits
+
+private:
+
+	//linear probing over a power of two, inserts claim a slot with one CAS so several threads can fill it at once
+	class Table {
+
+		Array<std::atomic<uint64_t>> m_slots;
+		uint64_t m_mask;
+		unsigned m_shift;
+		std::atomic<size_t> m_used;
+
+		uint64_t mix(uint64_t key) const { return key * 0x9E3779B97F4A7C15ULL; }
+
+	public:
+
+		Table();
+
+		static size_t capacityFor(size_t expected); //slots reset(expected) allocates
+		void reset(size_t expected); //empty, sized so expected keys fill at most 60%
+		bool full() const;           //past 75%, probe runs start getting long
+		size_t used() const;
+		size_t capacity() const;
+
+		void insert(uint64_t key, size_t pos);
+
+		//lowest position whose key (from keyAt) matches, NPOS if none
+		template<class KeyAt>
+		size_t find(uint64_t key, KeyAt keyAt) const {
+			uint64_t m = mix(key);
+			uint32_t fingerprint = (uint32_t)m;
+			size_t best = NPOS;
+			for (uint64_t i = m >> m_shift; ; i = (i + 1) & m_mask) {
+				uint64_t slot = m_slots[i].load(std::memory_order_relaxed);
+				if (slot == 0)
+					return best;
+				size_t pos = (uint32_t)slot - 1;
+				if ((uint32_t)(slot >> 32) == fingerprint && pos < best && keyAt(pos) == key)
+					best = pos;
+			}
+		}
+
+		bool write(FILE *f) const;
+		bool read(FILE *f, size_t capacity, size_t used, size_t positions); //false unless every slot holds a position below positions
+
+	};
+
+	Table m_bySolved;
+	Table m_byId;
+	size_t m_count;
+	uint32_t m_firstId;
+
+public:
+
+	BlockIndex();
+
+	void clear();
+	size_t size() const; //blocks covered, positions 0 .. size() - 1
+	bool full() const;   //needs a build before more blocks are added
+	size_t memoryBytes() const;
+
+	void add(const BlockRecord &record); //the block at position size()
+	//indexes records from scratch, threads share the inserts
+	void build(const BlockRecord *records, size_t count, unsigned threads = 1);
+
+	//recordAt(pos) gives the chain's record at pos, positions come back as NPOS if nothing matches
+	template<class RecordAt>
+	size_t findSolvedHash(uint64_t hash, RecordAt recordAt) const {
+		if (m_count == 0)
+			return NPOS;
+		return m_bySolved.find(hash, [&](size_t pos) { return (uint64_t)recordAt(pos).solvedHash; });
+	}
+	template<class RecordAt>
+	size_t findId(unsigned id, RecordAt recordAt) const {
+		if (m_count == 0)
+			return NPOS;
+		size_t found = m_byId.used() ? m_byId.find(id, [&](size_t pos) { return (uint64_t)recordAt(pos).id; }) : NPOS;
+		size_t slot = (size_t)id - m_firstId;
+		if (id >= m_firstId && slot < m_count && slot < found && recordAt(slot).id == id)
+			found = slot;
+		return found;
+	}
+
+	//tail is the solvedHash of the last block covered, load refuses a file that doesn't match the chain it's given
+	bool save(const std::string &path, uint64_t tail) const;
+	bool load(const std::string &path, const BlockRecord *records, size_t count);
+
+};
@@ -0,0 +1,262 @@
+#include "BlockWriter.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ChainStore.hpp"
+#include "HashPolicy.hpp"
+#include "MinerPool.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+const size_t MAX_LINE = 512; //an NDJSON line is under 300 bytes, the buffer is flushed before it has less room than this
+
+bool writeAll(int fd, const char *p, size_t bytes) {
+	while (bytes) {
+		ssize_t n = write(fd, p, bytes);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+const char *statusOf(const BlockRecord &r) {
+	if (r.flags & BlockRecord::SOLVED)
+		return "solved";
+	return r.flags & BlockRecord::NO_SOLUTION ? "no-solution" : "unsolved";
+}
+
+}
+
+BlockWriter::BlockWriter(const BlockOutputPolicy &policy)
+	: m_fd(-1), m_ownFd(false), m_regular(false), m_policy(policy), m_queue(policy.queueRecords ? policy.queueRecords : 1),
+	m_used(0), m_lastSync(0), m_failed(false), m_errno(0), m_closing(false),
+	m_blocks(0), m_bytes(0), m_writes(0), m_syncs(0), m_stalls(0), m_maxDepth(0) {
+	m_buffer.resize(BUFFER_BYTES);
+}
+
+BlockWriter::~BlockWriter() {
+	std::string error;
+	close(error);
+}
+
+bool BlockWriter::open(const std::string &path, std::string &error) {
+	if (m_fd >= 0) {
+		error = m_path + " is already open";
+		return false;
+	}
+	if (path == "-") {
+		m_fd = STDOUT_FILENO;
+		m_ownFd = false;
+	} else {
+		m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (m_fd < 0) {
+			error = "cannot open " + path + ": " + strerror(errno);
+			return false;
+		}
+		m_ownFd = true;
+	}
+	struct stat st;
+	m_regular = fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode);
+	m_path = path;
+	m_used = 0;
+	m_failed = false;
+	m_errno = 0;
+	m_closing = false;
+	m_lastSync = MinerPool::now();
+	if (m_policy.format == FORMAT_BINARY) {
+		ChainStore::newHeader(m_buffer.data());
+		m_used = ChainStore::HEADER_BYTES;
+	}
+	m_thread = std::thread(&BlockWriter::loop, this);
+	return true;
+}
+
+bool BlockWriter::close(std::string &error) {
+	if (m_fd < 0)
+		return true;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_closing = true;
+	}
+	m_wake.notify_all();
+	m_thread.join();
+	if (m_policy.sync != SYNC_NONE)
+		sync();
+	if (m_ownFd && ::close(m_fd) != 0 && !m_failed) {
+		m_failed = true;
+		m_errno = errno;
+	}
+	m_fd = -1;
+	if (m_failed) {
+		error = "cannot write " + (m_path == "-" ? std::string("stdout") : m_path) + ": " + strerror(m_errno);
+		return false;
+	}
+	return true;
+}
+
+bool BlockWriter::isOpen() const {
+	return m_fd >= 0;
+}
+
+void BlockWriter::push(const Block &block) {
+	push(block.toRecord());
+}
+
+void BlockWriter::push(const BlockRecord &record) {
+	if (m_queue.tryPush(record))
+		return;
+	m_stalls.fetch_add(1, std::memory_order_relaxed);
+	do
+		std::this_thread::yield();
+	while (!m_queue.tryPush(record));
+}
+
+//a pass every IDLE_MS rather than as soon as something lands, so a steady trickle of blocks
+//still goes out as one write per pass instead of one per block
+//closing is read before the last drain, so everything pushed before close() is in the stream
+void BlockWriter::loop() {
+	trace::nameThread("block writer");
+	while (true) {
+		bool closing;
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			closing = m_closing;
+		}
+		drain();
+		if (m_used) {
+			BC_TRACE_SPAN_ARG("writer.flush", m_used);
+			flush();
+		}
+		if (m_policy.sync == SYNC_INTERVAL && MinerPool::now() - m_lastSync >= m_policy.syncMs * (int64_t)1000000)
+			sync();
+		if (closing)
+			return;
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_wake.wait_for(lock, std::chrono::milliseconds((int64_t)IDLE_MS), [this] { return m_closing; });
+	}
+}
+
+void BlockWriter::drain() {
+	size_t depth = m_queue.size();
+	if (depth > m_maxDepth.load(std::memory_order_relaxed))
+		m_maxDepth.store(depth, std::memory_order_relaxed);
+	size_t n = 0;
+	BlockRecord r;
+	while (m_queue.tryPop(r)) {
+		format(r);
+		n++;
+		if (m_used > BUFFER_BYTES - MAX_LINE)
+			flush();
+	}
+	m_blocks.fetch_add(n, std::memory_order_relaxed);
+}
+
+void BlockWriter::format(const BlockRecord &r) {
+	char *out = m_buffer.data() + m_used;
+	if (m_policy.format == FORMAT_BINARY) {
+		memcpy(out, &r, sizeof(r));
+		m_used += sizeof(r);
+		return;
+	}
+	int policy = (r.flags & BlockRecord::HASH_MASK) >> BlockRecord::HASH_SHIFT;
+	int n = snprintf(out, MAX_LINE,
+		"{\"id\":%" PRIu32 ",\"previous\":\"%016" PRIx64 "\",\"hash\":\"%016" PRIx64 "\",\"nonce\":%" PRIu64
+		",\"threshold\":\"%016" PRIx64 "\",\"difficulty\":%u,\"policy\":\"%s\",\"status\":\"%s\",\"created\":%" PRId64 ",\"solved\":%" PRId64 "}\n",
+		r.id, r.previousHash, r.solvedHash, r.nonce, r.threshold, (unsigned)r.difficulty, hashPolicyName(policy), statusOf(r), r.timeCreated, r.timeSolved);
+	m_used += n;
+}
+
+//after a failed write the stream is broken, so everything else is thrown away rather than left to fill the queue
+bool BlockWriter::flush() {
+	size_t bytes = m_used;
+	m_used = 0;
+	if (m_failed)
+		return false;
+	if (!writeAll(m_fd, m_buffer.data(), bytes)) {
+		m_failed = true;
+		m_errno = errno;
+		return false;
+	}
+	m_writes.fetch_add(1, std::memory_order_relaxed);
+	m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+	if (m_policy.sync == SYNC_BATCH)
+		sync();
+	return true;
+}
+
+bool BlockWriter::sync() {
+	m_lastSync = MinerPool::now();
+	if (!m_regular || m_failed)
+		return !m_failed;
+	BC_TRACE_SPAN("writer.fsync");
+	if (fsync(m_fd) != 0) {
+		m_failed = true;
+		m_errno = errno;
+		return false;
+	}
+	m_syncs.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+BlockWriter::Stats BlockWriter::stats() const {
+	Stats s;
+	s.blocks = m_blocks.load(std::memory_order_relaxed);
+	s.bytes = m_bytes.load(std::memory_order_relaxed);
+	s.writes = m_writes.load(std::memory_order_relaxed);
+	s.syncs = m_syncs.load(std::memory_order_relaxed);
+	s.stalls = m_stalls.load(std::memory_order_relaxed);
+	s.maxDepth = m_maxDepth.load(std::memory_order_relaxed);
+	return s;
+}
+
+const std::string &BlockWriter::path() const {
+	return m_path;
+}
+
+bool BlockWriter::parseFormat(const char *name, int &format) {
+	if (name == NULL)
+		return false;
+	if (!strcmp(name, "ndjson"))
+		format = FORMAT_NDJSON;
+	else if (!strcmp(name, "binary"))
+		format = FORMAT_BINARY;
+	else
+		return false;
+	return true;
+}
+
+const char *BlockWriter::formatName(int format) {
+	return format == FORMAT_BINARY ? "binary" : "ndjson";
+}
+
+bool BlockWriter::parseSync(const char *name, BlockOutputPolicy &policy) {
+	if (name == NULL)
+		return false;
+	if (!strcmp(name, "close")) {
+		policy.sync = SYNC_CLOSE;
+	} else if (!strcmp(name, "none")) {
+		policy.sync = SYNC_NONE;
+	} else if (!strcmp(name, "batch")) {
+		policy.sync = SYNC_BATCH;
+	} else {
+		char *end;
+		unsigned long ms = strtoul(name, &end, 10);
+		if (end == name || *end != '\0' || ms == 0)
+			return false;
+		policy.sync = SYNC_INTERVAL;
+		policy.syncMs = (unsigned)ms;
+	}
+	return true;
+}
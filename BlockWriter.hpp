@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Array.hpp"
+#include "Block.hpp"
+#include "MpscQueue.hpp"
+
+struct BlockOutputPolicy {
+	int format = 0;                //BlockWriter::FORMAT_*, NDJSON by default
+	int sync = 0;                  //BlockWriter::SYNC_*, SYNC_CLOSE by default
+	unsigned syncMs = 1000;        //between fsyncs with SYNC_INTERVAL
+	size_t queueRecords = 1 << 16; //blocks in flight before push() has to wait, 3.5 MB
+};
+
+//streams solved blocks to a file or stdout from a thread of its own, so the miners never wait on either
+//push() copies the block's record into a lock-free queue; the writer thread drains it, formats into one big buffer
+//and hands that to write() when it fills or the pass ends, then fsyncs as the policy says
+//NDJSON is one object per line; binary is a chain file (ChainStore's header, then BlockRecords) that --verify reads
+//a full queue is the one place push() waits: it yields until the writer catches up and counts a stall,
+//so a disk that is slower than mining for a whole queue's worth of blocks slows mining instead of losing blocks
+//any number of threads can push, in which case the stream has each thread's blocks in the order it pushed them
+class BlockWriter {
+
+public:
+
+	static const int FORMAT_NDJSON = 0;
+	static const int FORMAT_BINARY = 1;
+
+	static const int SYNC_CLOSE = 0;    //fsync once, when the stream is closed
+	static const int SYNC_NONE = 1;     //leave it to the kernel
+	static const int SYNC_BATCH = 2;    //after every write
+	static const int SYNC_INTERVAL = 3; //at most every syncMs
+
+	static const size_t BUFFER_BYTES = 1 << 20; //written out once this full, or at the end of every pass
+	static const unsigned IDLE_MS = 2;          //between the writer's passes over the queue
+
+	struct Stats {
+		size_t blocks;
+		size_t bytes;
+		size_t writes; //write() calls
+		size_t syncs;
+		size_t stalls; //pushes that found the queue full
+		size_t maxDepth;
+	};
+
+private:
+
+	int m_fd;
+	bool m_ownFd;
+	bool m_regular; //only files are fsynced, pipes and terminals can't be
+	std::string m_path;
+	BlockOutputPolicy m_policy;
+	MpscQueue<BlockRecord> m_queue;
+	Array<char> m_buffer;
+	size_t m_used;
+	int64_t m_lastSync;
+	bool m_failed; //writer thread only until it's joined
+	int m_errno;
+
+	std::thread m_thread;
+	std::mutex m_mtx;
+	std::condition_variable m_wake;
+	bool m_closing;
+
+	std::atomic<size_t> m_blocks;
+	std::atomic<size_t> m_bytes;
+	std::atomic<size_t> m_writes;
+	std::atomic<size_t> m_syncs;
+	std::atomic<size_t> m_stalls;
+	std::atomic<size_t> m_maxDepth;
+
+	void loop();
+	void drain();
+	void format(const BlockRecord &r);
+	bool flush();
+	bool sync();
+
+public:
+
+	explicit BlockWriter(const BlockOutputPolicy &policy = BlockOutputPolicy());
+	~BlockWriter(); //closes the stream if it's open
+
+	BlockWriter(const BlockWriter&) = delete;
+	BlockWriter& operator=(const BlockWriter&) = delete;
+
+	//creates or truncates path, "-" is stdout, and starts the writer thread
+	bool open(const std::string &path, std::string &error);
+	//writes what's queued, syncs unless the policy is SYNC_NONE and stops the writer thread
+	//false with error set if any write or sync since open failed
+	bool close(std::string &error);
+	bool isOpen() const;
+
+	void push(const Block &block);
+	void push(const BlockRecord &record);
+
+	Stats stats() const;
+	const std::string &path() const;
+
+	static bool parseFormat(const char *name, int &format);
+	static const char *formatName(int format);
+	//"close", "none", "batch", or a number of milliseconds for SYNC_INTERVAL
+	static bool parseSync(const char *name, BlockOutputPolicy &policy);
+
+};
@@ -0,0 +1,112 @@
+#include "ChainColumns.hpp"
+
+void ChainColumns::reserve(size_t blocks) {
+	m_ids.reserve(blocks);
+	m_previousHashes.reserve(blocks);
+	m_solvedHashes.reserve(blocks);
+	m_nonces.reserve(blocks);
+	m_thresholds.reserve(blocks);
+	m_timesCreated.reserve(blocks);
+	m_timesSolved.reserve(blocks);
+	m_flags.reserve(blocks);
+}
+
+void ChainColumns::clear() {
+	m_ids.clear();
+	m_previousHashes.clear();
+	m_solvedHashes.clear();
+	m_nonces.clear();
+	m_thresholds.clear();
+	m_timesCreated.clear();
+	m_timesSolved.clear();
+	m_flags.clear();
+}
+
+void ChainColumns::append(const Block &block) {
+	append(block.toRecord());
+}
+
+void ChainColumns::append(const BlockRecord &record) {
+	m_ids.push_back(record.id);
+	m_previousHashes.push_back(record.previousHash);
+	m_solvedHashes.push_back(record.solvedHash);
+	m_nonces.push_back(record.nonce);
+	m_thresholds.push_back(record.threshold);
+	m_timesCreated.push_back(record.timeCreated);
+	m_timesSolved.push_back(record.timeSolved);
+	m_flags.push_back(record.flags);
+}
+
+void ChainColumns::append(const BlockRecord *records, size_t count) {
+	reserve(size() + count);
+	for (size_t i = 0; i < count; i++)
+		append(records[i]);
+}
+
+size_t ChainColumns::size() const {
+	return m_ids.size();
+}
+
+bool ChainColumns::empty() const {
+	return m_ids.empty();
+}
+
+Block ChainColumns::at(size_t i) const {
+	BlockRecord r;
+	r.previousHash = m_previousHashes[i];
+	r.solvedHash = m_solvedHashes[i];
+	r.nonce = m_nonces[i];
+	r.timeCreated = m_timesCreated[i];
+	r.timeSolved = m_timesSolved[i];
+	r.threshold = m_thresholds[i];
+	r.id = m_ids[i];
+	r.flags = m_flags[i];
+	r.difficulty = (uint8_t)thresholdDifficulty(r.threshold);
+	return Block::fromRecord(r);
+}
+
+size_t ChainColumns::findId(unsigned id) const {
+	size_t n = m_ids.size();
+	if (n == 0)
+		return NPOS;
+	size_t guess = (size_t)id - m_ids[0];
+	if (id >= m_ids[0] && guess < n && m_ids[guess] == id)
+		return guess;
+	const uint32_t *ids = m_ids.data();
+	for (size_t i = 0; i < n; i++)
+		if (ids[i] == id)
+			return i;
+	return NPOS;
+}
+
+ChainStats ChainColumns::stats() const {
+	ChainStats s = {0, 0, 0, 0, 0};
+	size_t n = m_nonces.size();
+	const uint64_t *nonces = m_nonces.data();
+	const int64_t *created = m_timesCreated.data();
+	const int64_t *solved = m_timesSolved.data();
+	const uint8_t *flags = m_flags.data();
+	double nanos = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (flags[i] & BlockRecord::NO_SOLUTION) {
+			s.unsolvable++;
+			continue;
+		}
+		s.hashes += (double)nonces[i] + 1;
+		if (nonces[i] > s.maxNonce)
+			s.maxNonce = nonces[i];
+		nanos += (double)(solved[i] - created[i]);
+	}
+	s.blocks = n;
+	s.meanSolveNanos = n > s.unsolvable ? nanos / (n - s.unsolvable) : 0;
+	return s;
+}
+
+const uint32_t *ChainColumns::ids() const { return m_ids.data(); }
+const uint64_t *ChainColumns::previousHashes() const { return m_previousHashes.data(); }
+const uint64_t *ChainColumns::solvedHashes() const { return m_solvedHashes.data(); }
+const uint64_t *ChainColumns::nonces() const { return m_nonces.data(); }
+const uint64_t *ChainColumns::thresholds() const { return m_thresholds.data(); }
+const int64_t *ChainColumns::timesCreated() const { return m_timesCreated.data(); }
+const int64_t *ChainColumns::timesSolved() const { return m_timesSolved.data(); }
+const uint8_t *ChainColumns::flags() const { return m_flags.data(); }
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Block.hpp"
+
+//summary of a chain that only reads the nonce and time columns
+struct ChainStats {
+	size_t blocks;
+	size_t unsolvable; //blocks marked as having no solution
+	double hashes;     //sum of nonce + 1, the work a lowest nonce search needed
+	size_t maxNonce;
+	double meanSolveNanos; //timeSolved - timeCreated, blockClock() nanoseconds
+};
+
+//a chain stored field by field, one contiguous column each
+//scans read only the columns they need: finding an id walks 4 bytes a block instead of a whole Block,
+//verification skips the timestamps, statistics skip the hashes
+class ChainColumns {
+
+	std::vector<uint32_t> m_ids;
+	std::vector<uint64_t> m_previousHashes;
+	std::vector<uint64_t> m_solvedHashes;
+	std::vector<uint64_t> m_nonces;
+	std::vector<uint64_t> m_thresholds;
+	std::vector<int64_t> m_timesCreated;
+	std::vector<int64_t> m_timesSolved;
+	std::vector<uint8_t> m_flags; //BlockRecord flags
+
+public:
+
+	static const size_t NPOS = SIZE_MAX;
+
+	void reserve(size_t blocks);
+	void clear();
+
+	void append(const Block &block);
+	void append(const BlockRecord &record);
+	void append(const BlockRecord *records, size_t count);
+
+	size_t size() const;
+	bool empty() const;
+	Block at(size_t i) const; //gathers one block back together
+
+	//position of the block with id, NPOS if there is none
+	//ids normally count up from the first one, so the slot that would hold it is tried before scanning
+	size_t findId(unsigned id) const;
+	ChainStats stats() const;
+
+	const uint32_t *ids() const;
+	const uint64_t *previousHashes() const;
+	const uint64_t *solvedHashes() const;
+	const uint64_t *nonces() const;
+	const uint64_t *thresholds() const;
+	const int64_t *timesCreated() const;
+	const int64_t *timesSolved() const;
+	const uint8_t *flags() const;
+
+};
@@ -0,0 +1,375 @@
+#include "ChainStore.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Trace.hpp"
+
+static const char MAGIC[8] = {'B', 'C', 'C', 'H', 'A', 'I', 'N', '1'};
+static const uint32_t VERSION = 3; //2 added the threshold to each record, 3 moved times to blockClock() nanoseconds
+
+static bool writeAll(int fd, const void *data, size_t bytes, off_t offset) {
+	const char *p = (const char *)data;
+	while (bytes) {
+		ssize_t n = pwrite(fd, p, bytes, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= n;
+		offset += n;
+	}
+	return true;
+}
+
+static std::string describe(const std::string &what, const std::string &path) {
+	return what + " " + path + ": " + strerror(errno);
+}
+
+void ChainStore::newHeader(void *out) {
+	static_assert(sizeof(Header) == HEADER_BYTES, "HEADER_BYTES is the size of Header");
+	Header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MAGIC, sizeof(MAGIC));
+	h.version = VERSION;
+	h.recordSize = sizeof(BlockRecord);
+	memcpy(out, &h, sizeof(h));
+}
+
+ChainStore::ChainStore() {
+	m_fd = -1;
+	m_count = 0;
+	m_written = 0;
+	m_recovered = 0;
+	m_torn = 0;
+	m_readOnly = false;
+	m_windowSize = 0;
+	m_pendingCount = 0;
+	m_map = NULL;
+	m_mapBytes = 0;
+	m_mapped = 0;
+	m_indexed = false;
+	m_indexDirty = false;
+	m_indexThreads = 1;
+}
+
+ChainStore::~ChainStore() {
+	close();
+}
+
+bool ChainStore::open(const std::string &path, std::string &error, unsigned window) {
+	return openFile(path, error, window, false);
+}
+
+bool ChainStore::openReadOnly(const std::string &path, std::string &error, unsigned window) {
+	return openFile(path, error, window, true);
+}
+
+bool ChainStore::openFile(const std::string &path, std::string &error, unsigned window, bool readOnly) {
+	close();
+	//a file we create is the only one we may give a header without looking at it first
+	bool created = false;
+	if (readOnly) {
+		m_fd = ::open(path.c_str(), O_RDONLY);
+	} else {
+		m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+		created = m_fd >= 0;
+		if (m_fd < 0 && errno == EEXIST)
+			m_fd = ::open(path.c_str(), O_RDWR);
+	}
+	if (m_fd < 0) {
+		error = describe("cannot open", path);
+		return false;
+	}
+	m_path = path;
+	m_readOnly = readOnly;
+	m_windowSize = window ? window : 1;
+	m_window = Array<Block>(m_windowSize);
+	m_pending = Array<BlockRecord>(FLUSH_EVERY < m_windowSize ? FLUSH_EVERY : m_windowSize);
+	m_pendingCount = 0;
+	m_recovered = 0;
+	m_torn = 0;
+
+	struct stat st;
+	if (fstat(m_fd, &st) != 0) {
+		error = describe("cannot stat", path);
+		close();
+		return false;
+	}
+	size_t bytes = (size_t)st.st_size;
+	if (!readOnly && (created || bytes == 0)) {
+		Header h;
+		newHeader(&h);
+		if (!writeAll(m_fd, &h, sizeof(h), 0) || fsync(m_fd) != 0) {
+			error = describe("cannot initialise", path);
+			close();
+			return false;
+		}
+		bytes = sizeof(Header);
+	} else {
+		//anything else has to already be a chain, a short or foreign file is never overwritten
+		Header h;
+		if (bytes < sizeof(Header) || pread(m_fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0
+			|| h.version != VERSION || h.recordSize != sizeof(BlockRecord)) {
+			error = path + " is not a chain file";
+			close();
+			return false;
+		}
+	}
+
+	//a crash can leave half a record, or a whole one whose contents never reached the disk
+	size_t whole = (bytes - sizeof(Header)) / sizeof(BlockRecord);
+	m_torn = bytes - sizeof(Header) - whole * sizeof(BlockRecord);
+	m_written = whole;
+	m_count = whole;
+	if (!remap()) {
+		error = describe("cannot map", path);
+		close();
+		return false;
+	}
+	//read-only opens leave the tail as it is for the caller to judge
+	if (!readOnly && !recoverTail(error)) {
+		close();
+		return false;
+	}
+
+	size_t first = m_count > m_windowSize ? m_count - m_windowSize : 0;
+	for (size_t i = first; i < m_count; i++)
+		m_window[i % m_windowSize] = Block::fromRecord(*recordAt(i));
+	return true;
+}
+
+//only the tail is checked, a torn write can't reach further back than what was unsynced,
+//which is at most FLUSH_EVERY records, so anything worse is left alone for --verify to report
+bool ChainStore::recoverTail(std::string &error) {
+	size_t whole = m_written;
+	size_t good = whole;
+	while (good > 0 && whole - good <= FLUSH_EVERY) {
+		const BlockRecord *r = recordAt(good - 1);
+		bool linked = good < 2 || recordAt(good - 2)->solvedHash == r->previousHash;
+		if (r->valid() && linked)
+			break;
+		good--;
+	}
+	if (whole - good > FLUSH_EVERY) {
+		error = m_path + ": more than " + std::to_string(FLUSH_EVERY) + " bad blocks at the end, more than a crash can leave, not truncating";
+		return false;
+	}
+	if (good == whole && m_torn == 0)
+		return true;
+	m_recovered = whole - good;
+	unmap();
+	if (ftruncate(m_fd, sizeof(Header) + good * sizeof(BlockRecord)) != 0 || fsync(m_fd) != 0) {
+		error = describe("cannot truncate", m_path);
+		return false;
+	}
+	m_torn = 0;
+	m_written = good;
+	m_count = good;
+	if (!remap()) {
+		error = describe("cannot map", m_path);
+		return false;
+	}
+	return true;
+}
+
+bool ChainStore::close() {
+	bool ok = true;
+	if (m_fd >= 0) {
+		ok = flush();
+		ok = saveIndex() && ok;
+		unmap();
+		ok = ::close(m_fd) == 0 && ok;
+	}
+	m_fd = -1;
+	m_count = 0;
+	m_written = 0;
+	m_pendingCount = 0;
+	m_index.clear();
+	m_indexed = false;
+	m_indexDirty = false;
+	return ok;
+}
+
+bool ChainStore::isOpen() const {
+	return m_fd >= 0;
+}
+
+bool ChainStore::append(const Block &block) {
+	if (m_fd < 0 || m_readOnly)
+		return false;
+	//the index is rebuilt bigger from the blocks it already covers, then the new one goes in
+	if (m_indexed && (m_index.full() || m_count >= BlockIndex::MAX_BLOCKS) && !rebuildIndex())
+		return false;
+	m_window[m_count % m_windowSize] = block;
+	m_pending[m_pendingCount] = block.toRecord();
+	if (m_indexed) {
+		m_index.add(m_pending[m_pendingCount]);
+		m_indexDirty = true;
+	}
+	m_pendingCount++;
+	m_count++;
+	if (m_pendingCount == m_pending.size())
+		return flush();
+	return true;
+}
+
+bool ChainStore::flush() {
+	BC_TRACE_SPAN_ARG("store.flush", m_pendingCount);
+	if (m_fd < 0 || m_pendingCount == 0)
+		return m_fd >= 0;
+	off_t offset = sizeof(Header) + m_written * sizeof(BlockRecord);
+	if (!writeAll(m_fd, &m_pending[0], m_pendingCount * sizeof(BlockRecord), offset))
+		return false;
+	m_written += m_pendingCount;
+	m_pendingCount = 0;
+	return true;
+}
+
+bool ChainStore::sync() {
+	BC_TRACE_SPAN("store.sync");
+	if (m_readOnly)
+		return m_fd >= 0 && saveIndex();
+	return flush() && fdatasync(m_fd) == 0 && saveIndex();
+}
+
+size_t ChainStore::size() const { return m_count; }
+bool ChainStore::empty() const { return m_count == 0; }
+size_t ChainStore::recovered() const { return m_recovered; }
+size_t ChainStore::tornBytes() const { return m_torn; }
+bool ChainStore::readOnly() const { return m_readOnly; }
+const std::string &ChainStore::path() const { return m_path; }
+
+Block ChainStore::at(size_t i) const {
+	if (i >= m_count)
+		throw std::out_of_range("ChainStore::at: " + std::to_string(i) + " >= " + std::to_string(m_count));
+	if (m_count - i <= m_windowSize)
+		return m_window[i % m_windowSize];
+	//outside the window means it was flushed long ago
+	const BlockRecord *r = recordAt(i);
+	if (r == NULL)
+		throw std::runtime_error(describe("cannot map", m_path));
+	return Block::fromRecord(*r);
+}
+
+Block ChainStore::tip() const {
+	return at(m_count - 1);
+}
+
+const BlockRecord *ChainStore::records(size_t &count) const {
+	if (m_mapped < m_written && !remap()) {
+		count = 0;
+		return NULL;
+	}
+	count = m_mapped;
+	return m_map ? (const BlockRecord *)(m_map + sizeof(Header)) : NULL;
+}
+
+bool ChainStore::mapAll() const {
+	return m_mapped >= m_written || remap();
+}
+
+bool ChainStore::index(unsigned threads) {
+	if (m_fd < 0)
+		return false;
+	m_indexThreads = threads ? threads : 1;
+	if (m_indexed)
+		return true;
+	if (!flush())
+		return false;
+	size_t count;
+	const BlockRecord *all = records(count);
+	if ((all == NULL && m_written) || count > BlockIndex::MAX_BLOCKS)
+		return false;
+	m_indexed = true;
+	if (m_index.load(m_path + ".idx", all, count)) {
+		m_indexDirty = m_index.size() != count || m_index.full();
+		if (m_index.full())
+			return rebuildIndex();
+		return true;
+	}
+	return rebuildIndex();
+}
+
+bool ChainStore::rebuildIndex() {
+	size_t count = 0;
+	const BlockRecord *all = NULL;
+	if (!flush() || m_count > BlockIndex::MAX_BLOCKS || ((all = records(count)) == NULL && m_written)) {
+		m_index.clear();
+		m_indexed = false;
+		return false;
+	}
+	m_index.build(all, count, m_indexThreads);
+	m_indexDirty = true;
+	return true;
+}
+
+//written with the chain already flushed, so the blocks it covers are all in the file
+bool ChainStore::saveIndex() {
+	if (!m_indexed || !m_indexDirty || !flush())
+		return true;
+	BC_TRACE_SPAN("store.saveIndex");
+	if (!mapAll() || !m_index.save(m_path + ".idx", m_count ? recordFor(m_count - 1).solvedHash : 0))
+		return false;
+	m_indexDirty = false;
+	return true;
+}
+
+bool ChainStore::indexed() const { return m_indexed; }
+const BlockIndex &ChainStore::blockIndex() const { return m_index; }
+
+size_t ChainStore::findSolvedHash(size_t hash) const {
+	if (!m_indexed || !mapAll())
+		return BlockIndex::NPOS;
+	return m_index.findSolvedHash(hash, [this](size_t i) -> const BlockRecord & { return recordFor(i); });
+}
+
+size_t ChainStore::findId(unsigned id) const {
+	if (!m_indexed || !mapAll())
+		return BlockIndex::NPOS;
+	return m_index.findId(id, [this](size_t i) -> const BlockRecord & { return recordFor(i); });
+}
+
+size_t ChainStore::findParent(size_t i) const {
+	if (i >= m_count || !mapAll())
+		return BlockIndex::NPOS;
+	return findSolvedHash(recordFor(i).previousHash);
+}
+
+const BlockRecord &ChainStore::recordFor(size_t i) const {
+	if (i >= m_written)
+		return m_pending[i - m_written];
+	return *recordAt(i);
+}
+
+const BlockRecord *ChainStore::recordAt(size_t i) const {
+	if (i >= m_mapped && (i >= m_written || !remap()))
+		return NULL;
+	return (const BlockRecord *)(m_map + sizeof(Header)) + i;
+}
+
+//the new mapping is made before the old one goes, so a failure leaves the records that were already mapped readable
+bool ChainStore::remap() const {
+	size_t bytes = sizeof(Header) + m_written * sizeof(BlockRecord);
+	void *p = mmap(NULL, bytes, PROT_READ, MAP_SHARED, m_fd, 0);
+	if (p == MAP_FAILED)
+		return false;
+	unmap();
+	m_map = (const uint8_t *)p;
+	m_mapBytes = bytes;
+	m_mapped = m_written;
+	return true;
+}
+
+void ChainStore::unmap() const {
+	if (m_map)
+		munmap((void *)m_map, m_mapBytes);
+	m_map = NULL;
+	m_mapBytes = 0;
+	m_mapped = 0;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "Array.hpp"
+#include "Block.hpp"
+#include "BlockIndex.hpp"
+
+//append-only file of BlockRecords behind a small header, read back through mmap
+//only the last window blocks are kept in memory, older ones come straight from the mapping,
+//so a chain of any length costs a constant amount of RAM and opening one never reads more than the window
+//open() drops a torn or garbled tail left by a crash, back to the last record that checks out, but never more than
+//FLUSH_EVERY records, and only ever writes a header into a file it created or one that is empty
+//openReadOnly() never writes the chain file and leaves a bad tail for the caller to find
+//index() adds hash lookups by solvedHash and id, kept up to date by append() and saved next to the chain as <path>.idx
+class ChainStore {
+
+public:
+
+	static const unsigned DEFAULT_WINDOW = 1024;
+	static const unsigned FLUSH_EVERY = 256; //records buffered before they're written out, never more than the window
+	static const size_t HEADER_BYTES = 32;
+
+	//the header of a new chain file, for writers that stream records in this format without a store
+	static void newHeader(void *out);
+
+private:
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t recordSize;
+		uint64_t reserved[2];
+	};
+
+	int m_fd;
+	std::string m_path;
+	size_t m_count;     //blocks in the chain, written or not
+	size_t m_written;   //blocks already in the file
+	size_t m_recovered; //records dropped by the last open
+	size_t m_torn;      //bytes of a partial record after the last whole one, only left in place by openReadOnly()
+	bool m_readOnly;
+
+	Array<Block> m_window; //block i sits at i % capacity while i is among the last capacity blocks
+	unsigned m_windowSize;
+	Array<BlockRecord> m_pending;
+	unsigned m_pendingCount;
+
+	mutable const uint8_t *m_map;
+	mutable size_t m_mapBytes;
+	mutable size_t m_mapped; //records covered by m_map
+
+	BlockIndex m_index;
+	bool m_indexed;
+	bool m_indexDirty; //blocks added since the index file was written
+	unsigned m_indexThreads;
+
+	bool openFile(const std::string &path, std::string &error, unsigned window, bool readOnly);
+	bool recoverTail(std::string &error);
+	bool remap() const;
+	void unmap() const;
+	bool mapAll() const; //maps every written record, false if the file can't be mapped
+	const BlockRecord *recordAt(size_t i) const; //NULL if it isn't written or can't be mapped
+	const BlockRecord &recordFor(size_t i) const; //written or still pending, once mapAll() has succeeded
+	bool rebuildIndex();
+	bool saveIndex();
+
+public:
+
+	ChainStore();
+	~ChainStore();
+
+	ChainStore(const ChainStore&) = delete;
+	ChainStore& operator=(const ChainStore&) = delete;
+
+	//opens or creates path, window is how many of the newest blocks stay in memory
+	bool open(const std::string &path, std::string &error, unsigned window = DEFAULT_WINDOW);
+	//an existing chain file as it is, append() fails and only <path>.idx is ever written
+	bool openReadOnly(const std::string &path, std::string &error, unsigned window = DEFAULT_WINDOW);
+	bool close();
+	bool isOpen() const;
+
+	bool append(const Block &block);
+	bool flush(); //writes buffered blocks to the file
+	bool sync();  //flush, then wait for the disk
+
+	size_t size() const;
+	bool empty() const;
+	size_t recovered() const;
+	size_t tornBytes() const;
+	bool readOnly() const;
+	const std::string &path() const;
+
+	Block at(size_t i) const; //throws std::runtime_error if block i has to come from the file and it can't be mapped
+	Block tip() const; //newest block, size() must not be 0
+
+	//every written record, valid until the next flush or close, count gets how many there are
+	//NULL with count 0 if the file can't be mapped
+	const BlockRecord *records(size_t &count) const;
+
+	//loads <path>.idx if it still matches the chain, otherwise builds the index on threads threads
+	bool index(unsigned threads = 1);
+	bool indexed() const;
+	const BlockIndex &blockIndex() const;
+	//positions of the first block with that solvedHash or id, BlockIndex::NPOS if there's none, no index or the file can't be mapped
+	size_t findSolvedHash(size_t hash) const;
+	size_t findId(unsigned id) const;
+	size_t findParent(size_t i) const; //the block whose solvedHash is block i's previousHash
+
+};
@@ -0,0 +1,135 @@
+#include "ChainVerifier.hpp"
+
+#include <atomic>
+#include "HashPolicy.hpp"
+
+//small enough that every worker gets many, large enough that taking one is noise next to hashing it
+static const size_t MIN_SEGMENT = 1 << 14;
+static const size_t SEGMENTS_PER_THREAD = 16;
+static const size_t NO_FAILURE = SIZE_MAX;
+
+namespace {
+
+//the checks only need these fields, so both storage layouts get the same code
+struct RecordView {
+	const BlockRecord *records;
+
+	bool intact(size_t i) const { return records[i].valid(); }
+	uint32_t id(size_t i) const { return records[i].id; }
+	uint64_t previousHash(size_t i) const { return records[i].previousHash; }
+	uint64_t solvedHash(size_t i) const { return records[i].solvedHash; }
+	uint64_t nonce(size_t i) const { return records[i].nonce; }
+	uint64_t threshold(size_t i) const { return records[i].threshold; }
+	bool noSolution(size_t i) const { return (records[i].flags & BlockRecord::NO_SOLUTION) != 0; }
+	int hashPolicy(size_t i) const { return (records[i].flags & BlockRecord::HASH_MASK) >> BlockRecord::HASH_SHIFT; }
+};
+
+//columns live in memory and carry no checksum
+struct ColumnView {
+	const uint32_t *ids;
+	const uint64_t *previousHashes;
+	const uint64_t *solvedHashes;
+	const uint64_t *nonces;
+	const uint64_t *thresholds;
+	const uint8_t *flags;
+
+	bool intact(size_t) const { return true; }
+	uint32_t id(size_t i) const { return ids[i]; }
+	uint64_t previousHash(size_t i) const { return previousHashes[i]; }
+	uint64_t solvedHash(size_t i) const { return solvedHashes[i]; }
+	uint64_t nonce(size_t i) const { return nonces[i]; }
+	uint64_t threshold(size_t i) const { return thresholds[i]; }
+	bool noSolution(size_t i) const { return (flags[i] & BlockRecord::NO_SOLUTION) != 0; }
+	int hashPolicy(size_t i) const { return (flags[i] & BlockRecord::HASH_MASK) >> BlockRecord::HASH_SHIFT; }
+};
+
+template<class View>
+int checkOne(const View &v, size_t i) {
+	if (!v.intact(i))
+		return VERIFY_BAD_RECORD;
+	if (v.noSolution(i)) {
+		//unsolvable blocks carry their policy's sentinel, see Block::setNoSolution
+		return v.solvedHash(i) == noSolutionWith(v.hashPolicy(i), v.previousHash(i), v.id(i)) ? VERIFY_OK : VERIFY_BAD_HASH;
+	}
+	if (hashWith(v.hashPolicy(i), v.previousHash(i), v.nonce(i), v.id(i)) != v.solvedHash(i))
+		return VERIFY_BAD_HASH;
+	if (v.solvedHash(i) > v.threshold(i))
+		return VERIFY_ABOVE_TARGET;
+	return VERIFY_OK;
+}
+
+template<class View>
+int checkAt(const View &v, size_t i, const size_t *startHash) {
+	int reason = checkOne(v, i);
+	if (reason == VERIFY_OK && i > 0 && v.id(i) != v.id(i - 1) + 1)
+		reason = VERIFY_BAD_ID;
+	if (reason == VERIFY_OK && (i > 0 ? v.solvedHash(i - 1) : startHash ? *startHash : v.previousHash(i)) != v.previousHash(i))
+		reason = VERIFY_BAD_LINK;
+	return reason;
+}
+
+template<class View>
+VerifyResult verify(const View &v, size_t count, MinerPool &pool, const size_t *startHash) {
+	size_t segment = count / ((size_t)pool.size() * SEGMENTS_PER_THREAD);
+	if (segment < MIN_SEGMENT)
+		segment = MIN_SEGMENT;
+	std::atomic<size_t> nextSegment(0);
+	std::atomic<size_t> firstBad(NO_FAILURE);
+	std::atomic<size_t> checked(0);
+
+	int64_t started = MinerPool::now();
+	pool.run([&](unsigned, unsigned) {
+		size_t done = 0;
+		while (true) {
+			size_t begin = nextSegment.fetch_add(1, std::memory_order_relaxed) * segment;
+			//segments go out in order, so once one starts above a known failure so will every later one
+			if (begin >= count || begin >= firstBad.load(std::memory_order_relaxed))
+				break;
+			size_t end = count - begin < segment ? count : begin + segment;
+			for (size_t i = begin; i < end; i++) {
+				done++;
+				if (checkAt(v, i, startHash) == VERIFY_OK)
+					continue;
+				size_t seen = firstBad.load(std::memory_order_relaxed);
+				while (i < seen && !firstBad.compare_exchange_weak(seen, i, std::memory_order_relaxed));
+				break;
+			}
+		}
+		checked.fetch_add(done, std::memory_order_relaxed);
+	});
+
+	VerifyResult result;
+	result.firstInvalid = firstBad.load(std::memory_order_relaxed);
+	result.ok = result.firstInvalid == NO_FAILURE;
+	result.reason = result.ok ? VERIFY_OK : checkAt(v, result.firstInvalid, startHash); //cheaper than racing to publish it
+	result.checked = checked.load(std::memory_order_relaxed);
+	result.seconds = (MinerPool::now() - started) / 1e9;
+	return result;
+}
+
+}
+
+int verifyRecord(const BlockRecord &record) {
+	return checkOne(RecordView{&record}, 0);
+}
+
+VerifyResult verifyChain(const BlockRecord *records, size_t count, MinerPool &pool, const size_t *startHash) {
+	return verify(RecordView{records}, count, pool, startHash);
+}
+
+VerifyResult verifyChain(const ChainColumns &chain, MinerPool &pool, const size_t *startHash) {
+	ColumnView v = {chain.ids(), chain.previousHashes(), chain.solvedHashes(), chain.nonces(), chain.thresholds(), chain.flags()};
+	return verify(v, chain.size(), pool, startHash);
+}
+
+const char *verifyReasonName(int reason) {
+	switch (reason) {
+	case VERIFY_OK: return "ok";
+	case VERIFY_BAD_RECORD: return "corrupt record";
+	case VERIFY_BAD_ID: return "id out of sequence";
+	case VERIFY_BAD_LINK: return "previous hash doesn't link";
+	case VERIFY_BAD_HASH: return "solved hash doesn't match nonce";
+	case VERIFY_ABOVE_TARGET: return "solved hash above difficulty target";
+	}
+	return "unknown";
+}
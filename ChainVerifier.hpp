@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include "Block.hpp"
+#include "ChainColumns.hpp"
+#include "MinerPool.hpp"
+
+//why a block failed verification
+const int VERIFY_OK = 0;
+const int VERIFY_BAD_RECORD = 1;   //checksum mismatch or impossible difficulty
+const int VERIFY_BAD_ID = 2;       //ids don't count up by one
+const int VERIFY_BAD_LINK = 3;     //previousHash isn't the solvedHash before it
+const int VERIFY_BAD_HASH = 4;     //solvedHash isn't hash(previousHash, nonce)
+const int VERIFY_ABOVE_TARGET = 5; //solvedHash is above the block's threshold
+
+struct VerifyResult {
+	bool ok;
+	size_t firstInvalid; //index of the lowest bad record, only meaningful if !ok
+	int reason;
+	size_t checked;      //records hashed, can stop short once an early failure is known
+	double seconds;
+};
+
+//checks every record on its own and against the one before it, the first against startHash if one is given
+//the chain is cut into segments that the pool's workers take in order, workers skip any segment above a
+//failure already found, so the reported block is always the lowest invalid one
+VerifyResult verifyChain(const BlockRecord *records, size_t count, MinerPool &pool, const size_t *startHash = NULL);
+//same checks straight off the columns, minus the record checksums
+VerifyResult verifyChain(const ChainColumns &chain, MinerPool &pool, const size_t *startHash = NULL);
+
+//single record check without the link, VERIFY_OK or the reason it fails
+int verifyRecord(const BlockRecord &record);
+
+const char *verifyReasonName(int reason);
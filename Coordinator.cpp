@@ -0,0 +1,362 @@
+#include "Coordinator.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "MinerPool.hpp"
+#include "ThreadMine.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+//the lease end is exclusive, so SIZE_MAX itself is never handed out
+const size_t NONCE_LIMIT = SIZE_MAX;
+const unsigned MAX_WORKER_THREADS = 4096;
+
+}
+
+Coordinator::Coordinator(size_t leaseNonces, unsigned leaseMs)
+	: m_listen(-1), m_leaseNonces(leaseNonces ? leaseNonces : 1), m_leaseMs(leaseMs ? leaseMs : 1), m_block(NULL), m_epoch(0),
+	m_lowest(true), m_fresh(0), m_nextLease(1), m_found(false), m_best(0), m_stats() {}
+
+//closing the sockets is what tells workers to exit
+Coordinator::~Coordinator() {
+	for (Peer *p : m_peers) {
+		close(p->fd);
+		delete p;
+	}
+	if (m_listen >= 0) {
+		close(m_listen);
+		unlink(m_path.c_str());
+	}
+}
+
+bool Coordinator::listen(const std::string &path, std::string &error) {
+	m_listen = lease::listenUnix(path, error);
+	if (m_listen < 0)
+		return false;
+	m_path = path;
+	return true;
+}
+
+bool Coordinator::mine(Block &block, int mode, std::string &error) {
+	BC_TRACE_SPAN_ARG("coordinator.block", block.getId());
+	int64_t started = MinerPool::now();
+	m_block = &block;
+	m_epoch++;
+	m_lowest = mode == MINE_LOWEST_NONCE;
+	m_fresh = 0;
+	m_leases.clear();
+	m_pending.clear();
+	m_found = false;
+	m_best = 0;
+	lease::Message job = lease::message(lease::BLOCK, m_epoch, block.getId(), block.getPreviousHash(), block.getThreshold(), block.getHashPolicy());
+	for (size_t i = m_peers.size(); i-- > 0;)
+		if (m_peers[i]->threads && !lease::send(m_peers[i]->fd, job, true))
+			drop(i);
+
+	Array<pollfd> fds;
+	int64_t dispatched = 0;
+	int64_t decidedAt = 0;
+	bool failed = false;
+	while (true) {
+		int64_t now = MinerPool::now();
+		expire(now);
+		assign(now);
+		if (dispatched == 0 && !m_leases.empty())
+			dispatched = MinerPool::now();
+		if (decided()) {
+			decidedAt = now;
+			break;
+		}
+		int timeout = m_leaseMs;
+		for (const Lease &l : m_leases)
+			timeout = std::min<int64_t>(timeout, (l.deadline - now) / 1000000 + 1);
+		fds.resize(m_peers.size() + 1);
+		fds[0] = {m_listen, POLLIN, 0};
+		for (size_t i = 0; i < m_peers.size(); i++)
+			fds[i + 1] = {m_peers[i]->fd, POLLIN, 0};
+		//can't go on, but the search didn't finish either, so the block is left unsolved rather than marked as having no solution
+		if (poll(fds.data(), fds.size(), std::max(timeout, 1)) < 0 && errno != EINTR) {
+			error = std::string("cannot poll workers: ") + strerror(errno);
+			decidedAt = MinerPool::now();
+			failed = true;
+			break;
+		}
+		//backwards, since drop() moves the last peer into the dropped one's place
+		for (size_t i = m_peers.size(); i-- > 0;)
+			if (fds[i + 1].revents && !receive(i))
+				drop(i);
+		if (fds[0].revents & POLLIN)
+			accept();
+		if (decided()) {
+			decidedAt = MinerPool::now();
+			break;
+		}
+	}
+	stop();
+	int64_t stopped = MinerPool::now();
+	m_stats.stopNanos += stopped - decidedAt;
+	if (m_found)
+		block.tryNonce(m_best);
+	else if (!failed)
+		block.setNoSolution();
+	m_block = NULL;
+	if (dispatched == 0)
+		dispatched = decidedAt;
+	m_lastPhases.dispatch = dispatched - started;
+	m_lastPhases.search = decidedAt - dispatched;
+	m_lastPhases.cancel = stopped - decidedAt;
+	m_lastPhases.join = MinerPool::now() - stopped;
+	return !failed;
+}
+
+void Coordinator::accept() {
+	int fd = accept4(m_listen, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+	Peer *p = new Peer();
+	p->fd = fd;
+	p->threads = 0;
+	p->pid = 0;
+	p->suspect = false;
+	m_peers.push_back(p);
+}
+
+void Coordinator::drop(size_t peer) {
+	Peer *p = m_peers[peer];
+	if (p->threads)
+		m_stats.workersLost++;
+	for (size_t i = m_leases.size(); i-- > 0;)
+		if (m_leases[i].peer == (int)peer) {
+			reclaim(m_leases[i]);
+			removeLease(i);
+		}
+	close(p->fd);
+	delete p;
+	size_t last = m_peers.size() - 1;
+	m_peers[peer] = m_peers[last];
+	m_peers.pop_back();
+	for (Lease &l : m_leases)
+		if (l.peer == (int)last)
+			l.peer = peer;
+}
+
+bool Coordinator::receive(size_t peer) {
+	Peer *p = m_peers[peer];
+	if (!p->reader.fill(p->fd))
+		return false;
+	lease::Message m;
+	while (p->reader.next(m))
+		if (!handle(peer, m))
+			return false;
+	return true;
+}
+
+bool Coordinator::handle(size_t peer, const lease::Message &m) {
+	Peer *p = m_peers[peer];
+	p->suspect = false;
+	if (m.type == lease::HELLO) {
+		if (m.a != lease::VERSION || p->threads)
+			return false;
+		p->threads = (unsigned)std::min<uint64_t>(std::max<uint64_t>(m.b, 1), MAX_WORKER_THREADS);
+		p->pid = m.c;
+		m_stats.workersJoined++;
+		if (m_block)
+			return lease::send(p->fd, lease::message(lease::BLOCK, m_epoch, m_block->getId(), m_block->getPreviousHash(), m_block->getThreshold(), m_block->getHashPolicy()), true);
+		return true;
+	}
+	if (p->threads == 0)
+		return false; //nothing but HELLO before HELLO
+	if (m.type != lease::PROGRESS && m.type != lease::DONE && m.type != lease::FOUND)
+		return false;
+	if (m_block == NULL || m.epoch != m_epoch)
+		return true; //about a block that's already decided
+	int i = leaseIndex(m.a, peer);
+	if (i < 0)
+		return true; //expired, cancelled or trimmed away
+	Lease &l = m_leases[i];
+	if (m.type == lease::PROGRESS) {
+		l.next = std::max(l.next, std::min<size_t>(m.b, l.end));
+		l.deadline = MinerPool::now() + m_leaseMs * (int64_t)1000000;
+		if (l.next >= l.end)
+			removeLease(i); //reached a trimmed end
+	} else if (m.type == lease::DONE) {
+		removeLease(i);
+	} else {
+		//a worker's word isn't enough to end a block on
+		if (m.b < l.next || !static_cast<const Block &>(*m_block).tryNonce(m.b))
+			return false;
+		//at or past a trimmed end it still means nothing below that end solves it
+		bool better = m.b < l.end && (!m_found || m.b < m_best);
+		removeLease(i);
+		if (better) {
+			m_found = true;
+			m_best = m.b;
+			trimTo(m_best);
+		}
+	}
+	return true;
+}
+
+void Coordinator::expire(int64_t now) {
+	for (size_t i = m_leases.size(); i-- > 0;)
+		if (m_leases[i].deadline <= now) {
+			m_stats.expired++;
+			m_peers[m_leases[i].peer]->suspect = true;
+			reclaim(m_leases[i]);
+			removeLease(i);
+		}
+}
+
+void Coordinator::assign(int64_t now) {
+	for (size_t i = m_peers.size(); i-- > 0;) {
+		Peer *p = m_peers[i];
+		if (p->threads == 0 || p->suspect)
+			continue;
+		while (leasesOf(i) < p->threads + PREFETCH) {
+			Range r;
+			if (!take(r))
+				return;
+			if (!give(i, r, now)) {
+				drop(i);
+				break;
+			}
+		}
+	}
+}
+
+//lost ranges first, lowest first, so lowest nonce mode isn't left waiting on a hole near the bottom
+bool Coordinator::take(Range &r) {
+	if (!m_pending.empty()) {
+		size_t low = 0;
+		for (size_t i = 1; i < m_pending.size(); i++)
+			if (m_pending[i].begin < m_pending[low].begin)
+				low = i;
+		Range &p = m_pending[low];
+		r.begin = p.begin;
+		r.end = p.end - p.begin > m_leaseNonces ? p.begin + m_leaseNonces : p.end;
+		p.begin = r.end;
+		if (p.begin == p.end) {
+			m_pending[low] = m_pending.back();
+			m_pending.pop_back();
+		}
+		m_stats.reassigned++;
+		return true;
+	}
+	//every fresh lease would start above any solution already found
+	if (m_found || m_fresh >= NONCE_LIMIT)
+		return false;
+	r.begin = m_fresh;
+	r.end = NONCE_LIMIT - m_fresh > m_leaseNonces ? m_fresh + m_leaseNonces : NONCE_LIMIT;
+	m_fresh = r.end;
+	return true;
+}
+
+bool Coordinator::give(size_t peer, const Range &r, int64_t now) {
+	Lease l;
+	l.id = m_nextLease++;
+	l.peer = peer;
+	l.next = r.begin;
+	l.end = r.end;
+	l.deadline = now + m_leaseMs * (int64_t)1000000;
+	if (!lease::send(m_peers[peer]->fd, lease::message(lease::LEASE, m_epoch, l.id, r.begin, r.end, m_leaseMs), true)) {
+		reclaim(l);
+		return false;
+	}
+	m_leases.push_back(l);
+	m_stats.leases++;
+	return true;
+}
+
+void Coordinator::reclaim(const Lease &l) {
+	if (l.next < l.end && !(m_found && !m_lowest))
+		m_pending.push_back({l.next, l.end});
+}
+
+void Coordinator::removeLease(size_t i) {
+	m_leases[i] = m_leases.back();
+	m_leases.pop_back();
+}
+
+//in lowest nonce mode nothing at or above best can win any more: drop it from the pending ranges and
+//cut every lease short there, so its worker reports done as soon as it gets to best instead of at the old end
+void Coordinator::trimTo(size_t best) {
+	if (!m_lowest)
+		return;
+	for (size_t i = m_pending.size(); i-- > 0;) {
+		Range &r = m_pending[i];
+		r.end = std::min(r.end, best);
+		if (r.begin >= r.end) {
+			m_pending[i] = m_pending.back();
+			m_pending.pop_back();
+		}
+	}
+	for (size_t i = m_leases.size(); i-- > 0;) {
+		Lease &l = m_leases[i];
+		if (l.end <= best)
+			continue;
+		lease::send(m_peers[l.peer]->fd, lease::message(lease::TRIM, m_epoch, l.id, best), true);
+		l.end = best;
+		if (l.next >= l.end)
+			removeLease(i);
+	}
+}
+
+bool Coordinator::decided() const {
+	if (m_found && !m_lowest)
+		return true;
+	if (!m_pending.empty() || !m_leases.empty())
+		return false;
+	return m_found || m_fresh >= NONCE_LIMIT;
+}
+
+//the STOP frames go out back to back before anything else happens, each worker's reader thread is
+//blocked on its socket and flags its mining threads as soon as the frame lands
+void Coordinator::stop() {
+	lease::Message m = lease::message(lease::STOP, m_epoch);
+	for (size_t i = m_peers.size(); i-- > 0;)
+		if (m_peers[i]->threads && !lease::send(m_peers[i]->fd, m, true))
+			drop(i);
+	m_leases.clear();
+	m_pending.clear();
+}
+
+size_t Coordinator::leasesOf(size_t peer) const {
+	size_t n = 0;
+	for (const Lease &l : m_leases)
+		n += l.peer == (int)peer;
+	return n;
+}
+
+int Coordinator::leaseIndex(uint64_t id, size_t peer) const {
+	for (size_t i = 0; i < m_leases.size(); i++)
+		if (m_leases[i].id == id && m_leases[i].peer == (int)peer)
+			return (int)i;
+	return -1;
+}
+
+size_t Coordinator::workers() const {
+	size_t n = 0;
+	for (const Peer *p : m_peers)
+		n += p->threads != 0;
+	return n;
+}
+
+unsigned Coordinator::workerThreads() const {
+	unsigned n = 0;
+	for (const Peer *p : m_peers)
+		n += p->threads;
+	return n;
+}
+
+const Coordinator::Stats &Coordinator::stats() const {
+	return m_stats;
+}
+
+const BlockPhases &Coordinator::lastPhases() const {
+	return m_lastPhases;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "Array.hpp"
+#include "Block.hpp"
+#include "LeaseProtocol.hpp"
+#include "Metrics.hpp"
+
+//mines blocks on LeaseWorker processes instead of local threads
+//each block's nonce space is handed out in leases of leaseNonces consecutive nonces, as many per worker as it has
+//threads; a worker renews a lease by reporting progress, and a lease that isn't renewed within leaseMs, or
+//whose worker disconnects, goes back to be reassigned from where that worker got to
+//solutions are checked here before they count, and once the block is decided every worker gets STOP
+//mine() has threadMine's modes: lowest nonce waits for every lease below the best solution, so the chain is
+//the same as mining it locally; first found takes the first valid one reported
+//workers can connect and leave at any time, mine() waits for one if there are none
+class Coordinator {
+
+public:
+
+	static const size_t DEFAULT_LEASE_NONCES = 1 << 20;
+	static const unsigned DEFAULT_LEASE_MS = 2000;
+	static const unsigned PREFETCH = 1; //leases a worker holds beyond one per thread, so no thread waits on a round trip
+
+	struct Stats {
+		size_t leases;     //handed out, reassigned ones included
+		size_t reassigned; //leases given out again after their worker was lost or let them expire
+		size_t expired;
+		size_t workersJoined;
+		size_t workersLost; //disconnected or dropped for not reading
+		int64_t stopNanos;  //total time from the deciding message arriving to STOP being sent to every worker
+	};
+
+private:
+
+	struct Peer {
+		int fd;
+		unsigned threads; //0 until its HELLO
+		uint64_t pid;
+		bool suspect;     //let a lease expire, gets no more until it's heard from again
+		lease::Reader reader;
+	};
+
+	struct Lease {
+		uint64_t id;
+		int peer;    //index in m_peers
+		size_t next; //first nonce its worker hasn't reported as searched
+		size_t end;
+		int64_t deadline;
+	};
+
+	struct Range {
+		size_t begin, end;
+	};
+
+	std::string m_path;
+	int m_listen;
+	size_t m_leaseNonces;
+	unsigned m_leaseMs;
+	Array<Peer *> m_peers;
+
+	//the block being mined
+	Block *m_block;
+	uint64_t m_epoch;
+	bool m_lowest;
+	size_t m_fresh;        //nonces from here up have never been leased
+	Array<Lease> m_leases; //out with a worker
+	Array<Range> m_pending; //came back from a lost or expired lease
+	uint64_t m_nextLease;
+	bool m_found;
+	size_t m_best;
+
+	Stats m_stats;
+	BlockPhases m_lastPhases;
+
+	void accept();
+	void drop(size_t peer);
+	bool receive(size_t peer); //false if the peer is gone or broke the protocol
+	bool handle(size_t peer, const lease::Message &m);
+	void expire(int64_t now);
+	void assign(int64_t now);
+	bool take(Range &r);                                //the next range to lease, false if none is needed
+	bool give(size_t peer, const Range &r, int64_t now); //false if the peer couldn't be sent it
+	void reclaim(const Lease &l);
+	void removeLease(size_t i);
+	void trimTo(size_t best);
+	bool decided() const;
+	void stop();
+	size_t leasesOf(size_t peer) const;
+	int leaseIndex(uint64_t id, size_t peer) const;
+
+public:
+
+	Coordinator(size_t leaseNonces = DEFAULT_LEASE_NONCES, unsigned leaseMs = DEFAULT_LEASE_MS);
+	~Coordinator();
+
+	Coordinator(const Coordinator&) = delete;
+	Coordinator& operator=(const Coordinator&) = delete;
+
+	bool listen(const std::string &path, std::string &error);
+
+	//blocks until block is solved, or marked as having no solution once all of the nonce space came back empty
+	//false with error set if waiting on the workers failed, the block is left unsolved and every worker is stopped
+	bool mine(Block &block, int mode, std::string &error);
+
+	size_t workers() const; //connected and past HELLO
+	unsigned workerThreads() const;
+	const Stats &stats() const;
+	//dispatch until the first leases were out, search until the block was decided, cancel while STOP went out,
+	//join until mine() returned
+	const BlockPhases &lastPhases() const;
+
+};
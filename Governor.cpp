@@ -0,0 +1,118 @@
+#include "Governor.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+namespace {
+
+//quota over period from one cpu.max, 0 if it's missing or says max
+double readCpuMax(const std::string &path) {
+	FILE *f = fopen(path.c_str(), "r");
+	if (f == NULL)
+		return 0;
+	char quota[32];
+	unsigned long long period = 0;
+	double cpus = 0;
+	if (fscanf(f, "%31s %llu", quota, &period) == 2 && strcmp(quota, "max") != 0 && period > 0)
+		cpus = strtod(quota, NULL) / period;
+	fclose(f);
+	return cpus;
+}
+
+}
+
+void Governor::Bucket::set(double tokensPerSec, int64_t burstNanos) {
+	m_nanosPerToken = tokensPerSec > 0 ? 1e9 / tokensPerSec : 0;
+	m_burst = burstNanos;
+	m_due.store(0, std::memory_order_relaxed);
+}
+
+//the bucket is full when due is burst or more behind now, so an idle miner gets at most a burst's worth for free
+int64_t Governor::Bucket::take(double tokens, int64_t now) {
+	if (m_nanosPerToken == 0)
+		return 0;
+	int64_t cost = (int64_t)(tokens * m_nanosPerToken);
+	int64_t due = m_due.load(std::memory_order_relaxed);
+	int64_t next;
+	do
+		next = std::max(due, now - m_burst) + cost;
+	while (!m_due.compare_exchange_weak(due, next, std::memory_order_relaxed));
+	return next > now ? next - now : 0;
+}
+
+Governor::Governor(const GovernorPolicy &policy, unsigned threads, double quotaCpus) : m_policy(policy), m_quotaCpus(quotaCpus), m_throttled(0) {
+	double cpus = threads ? threads : 1;
+	if (quotaCpus > 0 && quotaCpus < cpus)
+		cpus = quotaCpus;
+	m_cpuBudget = policy.cpuPercent > 0 ? cpus * std::min(policy.cpuPercent, 100.0) / 100 : 0;
+	int64_t burst = policy.burstMs * (int64_t)1000000;
+	m_hashes.set(policy.maxHashrate, burst);
+	//a busy nanosecond is a token, and the budget's cpus pay off that many of them every nanosecond
+	m_cpu.set(m_cpuBudget * 1e9, burst);
+}
+
+int64_t Governor::charge(size_t nonces, int64_t busyNanos, int64_t now) {
+	int64_t wait = std::max(m_hashes.take((double)nonces, now), m_cpu.take((double)busyNanos, now));
+	if (wait < MIN_PAUSE_NANOS)
+		return 0;
+	m_throttled.fetch_add(1, std::memory_order_relaxed);
+	return wait;
+}
+
+double Governor::hashrateCap() const {
+	return m_policy.maxHashrate;
+}
+
+double Governor::cpuBudget() const {
+	return m_cpuBudget;
+}
+
+double Governor::quotaCpus() const {
+	return m_quotaCpus;
+}
+
+size_t Governor::throttled() const {
+	return m_throttled.load(std::memory_order_relaxed);
+}
+
+//a pure cgroup v2 host mounts the hierarchy at /sys/fs/cgroup, a hybrid one under unified/
+double Governor::cpuQuota() {
+	const char *mount = access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0 ? "/sys/fs/cgroup" : "/sys/fs/cgroup/unified";
+	return cpuQuota("/proc/self/cgroup", mount);
+}
+
+//the v2 line of /proc/<pid>/cgroup is 0::<path>; a parent's quota limits everything under it, so the lowest one wins
+double Governor::cpuQuota(const std::string &procCgroup, const std::string &mount) {
+	FILE *f = fopen(procCgroup.c_str(), "r");
+	if (f == NULL)
+		return 0;
+	std::string path;
+	char line[4096];
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, "0::", 3)) {
+			path = line + 3;
+			while (!path.empty() && (path.back() == '\n' || path.back() == '/'))
+				path.pop_back();
+			break;
+		}
+	fclose(f);
+	double lowest = 0;
+	while (true) {
+		double cpus = readCpuMax(mount + path + "/cpu.max");
+		if (cpus > 0 && (lowest == 0 || cpus < lowest))
+			lowest = cpus;
+		if (path.empty())
+			return lowest;
+		path.erase(path.rfind('/'));
+	}
+}
+
+int64_t Governor::threadCpuNanos() {
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * (int64_t)1000000000 + ts.tv_nsec;
+}
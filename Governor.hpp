@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+struct GovernorPolicy {
+	double maxHashrate = 0; //nonces per second over every thread together, 0 for no cap
+	double cpuPercent = 0;  //busy time as a percentage of the cpus mining may use, 0 for no target
+	unsigned burstMs = 20;  //how far ahead of either rate a miner that was idle may run
+};
+
+//paces mining on shared hosts to a hashrate cap and/or a cpu budget, so the miner's neighbours keep their cpu
+//each budget is a token bucket kept as the time its debt is paid off, so charging it is one CAS and no lock:
+//after every chunk a thread charges the nonces it hashed and the busy time they took, and sleeps until
+//the buckets have caught up, so pacing costs a few clock reads and atomics per chunk and nothing per nonce
+//the cpus mining may use are its threads, or the cgroup's cpu.max quota if that's lower, so --cpu 100
+//holds the miner just under its quota instead of running into the kernel's throttling
+//busy time is wall time spent hashing, which is cpu time as long as nothing else preempts the thread
+class Governor {
+
+	class Bucket {
+		double m_nanosPerToken; //0 for no limit
+		int64_t m_burst;
+		alignas(64) std::atomic<int64_t> m_due;
+	public:
+		Bucket() : m_nanosPerToken(0), m_burst(0), m_due(0) {}
+		void set(double tokensPerSec, int64_t burstNanos);
+		int64_t take(double tokens, int64_t now); //how long until the tokens are paid for, 0 if they already are
+	};
+
+	GovernorPolicy m_policy;
+	double m_quotaCpus;
+	double m_cpuBudget;
+	Bucket m_hashes;
+	Bucket m_cpu;
+	std::atomic<size_t> m_throttled;
+
+public:
+
+	static const int64_t SLICE_NANOS = 1000000; //longest single sleep, so a cancel never waits on the governor for more
+	static const int64_t MIN_PAUSE_NANOS = 500000; //a thread runs on until it's this far ahead, so it sleeps less often
+
+	//quotaCpus from cpuQuota(), 0 for none
+	Governor(const GovernorPolicy &policy, unsigned threads, double quotaCpus);
+
+	Governor(const Governor&) = delete;
+	Governor& operator=(const Governor&) = delete;
+
+	//a thread's chunk is done: nanoseconds it should wait before its next one, 0 to carry straight on
+	//the debt carries over either way, so holding off on short pauses doesn't change the rate
+	int64_t charge(size_t nonces, int64_t busyNanos, int64_t now);
+
+	//sleeps off a charge in slices of at most SLICE_NANOS, giving up as soon as stop() is true
+	template<class Stop>
+	void pause(int64_t nanos, Stop stop) {
+		for (int64_t asked = 0; asked < nanos && !stop(); asked += SLICE_NANOS)
+			std::this_thread::sleep_for(std::chrono::nanoseconds(nanos - asked < SLICE_NANOS ? nanos - asked : SLICE_NANOS));
+	}
+
+	double hashrateCap() const; //0 for none
+	double cpuBudget() const;   //cpus' worth of busy time per second, 0 for none
+	double quotaCpus() const;   //0 for none
+	size_t throttled() const;   //charges that had to wait
+
+	//cpus allowed by cpu.max in the calling process's cgroup v2 and every cgroup above it, 0 if none of them sets one
+	static double cpuQuota();
+	//the same from a /proc/<pid>/cgroup file and the cgroup2 mount, for tests and odd layouts
+	static double cpuQuota(const std::string &procCgroup, const std::string &mount);
+	//cpu time of the calling thread, for what the governor's sleeps cost beyond the sleep itself
+	static int64_t threadCpuNanos();
+
+};
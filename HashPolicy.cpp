@@ -0,0 +1,27 @@
+#include "HashPolicy.hpp"
+
+#include <cstring>
+
+size_t hashWith(int policy, size_t previousHash, size_t nonce, unsigned id) {
+	return withHashPolicy(policy, [&](auto hash) { return decltype(hash)::hash(previousHash, nonce, id); });
+}
+
+size_t noSolutionWith(int policy, size_t previousHash, unsigned id) {
+	return withHashPolicy(policy, [&](auto hash) { return decltype(hash)::noSolution(previousHash, id); });
+}
+
+const char *hashPolicyName(int policy) {
+	switch (policy) {
+	case HASH_FNV1A: return "fnv1a";
+	case HASH_MIX: return "mix";
+	case HASH_SHA256D: return "sha256d";
+	default: return "std";
+	}
+}
+
+int parseHashPolicy(const char *name) {
+	for (int p = 0; p < HASH_POLICIES; p++)
+		if (name != NULL && !strcmp(name, hashPolicyName(p)))
+			return p;
+	return -1;
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "NonceHasher.hpp"
+#include "Sha256.hpp"
+
+//how (previousHash, nonce) becomes a block's hash, chosen per block and carried in its record
+//std is the original std::hash<std::string> of the two numbers as text and matches every chain mined before
+//there was a choice, fnv1a and mix skip the text and are several times cheaper per nonce but give different chains,
+//sha256d is double SHA-256 over a binary header (see Sha256d) and the same on every platform and standard library
+//the block id is part of that header, the older policies take it and ignore it so their chains stay as they were
+//a block with no solution carries noSolution(previousHash, id) as its hash, std keeps the original hash of previousHash
+//as text, the others hash nonce SIZE_MAX so their sentinel is as portable as the rest of their chain
+//each policy has a one-shot hash() and a Cursor that scans consecutive nonces like NonceHasher::scan, templated
+//on the target, so a mining loop instantiated per policy and target inlines down to the hash itself
+const int HASH_STD = 0;
+const int HASH_FNV1A = 1;
+const int HASH_MIX = 2;
+const int HASH_SHA256D = 3;
+const int HASH_POLICIES = 4;
+
+//what a hash has to be at or below
+//RuntimeTarget reads the threshold each time, ZeroBitsTarget is a compile time leading zero test
+struct RuntimeTarget {
+	size_t limit;
+
+	size_t threshold() const { return limit; }
+	bool operator()(size_t hash) const { return hash <= limit; }
+};
+
+template<unsigned ZeroBits>
+struct ZeroBitsTarget {
+	static_assert(ZeroBits <= 64, "a 64 bit hash has at most 64 leading zeros");
+	static constexpr size_t LIMIT = ZeroBits >= 64 ? 0 : SIZE_MAX >> (ZeroBits % 64);
+
+	constexpr size_t threshold() const { return LIMIT; }
+	constexpr bool operator()(size_t hash) const {
+		if constexpr (ZeroBits == 0)
+			return true;
+		else if constexpr (ZeroBits >= 64)
+			return hash == 0;
+		else
+			return hash >> (64 - ZeroBits) == 0;
+	}
+};
+
+//hashes a whole batch before looking for a hit, a loop with no early exit the compiler can vectorise
+template<class Target, class HashAt>
+inline unsigned firstHit(unsigned count, const Target &target, size_t &hashOut, HashAt hashAt) {
+	size_t hashes[NonceHasher::MAX_BATCH];
+	if (count > NonceHasher::MAX_BATCH)
+		count = NonceHasher::MAX_BATCH;
+	unsigned hits = 0;
+	for (unsigned i = 0; i < count; i++) {
+		hashes[i] = hashAt(i);
+		hits |= target(hashes[i]);
+	}
+	if (hits)
+		for (unsigned i = 0; i < count; i++)
+			if (target(hashes[i])) {
+				hashOut = hashes[i];
+				return i;
+			}
+	return count;
+}
+
+struct StdHash {
+	static const int ID = HASH_STD;
+
+	static size_t hash(size_t previousHash, size_t nonce, unsigned) { return NonceHasher::hash(previousHash, nonce); }
+	static size_t noSolution(size_t previousHash, unsigned) { return std::hash<std::string>()(std::to_string(previousHash)); }
+
+	//the batch kernels are picked from cpuid at run time and compare against a broadcast threshold, so a fixed
+	//target doesn't reach them and the std loops test the threshold at run time whatever Target is
+	class Cursor {
+		NonceHasher m_hasher;
+	public:
+		Cursor(size_t previousHash, unsigned) : m_hasher(previousHash) {}
+		void seek(size_t nonce) { m_hasher.seek(nonce); }
+		template<class Target>
+		unsigned scan(unsigned count, const Target &target, size_t &hashOut) { return m_hasher.scan(count, target.threshold(), hashOut); }
+	};
+};
+
+//fnv-1a over the little endian bytes of previousHash then nonce, the cursor keeps the state after previousHash
+struct Fnv1aHash {
+	static const int ID = HASH_FNV1A;
+	static const size_t BASIS = 0xcbf29ce484222325ULL;
+	static const size_t PRIME = 0x100000001b3ULL;
+
+	static size_t absorb(size_t h, size_t word) {
+		for (unsigned i = 0; i < 8; i++) {
+			h ^= word >> (8 * i) & 0xff;
+			h *= PRIME;
+		}
+		return h;
+	}
+	static size_t hash(size_t previousHash, size_t nonce, unsigned) { return absorb(absorb(BASIS, previousHash), nonce); }
+	static size_t noSolution(size_t previousHash, unsigned id) { return hash(previousHash, SIZE_MAX, id); }
+
+	class Cursor {
+		size_t m_mid;
+		size_t m_nonce;
+	public:
+		Cursor(size_t previousHash, unsigned) : m_mid(absorb(BASIS, previousHash)), m_nonce(0) {}
+		void seek(size_t nonce) { m_nonce = nonce; }
+		template<class Target>
+		unsigned scan(unsigned count, const Target &target, size_t &hashOut) {
+			size_t first = m_nonce;
+			m_nonce += count;
+			return firstHit(count, target, hashOut, [&](unsigned i) { return absorb(m_mid, first + i); });
+		}
+	};
+};
+
+//previousHash and nonce folded into one word, then a multiply-xorshift finaliser (moremur constants)
+struct MixHash {
+	static const int ID = HASH_MIX;
+
+	static size_t hash(size_t previousHash, size_t nonce, unsigned) {
+		size_t h = (previousHash ^ 0x243f6a8885a308d3ULL) + nonce * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 27;
+		h *= 0x3c79ac492ba7b653ULL;
+		h ^= h >> 33;
+		h *= 0x1c69b3f74ac4ae35ULL;
+		h ^= h >> 27;
+		return h;
+	}
+	static size_t noSolution(size_t previousHash, unsigned id) { return hash(previousHash, SIZE_MAX, id); }
+
+	class Cursor {
+		size_t m_previousHash;
+		size_t m_nonce;
+	public:
+		Cursor(size_t previousHash, unsigned) : m_previousHash(previousHash), m_nonce(0) {}
+		void seek(size_t nonce) { m_nonce = nonce; }
+		template<class Target>
+		unsigned scan(unsigned count, const Target &target, size_t &hashOut) {
+			size_t first = m_nonce;
+			m_nonce += count;
+			return firstHit(count, target, hashOut, [&](unsigned i) { return hash(m_previousHash, first + i, 0); });
+		}
+	};
+};
+
+//the cursor keeps the midstate of the header's first 64 bytes, each nonce is two SHA-256 compressions
+struct Sha256dHash {
+	static const int ID = HASH_SHA256D;
+
+	static size_t hash(size_t previousHash, size_t nonce, unsigned id) { return Sha256d::hash(id, previousHash, nonce); }
+	static size_t noSolution(size_t previousHash, unsigned id) { return hash(previousHash, SIZE_MAX, id); }
+
+	class Cursor {
+		Sha256d m_header;
+		size_t m_nonce;
+	public:
+		Cursor(size_t previousHash, unsigned id) : m_header(id, previousHash), m_nonce(0) {}
+		void seek(size_t nonce) { m_nonce = nonce; }
+		template<class Target>
+		unsigned scan(unsigned count, const Target &target, size_t &hashOut) {
+			size_t first = m_nonce;
+			m_nonce += count;
+			return firstHit(count, target, hashOut, [&](unsigned i) { return m_header.hash(first + i); });
+		}
+	};
+};
+
+size_t hashWith(int policy, size_t previousHash, size_t nonce, unsigned id);
+size_t noSolutionWith(int policy, size_t previousHash, unsigned id);
+const char *hashPolicyName(int policy);
+int parseHashPolicy(const char *name); //-1 if it isn't std, fnv1a, mix or sha256d
+
+//calls f with an instance of the policy's type, so f can be a generic lambda that instantiates per policy
+template<class F>
+auto withHashPolicy(int policy, F &&f) {
+	switch (policy) {
+	case HASH_FNV1A: return f(Fnv1aHash());
+	case HASH_MIX: return f(MixHash());
+	case HASH_SHA256D: return f(Sha256dHash());
+	default: return f(StdHash());
+	}
+}
+
+//calls f with ZeroBitsTarget<4 * d>() when threshold is exactly difficulty d's (0 .. 16), RuntimeTarget otherwise
+template<unsigned D = 0, class F>
+auto withTarget(size_t threshold, F &&f) {
+	if constexpr (D > 16) {
+		return f(RuntimeTarget{threshold});
+	} else {
+		if (threshold == ZeroBitsTarget<4 * D>::LIMIT)
+			return f(ZeroBitsTarget<4 * D>());
+		return withTarget<D + 1>(threshold, f);
+	}
+}
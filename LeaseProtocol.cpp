@@ -0,0 +1,164 @@
+#include "LeaseProtocol.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace lease {
+
+namespace {
+
+void put(uint8_t *p, uint64_t v, unsigned bytes) {
+	for (unsigned i = 0; i < bytes; i++)
+		p[i] = v >> (8 * i);
+}
+
+uint64_t get(const uint8_t *p, unsigned bytes) {
+	uint64_t v = 0;
+	for (unsigned i = bytes; i-- != 0;)
+		v = v << 8 | p[i];
+	return v;
+}
+
+bool address(const std::string &path, sockaddr_un &addr, std::string &error) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+		error = path + ": socket path must be 1 to " + std::to_string(sizeof(addr.sun_path) - 1) + " bytes";
+		return false;
+	}
+	memcpy(addr.sun_path, path.c_str(), path.size());
+	return true;
+}
+
+}
+
+Message message(uint32_t type, uint64_t epoch, uint64_t a, uint64_t b, uint64_t c, uint64_t d) {
+	Message m;
+	m.type = type;
+	m.epoch = epoch;
+	m.a = a;
+	m.b = b;
+	m.c = c;
+	m.d = d;
+	return m;
+}
+
+void encode(const Message &m, uint8_t out[WIRE_BYTES]) {
+	put(out, m.type, 4);
+	put(out + 4, 0, 4);
+	put(out + 8, m.epoch, 8);
+	put(out + 16, m.a, 8);
+	put(out + 24, m.b, 8);
+	put(out + 32, m.c, 8);
+	put(out + 40, m.d, 8);
+}
+
+Message decode(const uint8_t in[WIRE_BYTES]) {
+	return message((uint32_t)get(in, 4), get(in + 8, 8), get(in + 16, 8), get(in + 24, 8), get(in + 32, 8), get(in + 40, 8));
+}
+
+const char *typeName(uint32_t type) {
+	switch (type) {
+	case HELLO: return "hello";
+	case BLOCK: return "block";
+	case LEASE: return "lease";
+	case PROGRESS: return "progress";
+	case DONE: return "done";
+	case FOUND: return "found";
+	case TRIM: return "trim";
+	case STOP: return "stop";
+	default: return "unknown";
+	}
+}
+
+bool send(int fd, const Message &m, bool nonblocking) {
+	uint8_t frame[WIRE_BYTES];
+	encode(m, frame);
+	int flags = MSG_NOSIGNAL | (nonblocking ? MSG_DONTWAIT : 0);
+	size_t sent = 0;
+	while (sent < WIRE_BYTES) {
+		ssize_t n = ::send(fd, frame + sent, WIRE_BYTES - sent, flags);
+		if (n < 0 && errno == EINTR)
+			continue;
+		//a partial frame can't be taken back, so a nonblocking sender treats it like any other failure
+		if (n <= 0 || (nonblocking && (size_t)n < WIRE_BYTES))
+			return false;
+		sent += n;
+	}
+	return true;
+}
+
+bool Reader::fill(int fd) {
+	ssize_t n;
+	do
+		n = read(fd, m_buf + m_len, sizeof(m_buf) - m_len);
+	while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		return false;
+	m_len += n;
+	return true;
+}
+
+bool Reader::next(Message &m) {
+	if (m_len < WIRE_BYTES)
+		return false;
+	m = decode(m_buf);
+	memmove(m_buf, m_buf + WIRE_BYTES, m_len - WIRE_BYTES);
+	m_len -= WIRE_BYTES;
+	return true;
+}
+
+int listenUnix(const std::string &path, std::string &error) {
+	sockaddr_un addr;
+	if (!address(path, addr, error))
+		return -1;
+	//a socket file is only stale if nothing answers on it, a live coordinator keeps its workers
+	struct stat st;
+	if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+		int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (probe < 0) {
+			error = path + ": " + strerror(errno);
+			return -1;
+		}
+		bool live = connect(probe, (const sockaddr *)&addr, sizeof(addr)) == 0;
+		int probeErrno = errno;
+		close(probe);
+		if (live) {
+			error = path + ": another coordinator is listening there";
+			return -1;
+		}
+		if (probeErrno != ECONNREFUSED) {
+			error = path + ": " + strerror(probeErrno);
+			return -1;
+		}
+		unlink(path.c_str());
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || bind(fd, (const sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+		error = path + ": " + strerror(errno);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int connectUnix(const std::string &path, std::string &error) {
+	sockaddr_un addr;
+	if (!address(path, addr, error))
+		return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (const sockaddr *)&addr, sizeof(addr)) != 0) {
+		error = path + ": " + strerror(errno);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//wire format between a Coordinator and its LeaseWorkers
+//every message is WIRE_BYTES long: type, 4 reserved bytes, then epoch and four fields, all little endian,
+//so a reader only ever waits for a whole number of fixed size frames and nothing depends on host layout
+//epoch numbers the coordinator's blocks; anything about an older epoch is stale and dropped on arrival
+//only listenUnix and connectUnix know the transport, the rest works on any connected stream socket,
+//which is what a tcp transport between hosts would plug in
+namespace lease {
+
+const uint32_t VERSION = 1;
+const size_t WIRE_BYTES = 48;
+
+enum Type : uint32_t {
+	HELLO = 1, //worker -> coordinator  a: VERSION  b: threads  c: pid
+	BLOCK,     //coordinator -> worker  a: id  b: previousHash  c: threshold  d: hash policy
+	LEASE,     //coordinator -> worker  a: lease  b: first nonce  c: end (exclusive)  d: expiry ms
+	PROGRESS,  //worker -> coordinator  a: lease  b: next nonce to try, renews the lease
+	DONE,      //worker -> coordinator  a: lease, searched to its end without a solution
+	FOUND,     //worker -> coordinator  a: lease  b: lowest solving nonce in it  c: its hash
+	TRIM,      //coordinator -> worker  a: lease  b: its new end, nothing from there up can matter any more
+	STOP       //coordinator -> worker  stop everything up to and including epoch
+};
+
+struct Message {
+	uint32_t type;
+	uint64_t epoch;
+	uint64_t a, b, c, d;
+};
+
+Message message(uint32_t type, uint64_t epoch, uint64_t a = 0, uint64_t b = 0, uint64_t c = 0, uint64_t d = 0);
+void encode(const Message &m, uint8_t out[WIRE_BYTES]);
+Message decode(const uint8_t in[WIRE_BYTES]);
+const char *typeName(uint32_t type);
+
+//the whole frame or nothing useful: false on error, on a closed peer, or (nonblocking) if it wouldn't fit now,
+//which for frames this small means the peer stopped reading
+bool send(int fd, const Message &m, bool nonblocking = false);
+
+//reassembles frames from a stream socket
+class Reader {
+	uint8_t m_buf[WIRE_BYTES * 64];
+	size_t m_len;
+public:
+	Reader() : m_len(0) {}
+	//one read(); false once the peer closed or the socket failed
+	bool fill(int fd);
+	bool next(Message &m);
+};
+
+//stream socket at path, replacing a stale socket file left by a crashed coordinator but never one that still
+//accepts connections; -1 with error set on failure
+int listenUnix(const std::string &path, std::string &error);
+int connectUnix(const std::string &path, std::string &error);
+
+}
@@ -0,0 +1,234 @@
+#include "LeaseWorker.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include "HashPolicy.hpp"
+#include "MinerPool.hpp"
+#include "Topology.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+//one lease, a batch at a time: next is published after every batch for the heartbeat, end is reread
+//before every batch for TRIM, and the search gives up as soon as stopped reaches epoch
+//a hit publishes the solving nonce itself, not the one after it: a heartbeat that goes out before FOUND must not
+//report the solution as searched, or the coordinator would take FOUND for a nonce below the lease's progress
+template<class Hash, class Target>
+bool searchLease(const Block &job, uint64_t epoch, size_t begin, std::atomic<size_t> &next, const std::atomic<size_t> &end,
+	const std::atomic<uint64_t> &stopped, const Target &target, size_t &nonce, size_t &hash) {
+	typename Hash::Cursor cursor(job.getPreviousHash(), job.getId());
+	cursor.seek(begin);
+	for (size_t i = begin;;) {
+		size_t until = end.load(std::memory_order_relaxed);
+		if (i >= until || stopped.load(std::memory_order_relaxed) >= epoch)
+			return false;
+		unsigned count = until - i < NonceHasher::MAX_BATCH ? (unsigned)(until - i) : NonceHasher::MAX_BATCH;
+		unsigned hit = cursor.scan(count, target, hash);
+		if (hit < count) {
+			nonce = i + hit;
+			next.store(nonce, std::memory_order_relaxed);
+			return true;
+		}
+		i += count;
+		next.store(i, std::memory_order_relaxed);
+	}
+}
+
+}
+
+LeaseWorker::LeaseWorker(unsigned threads, const Array<unsigned> &cpus)
+	: m_fd(-1), m_threads(threads ? threads : 1), m_cpus(cpus), m_slots(new Slot[threads ? threads : 1]), m_epoch(0),
+	m_beatMs(DEFAULT_BEAT_MS), m_shutdown(false), m_stopped(0), m_leases(0), m_solutions(0), m_nonces(0) {
+	for (unsigned i = 0; i < m_threads; i++) {
+		m_slots[i].next.store(0);
+		m_slots[i].end.store(0);
+		m_slots[i].busy = false;
+	}
+}
+
+LeaseWorker::~LeaseWorker() {
+	if (m_fd >= 0)
+		close(m_fd);
+}
+
+bool LeaseWorker::run(const std::string &path, std::string &error) {
+	m_fd = lease::connectUnix(path, error);
+	if (m_fd < 0)
+		return false;
+	if (!send(lease::message(lease::HELLO, 0, lease::VERSION, m_threads, getpid()))) {
+		error = path + ": " + strerror(errno);
+		return false;
+	}
+	m_shutdown = false;
+	for (unsigned i = 0; i < m_threads; i++)
+		m_miners.push_back(std::thread(&LeaseWorker::miner, this, i));
+
+	lease::Reader reader;
+	bool ok = true;
+	int64_t nextBeat = MinerPool::now() + m_beatMs * (int64_t)1000000;
+	while (ok) {
+		int64_t now = MinerPool::now();
+		if (now >= nextBeat) {
+			heartbeat();
+			nextBeat = now + m_beatMs * (int64_t)1000000;
+		}
+		pollfd p = {m_fd, POLLIN, 0};
+		int ready = poll(&p, 1, (int)std::max<int64_t>((nextBeat - now) / 1000000, 1));
+		if (ready < 0 && errno != EINTR) {
+			error = path + ": " + strerror(errno);
+			ok = false;
+		} else if (ready > 0) {
+			//the coordinator closing the connection is how a run ends
+			if (!reader.fill(m_fd))
+				break;
+			lease::Message m;
+			while (ok && reader.next(m))
+				ok = handle(m, error);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_shutdown = true;
+		m_queue.clear();
+	}
+	m_stopped.store(UINT64_MAX);
+	m_wake.notify_all();
+	for (std::thread &t : m_miners)
+		t.join();
+	m_miners.clear();
+	close(m_fd);
+	m_fd = -1;
+	return ok;
+}
+
+bool LeaseWorker::handle(const lease::Message &m, std::string &error) {
+	std::unique_lock<std::mutex> lock(m_mtx);
+	switch (m.type) {
+	case lease::BLOCK: {
+		Block job((unsigned)m.a, m.b);
+		if (!job.setThreshold(m.c) || !job.setHashPolicy((int)m.d)) {
+			error = "coordinator sent block " + std::to_string(m.a) + " with unknown hash policy " + std::to_string(m.d);
+			return false;
+		}
+		m_job = job;
+		m_epoch = m.epoch;
+		m_queue.clear(); //anything left is for an older block
+		return true;
+	}
+	case lease::LEASE:
+		if (m.epoch != m_epoch || m_stopped.load() >= m.epoch)
+			return true;
+		m_queue.push_back({m.epoch, m.a, m.b, m.c});
+		m_beatMs = std::max<unsigned>((unsigned)m.d / 4, 1);
+		lock.unlock();
+		m_wake.notify_one();
+		return true;
+	case lease::TRIM:
+		for (Work &w : m_queue)
+			if (w.epoch == m.epoch && w.lease == m.a)
+				w.end = std::min<size_t>(w.end, m.b);
+		for (unsigned i = 0; i < m_threads; i++) {
+			Slot &s = m_slots[i];
+			if (s.busy && s.work.epoch == m.epoch && s.work.lease == m.a && m.b < s.end.load())
+				s.end.store(m.b, std::memory_order_relaxed);
+		}
+		return true;
+	case lease::STOP:
+		if (m.epoch > m_stopped.load())
+			m_stopped.store(m.epoch, std::memory_order_relaxed);
+		while (!m_queue.empty() && m_queue.front().epoch <= m.epoch)
+			m_queue.pop_front();
+		return true;
+	default:
+		error = std::string("coordinator sent a ") + lease::typeName(m.type) + " message";
+		return false;
+	}
+}
+
+//one PROGRESS per lease held, queued ones included, so none of them expire while they wait
+void LeaseWorker::heartbeat() {
+	Array<lease::Message> beats;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		for (unsigned i = 0; i < m_threads; i++)
+			if (m_slots[i].busy)
+				beats.push_back(lease::message(lease::PROGRESS, m_slots[i].work.epoch, m_slots[i].work.lease, m_slots[i].next.load(std::memory_order_relaxed)));
+		for (const Work &w : m_queue)
+			beats.push_back(lease::message(lease::PROGRESS, w.epoch, w.lease, w.begin));
+	}
+	for (const lease::Message &m : beats)
+		send(m);
+}
+
+void LeaseWorker::miner(unsigned slotNum) {
+	if (slotNum < m_cpus.size())
+		Topology::pin(m_cpus[slotNum]);
+	trace::nameThread("lease worker " + std::to_string(slotNum));
+	Slot &slot = m_slots[slotNum];
+	while (true) {
+		Work w;
+		Block job;
+		{
+			std::unique_lock<std::mutex> lock(m_mtx);
+			m_wake.wait(lock, [this] { return m_shutdown || !m_queue.empty(); });
+			if (m_shutdown)
+				return;
+			w = m_queue.front();
+			m_queue.pop_front();
+			job = m_job;
+			slot.work = w;
+			slot.next.store(w.begin, std::memory_order_relaxed);
+			slot.end.store(w.end, std::memory_order_relaxed);
+			slot.busy = true;
+		}
+		size_t nonce = 0, hash = 0;
+		bool found;
+		{
+			BC_TRACE_SPAN_ARG("lease", w.begin);
+			found = withHashPolicy(job.getHashPolicy(), [&](auto policy) {
+				return withTarget(job.getThreshold(), [&](auto target) {
+					return searchLease<decltype(policy)>(job, w.epoch, w.begin, slot.next, slot.end, m_stopped, target, nonce, hash);
+				});
+			});
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			slot.busy = false;
+		}
+		m_leases.fetch_add(1, std::memory_order_relaxed);
+		m_nonces.fetch_add(slot.next.load(std::memory_order_relaxed) + found - w.begin, std::memory_order_relaxed);
+		if (m_stopped.load(std::memory_order_relaxed) >= w.epoch)
+			continue; //the coordinator has moved on
+		if (found) {
+			m_solutions.fetch_add(1, std::memory_order_relaxed);
+			send(lease::message(lease::FOUND, w.epoch, w.lease, nonce, hash));
+		} else {
+			send(lease::message(lease::DONE, w.epoch, w.lease));
+		}
+	}
+}
+
+bool LeaseWorker::send(const lease::Message &m) {
+	std::lock_guard<std::mutex> lock(m_sendMtx);
+	return lease::send(m_fd, m);
+}
+
+unsigned LeaseWorker::threads() const {
+	return m_threads;
+}
+
+size_t LeaseWorker::leases() const {
+	return m_leases.load(std::memory_order_relaxed);
+}
+
+size_t LeaseWorker::solutions() const {
+	return m_solutions.load(std::memory_order_relaxed);
+}
+
+size_t LeaseWorker::nonces() const {
+	return m_nonces.load(std::memory_order_relaxed);
+}
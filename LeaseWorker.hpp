@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Array.hpp"
+#include "Block.hpp"
+#include "LeaseProtocol.hpp"
+
+//the other end of a Coordinator, meant to run as its own process (one per cgroup, say)
+//it tells the coordinator how many threads it mines with and searches every lease it's given on one of them,
+//from the lease's first nonce up to its lowest solution or its end
+//the thread in run() owns the socket: STOP and TRIM reach the mining threads through atomics they check every
+//NonceHasher::MAX_BATCH nonces, and every quarter of the lease expiry it reports how far each lease has got
+//so the coordinator doesn't take it back
+//given cpus, mining thread i pins itself to cpus[i] like MinerPool's workers
+class LeaseWorker {
+
+	struct Work {
+		uint64_t epoch;
+		uint64_t lease;
+		size_t begin, end;
+	};
+
+	struct Slot {
+		std::atomic<size_t> next; //first nonce not yet searched
+		std::atomic<size_t> end;  //lowered by TRIM while it's searched
+		bool busy;                //busy and work are guarded by m_mtx
+		Work work;
+	};
+
+	int m_fd;
+	unsigned m_threads;
+	Array<unsigned> m_cpus;
+	Array<std::thread> m_miners;
+	std::unique_ptr<Slot[]> m_slots;
+
+	std::mutex m_mtx; //everything below up to m_stopped, and the slots' busy and work
+	std::condition_variable m_wake;
+	uint64_t m_epoch; //of m_job
+	Block m_job;
+	std::deque<Work> m_queue;
+	unsigned m_beatMs;
+	bool m_shutdown;
+	std::atomic<uint64_t> m_stopped; //highest epoch a STOP has come for
+
+	std::mutex m_sendMtx;
+
+	std::atomic<size_t> m_leases;
+	std::atomic<size_t> m_solutions;
+	std::atomic<size_t> m_nonces;
+
+	void miner(unsigned slot);
+	bool handle(const lease::Message &m, std::string &error);
+	void heartbeat();
+	bool send(const lease::Message &m);
+
+public:
+
+	static const unsigned DEFAULT_BEAT_MS = 500; //until a lease says how long it lasts
+
+	LeaseWorker(unsigned threads, const Array<unsigned> &cpus = Array<unsigned>());
+	~LeaseWorker();
+
+	LeaseWorker(const LeaseWorker&) = delete;
+	LeaseWorker& operator=(const LeaseWorker&) = delete;
+
+	//mines for the coordinator at path until it closes the connection
+	//false with error set if it couldn't connect, the connection failed, or the coordinator broke the protocol
+	bool run(const std::string &path, std::string &error);
+
+	unsigned threads() const;
+	size_t leases() const;    //searched to their end, a solution, a trim or a stop
+	size_t solutions() const; //reported
+	size_t nonces() const;    //hashed
+
+};
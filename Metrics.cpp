@@ -0,0 +1,305 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include "MinerPool.hpp"
+#include "Topology.hpp"
+#include "Trace.hpp"
+
+//nonces saturate rather than wrap, a search of the whole range is one more than they hold
+void ThreadCounters::add(const ThreadCounters &other) {
+	noncesTried += std::min(other.noncesTried, SIZE_MAX - noncesTried);
+	hits += other.hits;
+	chunks += other.chunks;
+	steals += other.steals;
+	busyNanos += other.busyNanos;
+	schedNanos += other.schedNanos;
+	idleNanos += other.idleNanos;
+	throttleNanos += other.throttleNanos;
+	governorNanos += other.governorNanos;
+}
+
+void BlockPhases::add(const BlockPhases &other) {
+	dispatch += other.dispatch;
+	search += other.search;
+	cancel += other.cancel;
+	join += other.join;
+}
+
+int64_t BlockPhases::total() const {
+	return dispatch + search + cancel + join;
+}
+
+
+
+LatencyHistogram::LatencyHistogram() {
+	for (unsigned i = 0; i <= BUCKETS; i++)
+		m_counts[i] = 0;
+	m_count = 0;
+	m_sumNanos = 0;
+	m_maxNanos = 0;
+}
+
+void LatencyHistogram::record(int64_t nanos) {
+	if (nanos < 0)
+		nanos = 0;
+	uint64_t micros = (uint64_t)nanos / 1000;
+	unsigned i = 0;
+	while (i < BUCKETS && micros >= ((uint64_t)1 << i))
+		i++;
+	m_counts[i]++;
+	m_count++;
+	m_sumNanos += nanos;
+	if (nanos > m_maxNanos)
+		m_maxNanos = nanos;
+}
+
+size_t LatencyHistogram::count() const { return m_count; }
+size_t LatencyHistogram::bucket(unsigned i) const { return m_counts[i]; }
+int64_t LatencyHistogram::sumNanos() const { return m_sumNanos; }
+int64_t LatencyHistogram::maxNanos() const { return m_maxNanos; }
+
+double LatencyHistogram::bucketBound(unsigned i) {
+	return (double)((uint64_t)1 << i) / 1e6;
+}
+
+double LatencyHistogram::quantile(double q) const {
+	if (m_count == 0)
+		return 0;
+	size_t rank = (size_t)(q * (m_count - 1)) + 1;
+	size_t seen = 0;
+	for (unsigned i = 0; i < BUCKETS; i++) {
+		seen += m_counts[i];
+		if (seen >= rank)
+			return bucketBound(i);
+	}
+	return m_maxNanos / 1e9;
+}
+
+
+
+MinerMetrics::MinerMetrics(unsigned threadCount) : m_threads(threadCount), m_totals(threadCount) {
+	m_threadCount = threadCount;
+	m_phasedBlocks = 0;
+	m_blocks = 0;
+	m_started = MinerPool::now();
+}
+
+unsigned MinerMetrics::threadCount() const {
+	return m_threadCount;
+}
+
+ThreadCounters &MinerMetrics::counters(unsigned thread) {
+	return m_threads[thread];
+}
+
+bool MinerMetrics::placeCounters(const Array<int> &threadNodes) {
+	return Topology::placeSlots(&m_threads[0], sizeof(ThreadCounters), m_threadCount, threadNodes);
+}
+
+void MinerMetrics::flush(unsigned thread) {
+	std::lock_guard<std::mutex> guard(m_mtx);
+	m_totals[thread].add(m_threads[thread]);
+	m_threads[thread] = ThreadCounters();
+}
+
+void MinerMetrics::recordBlock(int64_t solveNanos, const BlockPhases *phases) {
+	std::lock_guard<std::mutex> guard(m_mtx);
+	m_solve.record(solveNanos);
+	if (phases) {
+		m_phases.add(*phases);
+		m_phasedBlocks++;
+	}
+	m_blocks++;
+}
+
+size_t MinerMetrics::blocks() const {
+	std::lock_guard<std::mutex> guard(m_mtx);
+	return m_blocks;
+}
+
+ThreadCounters MinerMetrics::total() const {
+	std::lock_guard<std::mutex> guard(m_mtx);
+	ThreadCounters sum;
+	for (unsigned i = 0; i < m_threadCount; i++)
+		sum.add(m_totals[i]);
+	return sum;
+}
+
+BlockPhases MinerMetrics::phases() const {
+	std::lock_guard<std::mutex> guard(m_mtx);
+	return m_phases;
+}
+
+size_t MinerMetrics::phasedBlocks() const {
+	std::lock_guard<std::mutex> guard(m_mtx);
+	return m_phasedBlocks;
+}
+
+namespace {
+
+struct Summary {
+	ThreadCounters total;
+	double uptime;
+	double hashrate;
+	double imbalance; //busiest thread's nonces over the mean
+};
+
+Summary summarize(const Array<ThreadCounters> &threads, unsigned count, int64_t started) {
+	Summary s;
+	size_t most = 0;
+	for (unsigned i = 0; i < count; i++) {
+		s.total.add(threads[i]);
+		if (threads[i].noncesTried > most)
+			most = threads[i].noncesTried;
+	}
+	s.uptime = (MinerPool::now() - started) / 1e9;
+	s.hashrate = s.uptime > 0 ? s.total.noncesTried / s.uptime : 0;
+	double mean = count ? (double)s.total.noncesTried / count : 0;
+	s.imbalance = mean > 0 ? most / mean : 0;
+	return s;
+}
+
+void append(std::string &out, const char *fmt, ...) {
+	char buf[512];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (n > 0)
+		out.append(buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
+}
+
+}
+
+std::string MinerMetrics::toJson() const {
+	std::lock_guard<std::mutex> guard(m_mtx);
+	Summary s = summarize(m_totals, m_threadCount, m_started);
+	std::string out;
+	append(out, "{\n  \"uptime_seconds\": %.3f,\n  \"blocks\": %zu,\n  \"nonces_tried\": %zu,\n  \"hashrate\": %.1f,\n  \"imbalance\": %.3f,\n",
+		s.uptime, m_blocks, s.total.noncesTried, s.hashrate, s.imbalance);
+	append(out, "  \"solve_latency\": {\"count\": %zu, \"mean_seconds\": %.6f, \"p50_seconds\": %.6f, \"p90_seconds\": %.6f, \"p99_seconds\": %.6f, \"max_seconds\": %.6f, \"buckets\": [",
+		m_solve.count(), m_solve.count() ? m_solve.sumNanos() / 1e9 / m_solve.count() : 0.0, m_solve.quantile(0.5), m_solve.quantile(0.9), m_solve.quantile(0.99), m_solve.maxNanos() / 1e9);
+	bool first = true;
+	for (unsigned i = 0; i <= LatencyHistogram::BUCKETS; i++) {
+		if (m_solve.bucket(i) == 0)
+			continue;
+		if (i < LatencyHistogram::BUCKETS)
+			append(out, "%s{\"le\": %g, \"count\": %zu}", first ? "" : ", ", LatencyHistogram::bucketBound(i), m_solve.bucket(i));
+		else
+			append(out, "%s{\"le\": \"+Inf\", \"count\": %zu}", first ? "" : ", ", m_solve.bucket(i));
+		first = false;
+	}
+	out += "]},\n";
+	append(out, "  \"block_phases\": {\"blocks\": %zu, \"dispatch_seconds\": %.6f, \"search_seconds\": %.6f, \"cancel_seconds\": %.6f, \"join_seconds\": %.6f},\n",
+		m_phasedBlocks, m_phases.dispatch / 1e9, m_phases.search / 1e9, m_phases.cancel / 1e9, m_phases.join / 1e9);
+	out += "  \"threads\": [\n";
+	for (unsigned i = 0; i < m_threadCount; i++) {
+		const ThreadCounters &t = m_totals[i];
+		append(out, "    {\"thread\": %u, \"nonces_tried\": %zu, \"hits\": %zu, \"chunks\": %zu, \"steals\": %zu, \"busy_seconds\": %.6f, \"sched_seconds\": %.6f, \"idle_seconds\": %.6f, \"throttle_seconds\": %.6f, \"governor_seconds\": %.6f, \"hashrate\": %.1f}%s\n",
+			i, t.noncesTried, t.hits, t.chunks, t.steals, t.busyNanos / 1e9, t.schedNanos / 1e9, t.idleNanos / 1e9, t.throttleNanos / 1e9, t.governorNanos / 1e9, s.uptime > 0 ? t.noncesTried / s.uptime : 0.0, i + 1 < m_threadCount ? "," : "");
+	}
+	out += "  ]\n}\n";
+	return out;
+}
+
+std::string MinerMetrics::toPrometheus() const {
+	std::lock_guard<std::mutex> guard(m_mtx);
+	Summary s = summarize(m_totals, m_threadCount, m_started);
+	std::string out;
+	struct Counter {
+		const char *name;
+		const char *help;
+		const char *type;
+	};
+	const Counter counters[] = {
+		{"bc_nonces_tried_total", "Nonces hashed", "counter"},
+		{"bc_hits_total", "Nonces that solved a block", "counter"},
+		{"bc_chunks_total", "Nonce chunks taken from the scheduler", "counter"},
+		{"bc_steals_total", "Chunks stolen from another thread", "counter"},
+		{"bc_busy_seconds_total", "Time spent hashing", "counter"},
+		{"bc_sched_seconds_total", "Time spent getting chunks", "counter"},
+		{"bc_idle_seconds_total", "Time spent waiting for work or for the rest of the pool", "counter"},
+		{"bc_throttle_seconds_total", "Time paused to hold the governor's hashrate cap or cpu budget", "counter"},
+		{"bc_governor_seconds_total", "Governor overhead: charging its buckets and the cpu its sleeps use", "counter"},
+	};
+	for (unsigned c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+		append(out, "# HELP %s %s\n# TYPE %s %s\n", counters[c].name, counters[c].help, counters[c].name, counters[c].type);
+		for (unsigned i = 0; i < m_threadCount; i++) {
+			const ThreadCounters &t = m_totals[i];
+			if (c == 0) append(out, "%s{thread=\"%u\"} %zu\n", counters[c].name, i, t.noncesTried);
+			if (c == 1) append(out, "%s{thread=\"%u\"} %zu\n", counters[c].name, i, t.hits);
+			if (c == 2) append(out, "%s{thread=\"%u\"} %zu\n", counters[c].name, i, t.chunks);
+			if (c == 3) append(out, "%s{thread=\"%u\"} %zu\n", counters[c].name, i, t.steals);
+			if (c == 4) append(out, "%s{thread=\"%u\"} %.9f\n", counters[c].name, i, t.busyNanos / 1e9);
+			if (c == 5) append(out, "%s{thread=\"%u\"} %.9f\n", counters[c].name, i, t.schedNanos / 1e9);
+			if (c == 6) append(out, "%s{thread=\"%u\"} %.9f\n", counters[c].name, i, t.idleNanos / 1e9);
+			if (c == 7) append(out, "%s{thread=\"%u\"} %.9f\n", counters[c].name, i, t.throttleNanos / 1e9);
+			if (c == 8) append(out, "%s{thread=\"%u\"} %.9f\n", counters[c].name, i, t.governorNanos / 1e9);
+		}
+	}
+	append(out, "# HELP bc_blocks_total Blocks mined\n# TYPE bc_blocks_total counter\nbc_blocks_total %zu\n", m_blocks);
+	append(out, "# HELP bc_hashrate Nonces per second since start\n# TYPE bc_hashrate gauge\nbc_hashrate %.1f\n", s.hashrate);
+	append(out, "# HELP bc_thread_imbalance Busiest thread's nonces over the mean\n# TYPE bc_thread_imbalance gauge\nbc_thread_imbalance %.3f\n", s.imbalance);
+	append(out, "# HELP bc_block_solve_seconds Wall time to solve a block\n# TYPE bc_block_solve_seconds histogram\n");
+	size_t cumulative = 0;
+	for (unsigned i = 0; i < LatencyHistogram::BUCKETS; i++) {
+		cumulative += m_solve.bucket(i);
+		append(out, "bc_block_solve_seconds_bucket{le=\"%g\"} %zu\n", LatencyHistogram::bucketBound(i), cumulative);
+	}
+	append(out, "bc_block_solve_seconds_bucket{le=\"+Inf\"} %zu\n", m_solve.count());
+	append(out, "bc_block_solve_seconds_sum %.9f\nbc_block_solve_seconds_count %zu\n", m_solve.sumNanos() / 1e9, m_solve.count());
+	append(out, "# HELP bc_block_phase_seconds_total Block latency split into dispatch, search, cancel and join\n# TYPE bc_block_phase_seconds_total counter\n");
+	append(out, "bc_block_phase_seconds_total{phase=\"dispatch\"} %.9f\nbc_block_phase_seconds_total{phase=\"search\"} %.9f\n", m_phases.dispatch / 1e9, m_phases.search / 1e9);
+	append(out, "bc_block_phase_seconds_total{phase=\"cancel\"} %.9f\nbc_block_phase_seconds_total{phase=\"join\"} %.9f\n", m_phases.cancel / 1e9, m_phases.join / 1e9);
+	return out;
+}
+
+bool MinerMetrics::writeFile(const std::string &path, const std::string &contents) {
+	std::string tmp = path + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (f == NULL)
+		return false;
+	bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+	ok = fclose(f) == 0 && ok;
+	return ok && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+
+
+MetricsExporter::MetricsExporter(MinerMetrics &metrics, const std::string &jsonPath, const std::string &promPath, unsigned intervalMs) : m_metrics(metrics) {
+	m_jsonPath = jsonPath;
+	m_promPath = promPath;
+	m_intervalMs = intervalMs ? intervalMs : 1000;
+	m_stop = false;
+	m_thread = std::thread(&MetricsExporter::loop, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+	{
+		std::lock_guard<std::mutex> guard(m_mtx);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	m_thread.join();
+	exportNow();
+}
+
+void MetricsExporter::exportNow() {
+	BC_TRACE_SPAN("metrics.export");
+	if (!m_jsonPath.empty())
+		MinerMetrics::writeFile(m_jsonPath, m_metrics.toJson());
+	if (!m_promPath.empty())
+		MinerMetrics::writeFile(m_promPath, m_metrics.toPrometheus());
+}
+
+void MetricsExporter::loop() {
+	std::unique_lock<std::mutex> lock(m_mtx);
+	while (!m_wake.wait_for(lock, std::chrono::milliseconds(m_intervalMs), [this] { return m_stop; })) {
+		lock.unlock();
+		exportNow();
+		lock.lock();
+	}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Array.hpp"
+
+//counters for one mining thread, only ever written by that thread while a block is mined
+struct alignas(64) ThreadCounters {
+	size_t noncesTried = 0;
+	size_t hits = 0;
+	size_t chunks = 0;
+	size_t steals = 0;
+	int64_t busyNanos = 0;  //hashing
+	int64_t schedNanos = 0; //getting chunks, including stealing
+	int64_t idleNanos = 0;  //parked or waiting for the rest of the pool
+	int64_t throttleNanos = 0; //paused by a Governor to hold its limits
+	int64_t governorNanos = 0; //the governor's own cost: charging, and the cpu its sleeps use
+
+	void add(const ThreadCounters &other);
+};
+
+//where one block's latency went, nanoseconds that add up to the whole threadMine call
+struct BlockPhases {
+	int64_t dispatch = 0; //waking the pool until the last worker started
+	int64_t search = 0;   //all workers hashing, until the first solution was published
+	int64_t cancel = 0;   //from that until the last worker noticed and returned
+	int64_t join = 0;     //from that until threadMine had the result back
+
+	void add(const BlockPhases &other);
+	int64_t total() const;
+};
+
+//log2 buckets of microseconds, bucket i holds latencies below 2^i us
+class LatencyHistogram {
+
+public:
+
+	static const unsigned BUCKETS = 40;
+
+private:
+
+	size_t m_counts[BUCKETS + 1]; //last bucket catches everything larger
+	size_t m_count;
+	int64_t m_sumNanos;
+	int64_t m_maxNanos;
+
+public:
+
+	LatencyHistogram();
+
+	void record(int64_t nanos);
+
+	size_t count() const;
+	size_t bucket(unsigned i) const;
+	static double bucketBound(unsigned i); //upper bound of bucket i in seconds
+	int64_t sumNanos() const;
+	int64_t maxNanos() const;
+	double quantile(double q) const; //seconds, upper bound of the bucket holding q
+
+};
+
+//per thread counters plus the block latency histogram for one pool of mining threads
+//threads fold their counters into shared totals once per block, so mining itself never contends
+class MinerMetrics {
+
+	Array<ThreadCounters> m_threads;
+	unsigned m_threadCount;
+
+	mutable std::mutex m_mtx;
+	Array<ThreadCounters> m_totals;
+	LatencyHistogram m_solve;
+	BlockPhases m_phases; //summed over every block that reported them
+	size_t m_phasedBlocks;
+	size_t m_blocks;
+	int64_t m_started;
+
+public:
+
+	MinerMetrics(unsigned threadCount);
+
+	unsigned threadCount() const;
+
+	//live counters for thread, only that thread may touch them
+	ThreadCounters &counters(unsigned thread);
+	//keeps each thread's live counters on its NUMA node, threadNodes[i] for thread i, see Topology::placeSlots
+	bool placeCounters(const Array<int> &threadNodes);
+
+	//moves thread's live counters into the totals, call once the thread is done with a block
+	void flush(unsigned thread);
+	void recordBlock(int64_t solveNanos, const BlockPhases *phases = NULL);
+
+	size_t blocks() const;
+	ThreadCounters total() const; //flushed counters of every thread added up
+	BlockPhases phases() const;   //summed phases, over phasedBlocks() blocks
+	size_t phasedBlocks() const;
+
+	std::string toJson() const;
+	std::string toPrometheus() const;
+
+	//writes through a temporary file so readers never see half a file
+	static bool writeFile(const std::string &path, const std::string &contents);
+
+};
+
+//rewrites the json and/or prometheus files every interval from a background thread and once more when destroyed
+class MetricsExporter {
+
+	MinerMetrics &m_metrics;
+	std::string m_jsonPath;
+	std::string m_promPath;
+	unsigned m_intervalMs;
+
+	std::mutex m_mtx;
+	std::condition_variable m_wake;
+	bool m_stop;
+	std::thread m_thread;
+
+	void loop();
+
+public:
+
+	MetricsExporter(MinerMetrics &metrics, const std::string &jsonPath, const std::string &promPath, unsigned intervalMs);
+	~MetricsExporter();
+
+	void exportNow();
+
+};
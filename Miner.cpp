@@ -0,0 +1,219 @@
+#include "Miner.hpp"
+
+#include "Topology.hpp"
+#include "Trace.hpp"
+
+Miner::Miner(unsigned threads, unsigned lanes, const Array<unsigned> &cpus) : m_stop(false), m_running(0) {
+	if (lanes == 0)
+		lanes = 1;
+	if (threads < lanes)
+		threads = lanes;
+	m_threads = threads;
+	unsigned cpu = 0;
+	for (unsigned i = 0; i < lanes; i++) {
+		unsigned size = threads / lanes + (i < threads % lanes);
+		Array<unsigned> laneCpus;
+		for (unsigned t = 0; t < size && cpu < cpus.size(); t++)
+			laneCpus.push_back(cpus[cpu++]);
+		Lane *l = new Lane();
+		l->pool.reset(new MinerPool(size, laneCpus));
+		l->scheduler.reset(new NonceScheduler(size));
+		m_lanes.push_back(l);
+	}
+	for (unsigned i = 0; i < lanes; i++)
+		m_lanes[i]->thread = std::thread(&Miner::lane, this, i);
+	m_sweeper = std::thread(&Miner::sweep, this);
+}
+
+Miner::~Miner() {
+	cancelAll();
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	m_queuedWake.notify_all();
+	m_sweeper.join();
+	for (Lane *l : m_lanes) {
+		l->thread.join();
+		delete l;
+	}
+}
+
+std::future<MineResult> Miner::submit(const Block &block, const MineOptions &opts) {
+	Job *job = new Job{block, opts, std::promise<MineResult>(), Callback(), MinerPool::now()};
+	std::future<MineResult> result = job->promise.get_future();
+	enqueue(job);
+	return result;
+}
+
+void Miner::submit(const Block &block, Callback done, const MineOptions &opts) {
+	enqueue(new Job{block, opts, std::promise<MineResult>(), std::move(done), MinerPool::now()});
+}
+
+void Miner::enqueue(Job *job) {
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		if (!m_stop) {
+			m_queue.push_back(job);
+			job = NULL;
+		}
+	}
+	if (job == NULL) {
+		m_wake.notify_one();
+		m_queuedWake.notify_one();
+		return;
+	}
+	MineResult r{job->block, MINE_CANCELLED, 0, 0, BlockPhases()};
+	finish(job, r);
+}
+
+void Miner::cancelAll() {
+	std::deque<Job *> dropped;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		dropped.swap(m_queue);
+		for (Lane *l : m_lanes)
+			if (l->busy)
+				l->run.halt(MINE_CANCELLED);
+	}
+	int64_t now = MinerPool::now();
+	for (Job *job : dropped) {
+		MineResult r{job->block, MINE_CANCELLED, now - job->submitted, 0, BlockPhases()};
+		finish(job, r);
+	}
+}
+
+void Miner::takeDead(std::deque<Job *> &dead, int64_t now) {
+	for (auto it = m_queue.begin(); it != m_queue.end();) {
+		const MineOptions &o = (*it)->opts;
+		if (o.token.cancelled() || (o.deadline && now >= o.deadline)) {
+			dead.push_back(*it);
+			it = m_queue.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void Miner::finishDead(std::deque<Job *> &dead, int64_t now) {
+	for (Job *job : dead) {
+		MineResult r{job->block, job->opts.token.cancelled() ? MINE_CANCELLED : MINE_DEADLINE, now - job->submitted, 0, BlockPhases()};
+		finish(job, r);
+	}
+	dead.clear();
+}
+
+//tokens have no way to wake anyone, so while jobs are queued they're looked at every SWEEP_NANOS,
+//and the wait never runs past the earliest queued deadline
+void Miner::sweep() {
+	trace::nameThread("miner sweeper");
+	std::deque<Job *> dead;
+	std::unique_lock<std::mutex> lock(m_mtx);
+	while (true) {
+		m_queuedWake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+		if (m_stop)
+			return;
+		int64_t now = MinerPool::now();
+		takeDead(dead, now);
+		if (!dead.empty()) {
+			lock.unlock();
+			finishDead(dead, now);
+			lock.lock();
+			continue;
+		}
+		int64_t wake = now + SWEEP_NANOS;
+		for (Job *job : m_queue)
+			if (job->opts.deadline && job->opts.deadline < wake)
+				wake = job->opts.deadline;
+		m_queuedWake.wait_for(lock, std::chrono::nanoseconds(wake - now));
+	}
+}
+
+void Miner::lane(unsigned i) {
+	Lane &l = *m_lanes[i];
+	trace::nameThread("miner lane " + std::to_string(i));
+	while (true) {
+		Job *job;
+		std::deque<Job *> dead;
+		int64_t now;
+		{
+			std::unique_lock<std::mutex> lock(m_mtx);
+			m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+			//whatever died in the queue is finished here rather than mined for a batch
+			now = MinerPool::now();
+			takeDead(dead, now);
+			if (m_queue.empty()) {
+				bool stop = m_stop;
+				lock.unlock();
+				finishDead(dead, now);
+				if (stop)
+					return;
+				continue;
+			}
+			job = m_queue.front();
+			m_queue.pop_front();
+			l.run.reset();
+			l.run.mode = job->opts.mode;
+			l.run.stop = job->opts.token.flag();
+			l.run.deadline = job->opts.deadline;
+			l.run.governor = job->opts.governor;
+			l.busy = true;
+			m_running++;
+		}
+		finishDead(dead, now);
+		int64_t picked = MinerPool::now();
+		MineResult r{job->block, MINE_CANCELLED, picked - job->submitted, 0, BlockPhases()};
+		{
+			BC_TRACE_SPAN_ARG("miner.job", job->block.getId());
+			//reset under the lock above, so a cancelAll since then is already in the run
+			r.status = threadMine(r.block, *l.pool, *l.scheduler, l.run);
+		}
+		r.mineNanos = MinerPool::now() - picked;
+		r.phases = l.run.phases;
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			l.busy = false;
+			l.run.stop = NULL;
+			l.run.governor = NULL;
+			m_running--;
+		}
+		finish(job, r);
+	}
+}
+
+void Miner::finish(Job *job, const MineResult &result) {
+	if (job->callback)
+		job->callback(result);
+	else
+		job->promise.set_value(result);
+	delete job;
+}
+
+size_t Miner::queued() const {
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_queue.size();
+}
+
+size_t Miner::running() const {
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_running;
+}
+
+unsigned Miner::lanes() const {
+	return m_lanes.size();
+}
+
+unsigned Miner::threads() const {
+	return m_threads;
+}
+
+const char *Miner::statusName(int status) {
+	switch (status) {
+	case MINE_SOLVED: return "solved";
+	case MINE_NO_SOLUTION: return "no-solution";
+	case MINE_CANCELLED: return "cancelled";
+	case MINE_DEADLINE: return "deadline";
+	default: return "unknown";
+	}
+}
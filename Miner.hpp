@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "Array.hpp"
+#include "Block.hpp"
+#include "Metrics.hpp"
+#include "MinerPool.hpp"
+#include "NonceScheduler.hpp"
+#include "ThreadMine.hpp"
+
+//cooperative cancellation: copies share one flag, and cancel() through any of them stops every job that holds
+//it at its workers' next batch of nonces, or before it starts if it's still queued
+//one token per parent block, say, cancels all the work built on it in one call once that block goes stale
+class CancelToken {
+	std::shared_ptr<std::atomic<bool>> m_flag;
+public:
+	CancelToken() : m_flag(std::make_shared<std::atomic<bool>>(false)) {}
+	void cancel() const { m_flag->store(true, std::memory_order_relaxed); }
+	bool cancelled() const { return m_flag->load(std::memory_order_relaxed); }
+	const std::atomic<bool> *flag() const { return m_flag.get(); }
+};
+
+struct MineOptions {
+	int mode = MINE_LOWEST_NONCE;
+	CancelToken token;    //a fresh one unless the caller shares theirs
+	int64_t deadline = 0; //MinerPool::now() nanoseconds, 0 for none; Miner::in() builds one from a timeout
+	Governor *governor = NULL; //paces the job, one shared by every job holds them all to its budget together
+};
+
+struct MineResult {
+	Block block;              //solved or marked as having no solution, or as submitted when status is cancelled or deadline
+	int status;               //MINE_SOLVED, MINE_NO_SOLUTION, MINE_CANCELLED or MINE_DEADLINE
+	int64_t queuedNanos;      //submit until a lane picked it up
+	int64_t mineNanos;        //on the lane
+	BlockPhases phases;
+};
+
+//embeddable front end to threadMine: jobs are queued and mined on lanes, each lane a MinerPool with its own
+//scheduler and MineRun, so up to lanes() blocks are mined at once and several Miners can share a process
+//results come back through a future or a completion callback, which runs on the lane's thread and should be quick
+//a job that is cancelled or out of time while still queued never reaches a pool, and completes within
+//SWEEP_NANOS of its token being cancelled or right at its deadline even when every lane is busy
+class Miner {
+
+public:
+
+	using Callback = std::function<void(const MineResult &)>;
+
+	static const int64_t SWEEP_NANOS = 1000000; //how often queued jobs' tokens are looked at while any are queued
+
+private:
+
+	struct Job {
+		Block block;
+		MineOptions opts;
+		std::promise<MineResult> promise;
+		Callback callback; //instead of the promise when set
+		int64_t submitted;
+	};
+
+	struct Lane {
+		std::unique_ptr<MinerPool> pool;
+		std::unique_ptr<NonceScheduler> scheduler;
+		MineRun run;
+		bool busy = false; //guarded by m_mtx, so cancelAll only halts runs that are in progress
+		std::thread thread;
+	};
+
+	unsigned m_threads;
+	Array<Lane *> m_lanes;
+
+	mutable std::mutex m_mtx;
+	std::condition_variable m_wake;
+	std::deque<Job *> m_queue;
+	bool m_stop;
+	size_t m_running;
+	std::condition_variable m_queuedWake; //the sweeper's, so it hears about every new job
+	std::thread m_sweeper;
+
+	void lane(unsigned i);
+	void sweep();
+	void takeDead(std::deque<Job *> &dead, int64_t now); //moves out queued jobs that were cancelled or ran out of time, under m_mtx
+	static void finishDead(std::deque<Job *> &dead, int64_t now);
+	static void finish(Job *job, const MineResult &result);
+	void enqueue(Job *job);
+
+public:
+
+	//threads split as evenly as they go over lanes (at least one each), cpus like MinerPool's, in lane order
+	Miner(unsigned threads, unsigned lanes = 1, const Array<unsigned> &cpus = Array<unsigned>());
+	//cancels everything, queued jobs complete as MINE_CANCELLED, and waits for the lanes
+	~Miner();
+
+	Miner(const Miner&) = delete;
+	Miner& operator=(const Miner&) = delete;
+
+	std::future<MineResult> submit(const Block &block, const MineOptions &opts = MineOptions());
+	void submit(const Block &block, Callback done, const MineOptions &opts = MineOptions());
+
+	//halts every running job and completes every queued one as MINE_CANCELLED, the tokens are left alone
+	void cancelAll();
+
+	size_t queued() const;
+	size_t running() const;
+	unsigned lanes() const;
+	unsigned threads() const;
+
+	static int64_t in(int64_t nanos) { return MinerPool::now() + nanos; } //deadline that far from now
+	static const char *statusName(int status);
+
+};
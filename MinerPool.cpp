@@ -0,0 +1,131 @@
+#include "MinerPool.hpp"
+
+#include <chrono>
+#include "Topology.hpp"
+#include "Trace.hpp"
+
+//how many times a parked worker (or run waiting on them) polls before sleeping on its condition variable
+static const unsigned SPIN_COUNT = 64;
+
+MinerPool::MinerPool(unsigned threadCount, const Array<unsigned> &cpus) : m_threads(threadCount), m_cpus(cpus) {
+	m_size = threadCount;
+	m_pinFailures = 0;
+	m_generation = 0;
+	m_started = 0;
+	m_remaining = 0;
+	m_stop = false;
+	m_job = NULL;
+	m_allStarted = 0;
+	m_lastFinished = 0;
+	m_lastRun = RunTimes{0, 0, 0, 0};
+	m_lastOverhead = 0;
+	m_totalOverhead = 0;
+	m_runs = 0;
+	unsigned i = 0;
+	for (auto &thr : m_threads)
+		thr = std::thread(&MinerPool::worker, this, i++);
+}
+
+MinerPool::~MinerPool() {
+	{
+		std::lock_guard<std::mutex> guard(m_mtx);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (auto &thr : m_threads)
+		thr.join();
+}
+
+unsigned MinerPool::size() const {
+	return m_size;
+}
+
+int MinerPool::cpuOf(unsigned thread) const {
+	return thread < m_cpus.size() ? (int)m_cpus[thread] : -1;
+}
+
+unsigned MinerPool::pinFailures() const {
+	return m_pinFailures.load();
+}
+
+int64_t MinerPool::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned MinerPool::waitForWork(unsigned seen) {
+	for (unsigned i = 0; i < SPIN_COUNT; i++) {
+		unsigned gen = m_generation.load(std::memory_order_acquire);
+		if (gen != seen || m_stop.load(std::memory_order_acquire))
+			return gen;
+		std::this_thread::yield();
+	}
+	std::unique_lock<std::mutex> lock(m_mtx);
+	m_wake.wait(lock, [&] { return m_generation.load(std::memory_order_acquire) != seen || m_stop.load(); });
+	return m_generation.load(std::memory_order_acquire);
+}
+
+void MinerPool::worker(unsigned threadNum) {
+	if (threadNum < m_cpus.size() && !Topology::pin(m_cpus[threadNum]))
+		m_pinFailures++;
+	trace::nameThread("miner " + std::to_string(threadNum));
+	unsigned seen = 0;
+	while (true) {
+		seen = waitForWork(seen);
+		if (m_stop.load(std::memory_order_acquire))
+			return;
+		if (m_started.fetch_add(1, std::memory_order_acq_rel) + 1 == m_size)
+			m_allStarted.store(now(), std::memory_order_relaxed);
+		(*m_job)(threadNum, m_size);
+		if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			m_lastFinished.store(now(), std::memory_order_relaxed);
+			std::lock_guard<std::mutex> guard(m_mtx);
+			m_done.notify_one();
+		}
+	}
+}
+
+void MinerPool::run(const Job &job) {
+	int64_t dispatched = now();
+	m_job = &job;
+	m_started.store(0, std::memory_order_relaxed);
+	m_remaining.store(m_size, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> guard(m_mtx);
+		m_generation.fetch_add(1, std::memory_order_release);
+	}
+	m_wake.notify_all();
+
+	bool finished = false;
+	for (unsigned i = 0; i < SPIN_COUNT && !finished; i++) {
+		finished = m_remaining.load(std::memory_order_acquire) == 0;
+		if (!finished)
+			std::this_thread::yield();
+	}
+	if (!finished) {
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_done.wait(lock, [&] { return m_remaining.load(std::memory_order_acquire) == 0; });
+	}
+	int64_t returned = now();
+
+	m_lastRun = RunTimes{dispatched, m_allStarted.load(std::memory_order_relaxed), m_lastFinished.load(std::memory_order_relaxed), returned};
+	m_lastOverhead = (m_lastRun.allStarted - dispatched) + (returned - m_lastRun.lastFinished);
+	m_totalOverhead += m_lastOverhead;
+	m_runs++;
+	m_job = NULL;
+}
+
+int64_t MinerPool::lastDispatchOverhead() const {
+	return m_lastOverhead;
+}
+
+int64_t MinerPool::totalDispatchOverhead() const {
+	return m_totalOverhead;
+}
+
+size_t MinerPool::runs() const {
+	return m_runs;
+}
+
+const MinerPool::RunTimes &MinerPool::lastRun() const {
+	return m_lastRun;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "Array.hpp"
+
+//long lived worker threads that park between jobs
+//run() hands the same job to every worker and returns once all of them finished it,
+//so a chain only pays for thread creation once instead of once per block
+//given cpus, worker i pins itself to cpus[i] before taking any work, so its stack and whatever it allocates
+//first land on that cpu's NUMA node
+class MinerPool {
+
+public:
+
+	using Job = std::function<void(unsigned threadNum, unsigned threadCount)>;
+
+	//when each phase of a run() ended, steady_clock nanoseconds
+	struct RunTimes {
+		int64_t dispatched;   //run() was called
+		int64_t allStarted;   //the last worker picked the job up
+		int64_t lastFinished; //the last worker was done with it
+		int64_t returned;     //run() saw that and returned
+	};
+
+private:
+
+	Array<std::thread> m_threads;
+	unsigned m_size;
+	Array<unsigned> m_cpus;
+	std::atomic<unsigned> m_pinFailures;
+
+	std::mutex m_mtx;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	std::atomic<unsigned> m_generation;
+	std::atomic<unsigned> m_started;
+	std::atomic<unsigned> m_remaining;
+	std::atomic<bool> m_stop;
+	const Job *m_job;
+
+	//steady_clock nanoseconds, written by the workers that close each phase
+	std::atomic<int64_t> m_allStarted;
+	std::atomic<int64_t> m_lastFinished;
+
+	RunTimes m_lastRun;
+	int64_t m_lastOverhead;
+	int64_t m_totalOverhead;
+	size_t m_runs;
+
+	void worker(unsigned threadNum);
+	unsigned waitForWork(unsigned seen);
+
+public:
+
+	MinerPool(unsigned threadCount, const Array<unsigned> &cpus = Array<unsigned>());
+	~MinerPool();
+
+	MinerPool(const MinerPool&) = delete;
+	MinerPool& operator=(const MinerPool&) = delete;
+
+	unsigned size() const;
+	int cpuOf(unsigned thread) const; //-1 if unpinned
+	unsigned pinFailures() const;     //workers the kernel wouldn't pin, after they've started
+
+	void run(const Job &job);
+
+	//dispatch overhead is the time to get every worker running plus the time from the
+	//last worker finishing until run() returns, all in nanoseconds
+	int64_t lastDispatchOverhead() const;
+	int64_t totalDispatchOverhead() const;
+	size_t runs() const;
+	const RunTimes &lastRun() const;
+
+	static int64_t now(); //steady_clock nanoseconds
+
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//bounded lock-free queue for any number of producers and one consumer
+//each slot carries a sequence number that says whose turn it is: producers claim a position with a CAS on the tail
+//and publish the slot by bumping its sequence, so a push is a few atomics and never waits on the consumer's work,
+//only on a full queue, where tryPush returns false and the caller decides what waiting means
+//capacity is rounded up to a power of two
+template<class T>
+class MpscQueue {
+
+	struct Slot {
+		std::atomic<size_t> seq;
+		T value;
+	};
+
+	std::unique_ptr<Slot[]> m_slots;
+	size_t m_mask;
+	alignas(64) std::atomic<size_t> m_tail; //next position a producer claims
+	alignas(64) std::atomic<size_t> m_head; //next position the consumer reads, only the consumer moves it
+
+public:
+
+	explicit MpscQueue(size_t capacity) : m_tail(0), m_head(0) {
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		m_slots.reset(new Slot[size]);
+		m_mask = size - 1;
+		for (size_t i = 0; i < size; i++)
+			m_slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	bool tryPush(const T &value) {
+		size_t pos = m_tail.load(std::memory_order_relaxed);
+		while (true) {
+			Slot &s = m_slots[pos & m_mask];
+			intptr_t diff = (intptr_t)s.seq.load(std::memory_order_acquire) - (intptr_t)pos;
+			if (diff == 0) {
+				if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					s.value = value;
+					s.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false; //the consumer hasn't got to this slot's last value yet
+			} else {
+				pos = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	//consumer only; false when empty, or when the next producer has claimed its slot but not filled it yet
+	bool tryPop(T &value) {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		Slot &s = m_slots[head & m_mask];
+		if (s.seq.load(std::memory_order_acquire) != head + 1)
+			return false;
+		value = s.value;
+		s.seq.store(head + m_mask + 1, std::memory_order_release);
+		m_head.store(head + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	size_t capacity() const { return m_mask + 1; }
+	//a snapshot, only exact when nobody is pushing
+	size_t size() const { return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_relaxed); }
+
+};
@@ -0,0 +1,80 @@
+#include "NonceCheckpoint.hpp"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "MinerPool.hpp"
+#include "Trace.hpp"
+
+//3 added the hash policy, an older checkpoint just doesn't match and the block starts over
+static const char *FORMAT = "bc-checkpoint 3 id=%u previous=%zu threshold=%zx hash=%d searched=%zu\n";
+
+NonceCheckpoint::NonceCheckpoint(const std::string &path, unsigned intervalMs) : m_path(path) {
+	m_intervalMs = intervalMs ? intervalMs : DEFAULT_INTERVAL_MS;
+	m_due = 0;
+	m_saving = false;
+	m_onDisk = false;
+	m_saves = 0;
+}
+
+size_t NonceCheckpoint::resumePoint(const Block &block) {
+	FILE *f = fopen(m_path.c_str(), "r");
+	if (f == NULL)
+		return 0;
+	m_onDisk = true;
+	unsigned id;
+	size_t previous, threshold, searched;
+	int hash;
+	bool ok = fscanf(f, FORMAT, &id, &previous, &threshold, &hash, &searched) == 5;
+	fclose(f);
+	if (!ok || id != block.getId() || previous != block.getPreviousHash() || threshold != block.getThreshold() || hash != block.getHashPolicy())
+		return 0;
+	return searched;
+}
+
+void NonceCheckpoint::begin() {
+	m_due.store(MinerPool::now() + (int64_t)m_intervalMs * 1000000, std::memory_order_relaxed);
+}
+
+void NonceCheckpoint::poll(const Block &block, const NonceScheduler &scheduler) {
+	int64_t now = MinerPool::now();
+	if (now < m_due.load(std::memory_order_relaxed) || m_saving.exchange(true, std::memory_order_acquire))
+		return;
+	m_due.store(now + (int64_t)m_intervalMs * 1000000, std::memory_order_relaxed);
+	save(block, scheduler.searched());
+	m_saving.store(false, std::memory_order_release);
+}
+
+//written through a temporary file and synced before the rename, so the old checkpoint survives a crash mid-save
+bool NonceCheckpoint::save(const Block &block, size_t searched) {
+	BC_TRACE_SPAN_ARG("checkpoint.save", searched);
+	char text[160];
+	int len = snprintf(text, sizeof(text), FORMAT, block.getId(), block.getPreviousHash(), block.getThreshold(), block.getHashPolicy(), searched);
+	std::string tmp = m_path + ".tmp";
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	bool ok = write(fd, text, len) == len;
+	ok = fsync(fd) == 0 && ok;
+	ok = close(fd) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), m_path.c_str()) != 0)
+		return false;
+	m_onDisk = true;
+	m_saves++;
+	return true;
+}
+
+void NonceCheckpoint::clear() {
+	if (!m_onDisk)
+		return;
+	remove(m_path.c_str());
+	m_onDisk = false;
+}
+
+const std::string &NonceCheckpoint::path() const {
+	return m_path;
+}
+
+size_t NonceCheckpoint::saves() const {
+	return m_saves;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "Block.hpp"
+#include "NonceScheduler.hpp"
+
+//remembers how far the search for one block got, so a killed miner picks up where it was instead of rescanning
+//the saved point is the scheduler's searched watermark, so chunks that finished out of order above it and
+//whatever was in flight are tried again on resume; with the default chunk sizes that's well under a second
+class NonceCheckpoint {
+
+public:
+
+	static const unsigned DEFAULT_INTERVAL_MS = 5000;
+
+private:
+
+	std::string m_path;
+	unsigned m_intervalMs;
+	alignas(64) std::atomic<int64_t> m_due; //steady_clock ns of the next save
+	std::atomic<bool> m_saving;
+	bool m_onDisk; //a checkpoint file may exist, saved or found by this object
+	size_t m_saves;
+
+public:
+
+	NonceCheckpoint(const std::string &path, unsigned intervalMs = DEFAULT_INTERVAL_MS);
+
+	//nonce to restart block's search from, 0 unless the file was saved for this very block
+	size_t resumePoint(const Block &block);
+
+	//starts the interval for a new block, call before mining it
+	void begin();
+
+	//cheap check any mining thread can make between chunks, one of them saves when the interval is up
+	void poll(const Block &block, const NonceScheduler &scheduler);
+
+	bool save(const Block &block, size_t searched);
+
+	//drops the file once its block is solved
+	void clear();
+
+	const std::string &path() const;
+	size_t saves() const;
+
+};
@@ -0,0 +1,482 @@
+#include "NonceHasher.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+
+//libstdc++ hashes strings with _Hash_bytes (64 bit murmur), which can be resumed chunk by chunk.
+//anything else goes through std::hash<std::string_view>, which the standard requires to match
+//std::hash<std::string>, so results stay identical to Block's old hasher either way
+#if defined(__GLIBCXX__) && SIZE_MAX == UINT64_MAX
+#define BC_MURMUR_HASH 1
+#else
+#define BC_MURMUR_HASH 0
+#endif
+
+#if BC_MURMUR_HASH && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BC_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define BC_X86_KERNELS 0
+#endif
+
+namespace {
+
+#if BC_MURMUR_HASH
+const size_t MUL = (((size_t)0xc6a4a793UL) << 32UL) + (size_t)0x5bd1e995UL;
+const size_t SEED = 0xc70f6907UL;
+const bool LITTLE_ENDIAN_WORDS = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+inline size_t shiftMix(size_t v) {
+	return v ^ (v >> 47);
+}
+
+inline size_t loadChunk(const char *p) {
+	size_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline size_t loadBytes(const char *p, unsigned n) {
+	size_t v = 0;
+	while (n-- != 0)
+		v = (v << 8) + (unsigned char)p[n];
+	return v;
+}
+
+inline size_t mixChunk(size_t h, size_t data) {
+	h ^= shiftMix(data * MUL) * MUL;
+	return h * MUL;
+}
+
+inline size_t finish(size_t h, const char *tail, unsigned tailLen) {
+	if (tailLen) {
+		h ^= loadBytes(tail, tailLen);
+		h *= MUL;
+	}
+	h = shiftMix(h) * MUL;
+	return shiftMix(h);
+}
+#endif
+
+//text of 000 .. 999 as little endian words, for splicing trailing nonce digits into chunks
+const uint32_t *digitTriples() {
+	static uint32_t table[1000];
+	static bool filled = [] {
+		for (uint32_t v = 0; v < 1000; v++)
+			table[v] = ('0' + v / 100) | ('0' + v / 10 % 10) << 8 | ('0' + v % 10) << 16;
+		return true;
+	}();
+	(void)filled;
+	return table;
+}
+
+unsigned writeDecimal(char *out, size_t v) {
+	char tmp[20];
+	unsigned n = 0;
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	for (unsigned i = 0; i < n; i++)
+		out[i] = tmp[n - 1 - i];
+	return n;
+}
+
+size_t hashText(const char *text, unsigned len) {
+#if BC_MURMUR_HASH
+	size_t h = SEED ^ (len * MUL);
+	unsigned chunks = len / 8;
+	for (unsigned k = 0; k < chunks; k++)
+		h = mixChunk(h, loadChunk(text + k * 8));
+	return finish(h, text + chunks * 8, len & 7);
+#else
+	return std::hash<std::string_view>()(std::string_view(text, len));
+#endif
+}
+
+#if BC_MURMUR_HASH
+//batch kernels finish the hash for every lane from a shared state h0
+//words holds rows of MAX_BATCH lanes: one row per remaining full chunk, then the tail bytes if any
+//lanes are processed up to count rounded to the vector width, so the word rows are padded to MAX_BATCH
+using BatchFunc = unsigned (*)(size_t h0, const size_t *words, unsigned rows, bool tail, unsigned count, size_t threshold, size_t *hashes);
+const unsigned ROW = NonceHasher::MAX_BATCH;
+
+unsigned batchScalar(size_t h0, const size_t *words, unsigned rows, bool tail, unsigned count, size_t threshold, size_t *hashes) {
+	for (unsigned lane = 0; lane < count; lane++) {
+		size_t h = h0;
+		for (unsigned r = 0; r < rows; r++)
+			h = mixChunk(h, words[r * ROW + lane]);
+		if (tail) {
+			h ^= words[rows * ROW + lane];
+			h *= MUL;
+		}
+		h = shiftMix(h) * MUL;
+		hashes[lane] = shiftMix(h);
+	}
+	for (unsigned lane = 0; lane < count; lane++)
+		if (hashes[lane] <= threshold)
+			return lane;
+	return count;
+}
+
+#if BC_X86_KERNELS
+//avx2 has no 64 bit multiply, so build the low half from three 32x32 products
+__attribute__((target("avx2"))) inline __m256i mulLo64(__m256i a, __m256i b) {
+	__m256i lo = _mm256_mul_epu32(a, b);
+	__m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+	return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2"))) inline __m256i shiftMix4(__m256i v) {
+	return _mm256_xor_si256(v, _mm256_srli_epi64(v, 47));
+}
+
+//every lane group is carried through each row before any is finished so the multiply chains overlap
+__attribute__((target("avx2")))
+unsigned batchAvx2(size_t h0, const size_t *words, unsigned rows, bool tail, unsigned count, size_t threshold, size_t *hashes) {
+	const __m256i mul = _mm256_set1_epi64x((long long)MUL);
+	const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+	const __m256i thr = _mm256_xor_si256(_mm256_set1_epi64x((long long)threshold), sign);
+	const unsigned groups = (count + 3) / 4;
+	__m256i h[ROW / 4];
+	for (unsigned g = 0; g < groups; g++)
+		h[g] = _mm256_set1_epi64x((long long)h0);
+	for (unsigned r = 0; r < rows; r++) {
+		for (unsigned g = 0; g < groups; g++) {
+			__m256i k = _mm256_loadu_si256((const __m256i *)(words + r * ROW + g * 4));
+			k = mulLo64(shiftMix4(mulLo64(k, mul)), mul);
+			h[g] = mulLo64(_mm256_xor_si256(h[g], k), mul);
+		}
+	}
+	for (unsigned g = 0; g < groups; g++) {
+		if (tail)
+			h[g] = mulLo64(_mm256_xor_si256(h[g], _mm256_loadu_si256((const __m256i *)(words + rows * ROW + g * 4))), mul);
+		h[g] = shiftMix4(mulLo64(shiftMix4(h[g]), mul));
+	}
+	for (unsigned g = 0; g < groups; g++) {
+		_mm256_storeu_si256((__m256i *)(hashes + g * 4), h[g]);
+		//unsigned h <= threshold is !(h > threshold) on sign flipped values
+		int above = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_xor_si256(h[g], sign), thr)));
+		int hits = ~above & 0xf;
+		if (hits) {
+			unsigned idx = g * 4 + __builtin_ctz(hits);
+			return idx < count ? idx : count;
+		}
+	}
+	return count;
+}
+
+__attribute__((target("avx512f,avx512dq")))
+unsigned batchAvx512(size_t h0, const size_t *words, unsigned rows, bool tail, unsigned count, size_t threshold, size_t *hashes) {
+	const __m512i mul = _mm512_set1_epi64((long long)MUL);
+	const __m512i thr = _mm512_set1_epi64((long long)threshold);
+	//the zero masked shift, since gcc's unmasked one merges into an undefined vector and warns about it
+	const __mmask8 all = 0xff;
+	const unsigned groups = (count + 7) / 8;
+	__m512i h[ROW / 8];
+	for (unsigned g = 0; g < groups; g++)
+		h[g] = _mm512_set1_epi64((long long)h0);
+	for (unsigned r = 0; r < rows; r++) {
+		for (unsigned g = 0; g < groups; g++) {
+			__m512i k = _mm512_mullo_epi64(_mm512_loadu_si512(words + r * ROW + g * 8), mul);
+			k = _mm512_mullo_epi64(_mm512_xor_si512(k, _mm512_maskz_srli_epi64(all, k, 47)), mul);
+			h[g] = _mm512_mullo_epi64(_mm512_xor_si512(h[g], k), mul);
+		}
+	}
+	for (unsigned g = 0; g < groups; g++) {
+		if (tail)
+			h[g] = _mm512_mullo_epi64(_mm512_xor_si512(h[g], _mm512_loadu_si512(words + rows * ROW + g * 8)), mul);
+		h[g] = _mm512_mullo_epi64(_mm512_xor_si512(h[g], _mm512_maskz_srli_epi64(all, h[g], 47)), mul);
+		h[g] = _mm512_xor_si512(h[g], _mm512_maskz_srli_epi64(all, h[g], 47));
+	}
+	for (unsigned g = 0; g < groups; g++) {
+		_mm512_storeu_si512(hashes + g * 8, h[g]);
+		__mmask8 hits = _mm512_cmple_epu64_mask(h[g], thr);
+		if (hits) {
+			unsigned idx = g * 8 + __builtin_ctz(hits);
+			return idx < count ? idx : count;
+		}
+	}
+	return count;
+}
+#endif
+
+bool kernelSupported(NonceHasher::BatchKernel kernel) {
+#if BC_X86_KERNELS
+	if (kernel == NonceHasher::KERNEL_AVX2)
+		return __builtin_cpu_supports("avx2");
+	if (kernel == NonceHasher::KERNEL_AVX512)
+		return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+#endif
+	return kernel == NonceHasher::KERNEL_SCALAR;
+}
+
+NonceHasher::BatchKernel detectKernel() {
+	if (kernelSupported(NonceHasher::KERNEL_AVX512))
+		return NonceHasher::KERNEL_AVX512;
+	if (kernelSupported(NonceHasher::KERNEL_AVX2))
+		return NonceHasher::KERNEL_AVX2;
+	return NonceHasher::KERNEL_SCALAR;
+}
+
+BatchFunc kernelFunc(NonceHasher::BatchKernel kernel) {
+#if BC_X86_KERNELS
+	if (kernel == NonceHasher::KERNEL_AVX2)
+		return batchAvx2;
+	if (kernel == NonceHasher::KERNEL_AVX512)
+		return batchAvx512;
+#endif
+	return batchScalar;
+}
+#endif
+
+std::atomic<int> activeKernel(-1);
+
+}
+
+
+
+NonceHasher::NonceHasher(size_t previousHash) {
+	m_prefixLen = writeDecimal(m_text, previousHash);
+	format(0);
+}
+
+size_t NonceHasher::hash(size_t previousHash, size_t nonce) {
+	char text[MAX_DIGITS * 2];
+	unsigned len = writeDecimal(text, previousHash);
+	len += writeDecimal(text + len, nonce);
+	return hashText(text, len);
+}
+
+void NonceHasher::format(size_t nonce) {
+	m_nonce = nonce;
+	m_len = m_prefixLen + writeDecimal(m_text + m_prefixLen, nonce);
+	//the length is mixed into the initial state, so every cached chunk depends on it
+#if BC_MURMUR_HASH
+	m_state[0] = SEED ^ (m_len * MUL);
+#endif
+	m_validChunks = 0;
+}
+
+void NonceHasher::seek(size_t nonce) {
+	format(nonce);
+}
+
+void NonceHasher::advance(size_t step) {
+	size_t next = m_nonce + step;
+	if (next < m_nonce) { //wrapped around
+		format(next);
+		return;
+	}
+	m_nonce = next;
+	unsigned pos = m_len;
+	while (step) {
+		if (pos == m_prefixLen) { //gained a digit
+			format(next);
+			return;
+		}
+		--pos;
+		size_t v = (m_text[pos] - '0') + step % 10;
+		step /= 10;
+		if (v >= 10) {
+			v -= 10;
+			step++;
+		}
+		m_text[pos] = '0' + (char)v;
+	}
+	if (pos / 8 < m_validChunks)
+		m_validChunks = pos / 8;
+}
+
+size_t NonceHasher::nonce() const {
+	return m_nonce;
+}
+
+size_t NonceHasher::stateAt(unsigned chunks) {
+#if BC_MURMUR_HASH
+	for (unsigned k = m_validChunks; k < chunks; k++)
+		m_state[k + 1] = mixChunk(m_state[k], loadChunk(m_text + k * 8));
+	if (chunks > m_validChunks)
+		m_validChunks = chunks;
+#endif
+	return m_state[chunks];
+}
+
+size_t NonceHasher::digest() {
+#if BC_MURMUR_HASH
+	unsigned chunks = m_len / 8;
+	return finish(stateAt(chunks), m_text + chunks * 8, m_len & 7);
+#else
+	return hashText(m_text, m_len);
+#endif
+}
+
+unsigned NonceHasher::scan(unsigned count, size_t threshold, size_t &hashOut) {
+	if (count > MAX_BATCH)
+		count = MAX_BATCH;
+#if BC_MURMUR_HASH
+	size_t first = m_nonce;
+	size_t last = first + (count - 1);
+	char lastText[MAX_DIGITS];
+	unsigned lastLen = writeDecimal(lastText, last);
+	//the lanes only share a state if no nonce in the batch wraps or gains a digit
+	if (count > 1 && last > first && m_prefixLen + lastLen == m_len) {
+		unsigned diff = m_prefixLen;
+		while (m_text[diff] == lastText[diff - m_prefixLen])
+			diff++;
+		unsigned common = diff / 8;
+		unsigned chunks = m_len / 8;
+		unsigned rows = chunks - common;
+		bool tail = (m_len & 7) != 0;
+		size_t h0 = stateAt(common);
+
+		size_t words[(MAX_CHUNKS + 1) * MAX_BATCH];
+		size_t hashes[MAX_BATCH];
+		char text[MAX_DIGITS * 2];
+		memcpy(text, m_text, m_len);
+		unsigned low = m_len - diff; //trailing digits that differ across the batch
+		if (low <= 3 && LITTLE_ENDIAN_WORDS) {
+			//only the last few digits move, so splice their text into otherwise fixed words
+			//they sit at the end of the text, which spans at most this row and a tail row
+			for (unsigned pos = diff; pos < m_len; pos++)
+				text[pos] = 0;
+			size_t base[2];
+			for (unsigned r = 0; r < rows + tail; r++)
+				base[r] = r < rows ? loadChunk(text + (common + r) * 8) : loadBytes(text + chunks * 8, m_len & 7);
+			unsigned mod = low == 3 ? 1000 : low == 2 ? 100 : 10;
+			unsigned v0 = (unsigned)(first % mod);
+			unsigned shift = diff % 8 * 8;
+			unsigned drop = (3 - low) * 8;
+			const uint32_t *digits = digitTriples();
+			for (unsigned lane = 0; lane < MAX_BATCH; lane++) {
+				size_t d = digits[v0 + (lane < count ? lane : count - 1)] >> drop; //pad lanes repeat the last nonce
+				words[lane] = base[0] | d << shift;
+				if (rows + tail > 1)
+					words[MAX_BATCH + lane] = base[1] | (shift ? d >> (64 - shift) : 0);
+			}
+		} else {
+			for (unsigned lane = 0; lane < MAX_BATCH; lane++) {
+				for (unsigned r = 0; r < rows; r++)
+					words[r * MAX_BATCH + lane] = loadChunk(text + (common + r) * 8);
+				if (tail)
+					words[rows * MAX_BATCH + lane] = loadBytes(text + chunks * 8, m_len & 7);
+				if (lane + 1 >= count)
+					continue; //pad lanes repeat the last nonce
+				//digits past the last nonce are never touched, so this never carries into the prefix
+				unsigned pos = m_len;
+				while (text[--pos] == '9')
+					text[pos] = '0';
+				text[pos]++;
+			}
+		}
+
+		unsigned hit = kernelFunc(batchKernel())(h0, words, rows, tail, count, threshold, hashes);
+		if (hit < count)
+			hashOut = hashes[hit];
+		advance(count);
+		return hit;
+	}
+#endif
+	for (unsigned i = 0; i < count; i++, advance()) {
+		size_t h = digest();
+		if (h <= threshold) {
+			hashOut = h;
+			advance(count - i);
+			return i;
+		}
+	}
+	return count;
+}
+
+NonceHasher::BatchKernel NonceHasher::batchKernel() {
+	int kernel = activeKernel.load(std::memory_order_relaxed);
+	if (kernel < 0) {
+#if BC_MURMUR_HASH
+		kernel = detectKernel();
+#else
+		kernel = KERNEL_SCALAR;
+#endif
+		activeKernel.store(kernel, std::memory_order_relaxed);
+	}
+	return (BatchKernel)kernel;
+}
+
+bool NonceHasher::useBatchKernel(BatchKernel kernel) {
+#if BC_MURMUR_HASH
+	if (!kernelSupported(kernel))
+		return false;
+#else
+	if (kernel != KERNEL_SCALAR)
+		return false;
+#endif
+	activeKernel.store(kernel, std::memory_order_relaxed);
+	return true;
+}
+
+const char *NonceHasher::kernelName(BatchKernel kernel) {
+	if (kernel == KERNEL_AVX2)
+		return "avx2";
+	if (kernel == KERNEL_AVX512)
+		return "avx512";
+	return "scalar";
+}
+
+bool NonceHasher::selfTest(std::string *failure) {
+	static const size_t prevs[] = {0, 5, 123456789, 9999999999999999999ULL, SIZE_MAX};
+	static const size_t starts[] = {0, 7, 95, 990, 9985, 12345678, 99999990, 4294967290ULL, 999999999999999990ULL,
+		9999999999999999990ULL, SIZE_MAX - 40, SIZE_MAX - 10};
+	//the batches are checked against hash() below, so hash() and the cursor are first checked against the
+	//standard library itself, on every nonce any batch covers, wrapping past SIZE_MAX included
+	std::hash<std::string> reference;
+	for (size_t prev : prevs)
+		for (size_t start : starts) {
+			NonceHasher cursor(prev);
+			cursor.seek(start);
+			for (unsigned i = 0; i < MAX_BATCH; i++, cursor.advance()) {
+				size_t nonce = start + i;
+				size_t want = reference(std::to_string(prev) + std::to_string(nonce));
+				if (hash(prev, nonce) != want || cursor.digest() != want) {
+					if (failure)
+						*failure = "hash of nonce " + std::to_string(nonce) + " after " + std::to_string(prev) + " differs from std::hash<std::string>";
+					return false;
+				}
+			}
+		}
+
+	BatchKernel active = batchKernel();
+	bool ok = true;
+	for (int k = KERNEL_SCALAR; k <= KERNEL_AVX512 && ok; k++) {
+		if (!useBatchKernel((BatchKernel)k))
+			continue;
+		for (size_t prev : prevs)
+			for (size_t start : starts)
+				for (unsigned count = 1; count <= MAX_BATCH && ok; count++) {
+					size_t expected[MAX_BATCH];
+					for (unsigned i = 0; i < count; i++)
+						expected[i] = hash(prev, start + i);
+					//no hit, then hits on the last, a middle and the first lane (or earlier, if one hashes lower)
+					size_t thresholds[] = {0, expected[count - 1], expected[count / 2], SIZE_MAX};
+					for (size_t threshold : thresholds) {
+						unsigned want = 0;
+						while (want < count && expected[want] > threshold)
+							want++;
+						NonceHasher cursor(prev);
+						cursor.seek(start);
+						size_t got = 0;
+						unsigned hit = cursor.scan(count, threshold, got);
+						if (hit != want || (hit < count && got != expected[hit]) || cursor.nonce() != start + count) {
+							if (failure)
+								*failure = std::string(kernelName((BatchKernel)k)) + ": scan of " + std::to_string(count) + " nonces from " + std::to_string(start)
+									+ " after " + std::to_string(prev) + " found lane " + std::to_string(hit) + ", expected " + std::to_string(want);
+							ok = false;
+							break;
+						}
+					}
+				}
+	}
+	useBatchKernel(active);
+	return ok;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//hashes std::to_string(previousHash) + std::to_string(nonce) exactly like std::hash<std::string>
+//without allocating: the text lives in a stack buffer, the previousHash prefix is formatted once,
+//and the hash state after each leading 8 byte chunk is cached so advancing the nonce only
+//rehashes the chunks holding the digits that changed
+class NonceHasher {
+
+	static const unsigned MAX_DIGITS = 20; //digits in SIZE_MAX
+	static const unsigned MAX_CHUNKS = (MAX_DIGITS * 2 + 7) / 8;
+
+	char m_text[MAX_DIGITS * 2];
+	unsigned m_prefixLen;
+	unsigned m_len;
+	size_t m_nonce;
+	size_t m_state[MAX_CHUNKS + 1]; //m_state[k] is the hash after k chunks of m_text
+	unsigned m_validChunks;
+
+	void format(size_t nonce);
+	size_t stateAt(unsigned chunks);
+
+public:
+
+	static const unsigned MAX_BATCH = 32;
+
+	enum BatchKernel { KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512 };
+
+	explicit NonceHasher(size_t previousHash);
+
+	//one-shot version for callers that only try a single nonce
+	static size_t hash(size_t previousHash, size_t nonce);
+
+	void seek(size_t nonce);
+	void advance(size_t step = 1); //nonce += step, rewriting only the digits that change
+
+	size_t nonce() const;
+	size_t digest();
+
+	//tries count (<= MAX_BATCH) consecutive nonces starting at nonce(), leaving the cursor count past it
+	//returns the index of the first nonce hashing to <= threshold (its hash goes in hashOut) or count if none
+	unsigned scan(unsigned count, size_t threshold, size_t &hashOut);
+
+	//kernel used by scan, picked from cpuid on first use; useBatchKernel returns false if unsupported here
+	static BatchKernel batchKernel();
+	static bool useBatchKernel(BatchKernel kernel);
+	static const char *kernelName(BatchKernel kernel);
+
+	//checks hash() and digest() against std::hash<std::string> of the text on the same grid of nonces,
+	//then runs scan on every kernel this cpu supports against hash() nonce by nonce: batches of every size from 1 to
+	//MAX_BATCH, starting across digit count changes and the top of the nonce range, with and without a hit
+	//the kernel in use is left as it was; false with a description of the first mismatch otherwise
+	static bool selfTest(std::string *failure = NULL);
+
+};
@@ -0,0 +1,223 @@
+#include "NonceScheduler.hpp"
+
+#include <chrono>
+#include <thread>
+#include "NonceHasher.hpp"
+#include "Topology.hpp"
+
+static int64_t steadyNanos() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//chunks are whole batches so the batch kernel never runs partly empty
+static size_t roundToBatch(size_t n) {
+	n -= n % NonceHasher::MAX_BATCH;
+	return n ? n : NonceHasher::MAX_BATCH;
+}
+
+NonceScheduler::NonceScheduler(unsigned threadCount, ChunkPolicy policy) : m_lanes(threadCount) {
+	m_count = threadCount;
+	m_policy = policy;
+	m_tracking = false;
+	if (m_policy.minChunk > m_policy.maxChunk)
+		m_policy.minChunk = m_policy.maxChunk;
+	if (m_policy.refill == 0)
+		m_policy.refill = 1;
+	if (m_policy.guidedDivisor == 0)
+		m_policy.guidedDivisor = 1;
+	reset();
+}
+
+void NonceScheduler::reset(size_t begin, size_t end) {
+	for (auto &lane : m_lanes) {
+		std::lock_guard<std::mutex> guard(lane.mtx);
+		lane.chunks.clear();
+		lane.queued.store(0, std::memory_order_relaxed);
+		if (lane.chunkSize == 0 || m_policy.mode != ChunkPolicy::ADAPTIVE)
+			lane.chunkSize = m_policy.mode == ChunkPolicy::FIXED ? m_policy.fixedChunk : m_policy.minChunk;
+		lane.handedOutAt = 0;
+		lane.steals = 0;
+	}
+	m_end = end;
+	m_frontier.store(begin, std::memory_order_relaxed);
+	m_scheduled.store(0, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> guard(m_progressMtx);
+	m_finished.clear();
+	m_searched.store(begin, std::memory_order_relaxed);
+}
+
+size_t NonceScheduler::chunkSize(Lane &lane) {
+	size_t size = lane.chunkSize;
+	if (m_policy.mode == ChunkPolicy::GUIDED) {
+		size_t remaining = m_end - m_frontier.load(std::memory_order_relaxed);
+		size = remaining / ((size_t)m_policy.guidedDivisor * m_count);
+		if (size > m_policy.maxChunk)
+			size = m_policy.maxChunk;
+		if (size < m_policy.minChunk)
+			size = m_policy.minChunk;
+	}
+	return roundToBatch(size);
+}
+
+void NonceScheduler::adapt(Lane &lane, int64_t now) {
+	if (m_policy.mode != ChunkPolicy::ADAPTIVE || lane.handedOutAt == 0)
+		return;
+	int64_t took = now - lane.handedOutAt;
+	if (took <= 0)
+		return;
+	//move halfway towards the size that would have hit the target time
+	double wanted = (double)lane.handedOutSize * (m_policy.targetMicros * 1000.0) / took;
+	double size = (lane.chunkSize + wanted) / 2;
+	if (size > m_policy.maxChunk)
+		size = (double)m_policy.maxChunk;
+	if (size < m_policy.minChunk)
+		size = (double)m_policy.minChunk;
+	lane.chunkSize = (size_t)size;
+}
+
+bool NonceScheduler::refill(Lane &lane) {
+	size_t size = chunkSize(lane);
+	size_t want = size * m_policy.refill;
+	size_t begin = m_frontier.load(std::memory_order_relaxed);
+	size_t take;
+	do {
+		if (begin >= m_end)
+			return false;
+		take = m_end - begin < want ? m_end - begin : want;
+	} while (!m_frontier.compare_exchange_weak(begin, begin + take, std::memory_order_relaxed));
+	for (size_t at = begin; at < begin + take; at += size) {
+		size_t left = begin + take - at;
+		lane.chunks.push_back({at, at + (left < size ? left : size)});
+	}
+	lane.queued.store(lane.chunks.size(), std::memory_order_relaxed);
+	return true;
+}
+
+bool NonceScheduler::steal(unsigned thief, NonceChunk &chunk, size_t minQueued) {
+	//pick the fullest deque, then take its highest chunk
+	unsigned victim = m_count;
+	size_t most = minQueued - 1;
+	for (unsigned i = 0; i < m_count; i++) {
+		if (i == thief)
+			continue;
+		size_t n = m_lanes[i].queued.load(std::memory_order_relaxed); //rechecked under the lock below
+		if (n > most) {
+			most = n;
+			victim = i;
+		}
+	}
+	if (victim == m_count)
+		return false;
+	Lane &v = m_lanes[victim];
+	std::lock_guard<std::mutex> guard(v.mtx);
+	if (v.chunks.size() < minQueued)
+		return false;
+	chunk = v.chunks.back();
+	v.chunks.pop_back();
+	v.queued.store(v.chunks.size(), std::memory_order_relaxed);
+	return true;
+}
+
+bool NonceScheduler::next(unsigned lane, NonceChunk &chunk) {
+	Lane &own = m_lanes[lane];
+	int64_t now = steadyNanos();
+	bool found = false;
+	bool stolen = false;
+	{
+		std::lock_guard<std::mutex> guard(own.mtx);
+		adapt(own, now);
+		if (!own.chunks.empty()) {
+			chunk = own.chunks.front();
+			own.chunks.pop_front();
+			own.queued.store(own.chunks.size(), std::memory_order_relaxed);
+			found = true;
+		}
+	}
+	//out of local work: relieve a thread that is falling behind before claiming fresh nonces
+	if (!found)
+		found = stolen = steal(lane, chunk, 2);
+	if (!found) {
+		std::lock_guard<std::mutex> guard(own.mtx);
+		if (refill(own)) {
+			chunk = own.chunks.front();
+			own.chunks.pop_front();
+			own.queued.store(own.chunks.size(), std::memory_order_relaxed);
+			found = true;
+		}
+	}
+	//frontier is exhausted, help whoever still has chunks queued
+	//the queued counts are read without the locks and lag behind them, so a retry yields rather than spinning on a stale one
+	while (!found) {
+		found = stolen = steal(lane, chunk, 1);
+		if (found)
+			break;
+		bool anyQueued = false;
+		for (unsigned i = 0; i < m_count && !anyQueued; i++)
+			anyQueued = m_lanes[i].queued.load(std::memory_order_relaxed) != 0;
+		if (!anyQueued)
+			break;
+		std::this_thread::yield();
+	}
+	std::lock_guard<std::mutex> guard(own.mtx);
+	own.handedOutAt = found ? now : 0;
+	own.handedOutSize = found ? chunk.end - chunk.begin : 0;
+	if (stolen)
+		own.steals++;
+	if (found)
+		m_scheduled.fetch_add(chunk.end - chunk.begin, std::memory_order_relaxed);
+	return found;
+}
+
+void NonceScheduler::complete(const NonceChunk &chunk) {
+	if (!m_tracking)
+		return;
+	std::lock_guard<std::mutex> guard(m_progressMtx);
+	size_t searched = m_searched.load(std::memory_order_relaxed);
+	if (chunk.begin != searched) {
+		m_finished[chunk.begin] = chunk.end;
+		return;
+	}
+	searched = chunk.end;
+	//soak up whatever finished early and now joins the searched prefix
+	auto it = m_finished.begin();
+	while (it != m_finished.end() && it->first == searched) {
+		searched = it->second;
+		it = m_finished.erase(it);
+	}
+	m_searched.store(searched, std::memory_order_relaxed);
+}
+
+void NonceScheduler::trackProgress(bool on) {
+	m_tracking = on;
+}
+
+size_t NonceScheduler::searched() const {
+	return m_searched.load(std::memory_order_relaxed);
+}
+
+bool NonceScheduler::placeLanes(const Array<int> &laneNodes) {
+	return Topology::placeSlots(&m_lanes[0], sizeof(Lane), m_count, laneNodes);
+}
+
+unsigned NonceScheduler::threadCount() const {
+	return m_count;
+}
+
+const ChunkPolicy &NonceScheduler::policy() const {
+	return m_policy;
+}
+
+size_t NonceScheduler::scheduled() const {
+	return m_scheduled.load(std::memory_order_relaxed);
+}
+
+size_t NonceScheduler::steals() const {
+	size_t n = 0;
+	for (unsigned i = 0; i < m_count; i++)
+		n += m_lanes[i].steals;
+	return n;
+}
+
+size_t NonceScheduler::steals(unsigned lane) const {
+	return m_lanes[lane].steals;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include "Array.hpp"
+
+struct NonceChunk {
+	size_t begin;
+	size_t end; //exclusive
+};
+
+struct ChunkPolicy {
+	static const int FIXED = 0;    //every chunk is fixedChunk nonces
+	static const int GUIDED = 1;   //remaining nonces / (guidedDivisor * threads), shrinking towards the end of a range
+	static const int ADAPTIVE = 2; //each thread sizes its chunks to take about targetMicros at its measured speed
+
+	int mode = ADAPTIVE;
+	size_t fixedChunk = 1 << 14;
+	size_t minChunk = 1 << 10;
+	size_t maxChunk = 1 << 22;
+	unsigned guidedDivisor = 4;
+	unsigned targetMicros = 500;
+	unsigned refill = 4; //chunks a thread claims from the shared frontier at once
+};
+
+//hands out contiguous nonce chunks to a fixed set of threads
+//each thread claims a few chunks at a time from a shared frontier into its own deque and works
+//from the front, threads that run dry first steal from the back of the fullest deque, so slow or
+//preempted threads never sit on queued work and the nonces still go out in roughly rising order
+class NonceScheduler {
+
+	struct alignas(64) Lane {
+		std::mutex mtx;
+		std::deque<NonceChunk> chunks;
+		std::atomic<size_t> queued{0}; //chunks.size(), readable without the lock
+		size_t chunkSize = 0;
+		int64_t handedOutAt = 0; //steady_clock ns when the last chunk was taken, 0 if none is out
+		size_t handedOutSize = 0;
+		size_t steals = 0;
+	};
+
+	Array<Lane> m_lanes;
+	unsigned m_count;
+	ChunkPolicy m_policy;
+	size_t m_end;
+	alignas(64) std::atomic<size_t> m_frontier;
+	std::atomic<size_t> m_scheduled;
+
+	//finished chunks above the searched watermark, only kept while progress is tracked
+	bool m_tracking;
+	std::mutex m_progressMtx;
+	std::map<size_t, size_t> m_finished;
+	std::atomic<size_t> m_searched;
+
+	size_t chunkSize(Lane &lane);
+	void adapt(Lane &lane, int64_t now);
+	bool refill(Lane &lane);
+	bool steal(unsigned thief, NonceChunk &chunk, size_t minQueued);
+
+public:
+
+	NonceScheduler(unsigned threadCount, ChunkPolicy policy = ChunkPolicy());
+
+	//starts a new search over [begin, end), dropping anything left over from the last one
+	//end is exclusive, so the default range stops one short of the top: nonce SIZE_MAX is never handed out
+	void reset(size_t begin = 0, size_t end = SIZE_MAX);
+
+	//next chunk for thread lane, false once the whole range has been handed out
+	bool next(unsigned lane, NonceChunk &chunk);
+
+	//reports chunk as fully searched, chunks can finish in any order
+	//ignored unless trackProgress is on, since it costs a shared lock per chunk
+	void complete(const NonceChunk &chunk);
+	void trackProgress(bool on);
+	size_t searched() const; //every nonce from the reset begin up to this one has been tried
+
+	//keeps each lane's memory on its thread's NUMA node, laneNodes[i] for lane i, see Topology::placeSlots
+	bool placeLanes(const Array<int> &laneNodes);
+
+	unsigned threadCount() const;
+	const ChunkPolicy &policy() const;
+	size_t scheduled() const; //nonces handed out since reset
+	size_t steals() const;
+	size_t steals(unsigned lane) const;
+
+};
@@ -0,0 +1,68 @@
+#include "RetargetController.hpp"
+
+#include <cmath>
+#include "Block.hpp"
+
+RetargetController::RetargetController(double initialBits, RetargetPolicy policy) : m_samples(policy.window ? policy.window : 1) {
+	m_policy = policy;
+	if (m_policy.window == 0)
+		m_policy.window = 1;
+	if (m_policy.maxStepBits <= 0)
+		m_policy.maxStepBits = 1;
+	m_bits = initialBits < m_policy.minBits ? m_policy.minBits : initialBits > m_policy.maxBits ? m_policy.maxBits : initialBits;
+	m_count = 0;
+	m_next = 0;
+}
+
+double RetargetController::bits() const {
+	return m_bits;
+}
+
+size_t RetargetController::threshold() const {
+	return bitsThreshold(m_bits);
+}
+
+void RetargetController::record(double seconds, double hashes) {
+	if (hashes <= 0)
+		hashes = std::exp2(m_bits);
+	m_samples[m_next] = {seconds, hashes};
+	m_next = (m_next + 1) % m_policy.window;
+	if (m_count < m_policy.window)
+		m_count++;
+
+	double rate = hashrate();
+	if (rate <= 0)
+		return;
+	//2^bits hashes on average, so the bits that fill the target time at this rate
+	double wanted = std::log2(rate * m_policy.targetSeconds);
+	double step = wanted - m_bits;
+	if (step > m_policy.maxStepBits)
+		step = m_policy.maxStepBits;
+	if (step < -m_policy.maxStepBits)
+		step = -m_policy.maxStepBits;
+	m_bits += step;
+	if (m_bits < m_policy.minBits)
+		m_bits = m_policy.minBits;
+	if (m_bits > m_policy.maxBits)
+		m_bits = m_policy.maxBits;
+}
+
+double RetargetController::hashrate() const {
+	double seconds = 0, hashes = 0;
+	for (unsigned i = 0; i < m_count; i++) {
+		seconds += m_samples[i].seconds;
+		hashes += m_samples[i].hashes;
+	}
+	return seconds > 0 ? hashes / seconds : 0;
+}
+
+double RetargetController::meanSeconds() const {
+	double seconds = 0;
+	for (unsigned i = 0; i < m_count; i++)
+		seconds += m_samples[i].seconds;
+	return m_count ? seconds / m_count : 0;
+}
+
+const RetargetPolicy &RetargetController::policy() const {
+	return m_policy;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Array.hpp"
+
+struct RetargetPolicy {
+	double targetSeconds = 1.0; //block interval to hold
+	unsigned window = 16;       //recent blocks the hashrate is measured over
+	double maxStepBits = 1.0;   //most the difficulty moves after one block, 1 bit halves or doubles the work
+	double minBits = 0;
+	double maxBits = 64;
+};
+
+//picks each block's difficulty so blocks take about targetSeconds
+//the hashrate over the last window blocks (hashes each needed over their solve times) is what the next block
+//is sized for, so a change in core count is followed within a few blocks and one lucky block barely moves it
+class RetargetController {
+
+	struct Sample {
+		double seconds;
+		double hashes;
+	};
+
+	RetargetPolicy m_policy;
+	double m_bits;
+	Array<Sample> m_samples; //ring of the last window blocks
+	unsigned m_count;
+	unsigned m_next;
+
+public:
+
+	RetargetController(double initialBits, RetargetPolicy policy = RetargetPolicy());
+
+	double bits() const;
+	size_t threshold() const; //for the next block
+
+	//solve time of the block mined at the current bits and the hashes it took
+	//hashes 0 means unknown, the average for the difficulty, 2^bits, is used instead
+	void record(double seconds, double hashes = 0);
+
+	double hashrate() const;    //hashes per second over the window
+	double meanSeconds() const; //block time over the window
+	const RetargetPolicy &policy() const;
+
+};
@@ -0,0 +1,353 @@
+#include "Sha256.hpp"
+
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BC_SHA_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define BC_SHA_NI 0
+#endif
+
+const uint32_t Sha256::IV[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+namespace {
+
+alignas(16) const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline uint32_t rotr(uint32_t x, unsigned n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+inline uint32_t loadBig(const uint8_t *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+inline void storeBig(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+inline void storeLittle(uint8_t *p, uint64_t v, unsigned bytes) {
+	for (unsigned i = 0; i < bytes; i++)
+		p[i] = v >> (8 * i);
+}
+
+//a little endian field's 4 bytes read as a big endian message word
+inline uint32_t swap32(uint32_t v) {
+	return __builtin_bswap32(v);
+}
+
+void compressPortable(uint32_t state[8], const uint32_t words[16]) {
+	uint32_t w[64];
+	memcpy(w, words, 16 * sizeof(uint32_t));
+	for (unsigned i = 16; i < 64; i++) {
+		uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for (unsigned i = 0; i < 64; i++) {
+		uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+		uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+#if BC_SHA_NI
+#define BC_SHA_TARGET __attribute__((target("sha,sse4.1")))
+
+//four rounds G*4 .. G*4+3 on message group cur, extending the schedule as Intel's reference code does:
+//next gets sha256msg2 once cur is complete (G 3 .. 14), prev gets sha256msg1 (G 1 .. 12)
+template<int G>
+BC_SHA_TARGET inline __attribute__((always_inline)) void quadRound(__m128i &abef, __m128i &cdgh, __m128i &cur, __m128i &next, __m128i &prev) {
+	__m128i msg = _mm_add_epi32(cur, _mm_load_si128((const __m128i *)&K[G * 4]));
+	cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+	if constexpr (G >= 3 && G <= 14) {
+		next = _mm_add_epi32(next, _mm_alignr_epi8(cur, prev, 4));
+		next = _mm_sha256msg2_epu32(next, cur);
+	}
+	msg = _mm_shuffle_epi32(msg, 0x0e);
+	abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+	if constexpr (G >= 1 && G <= 12)
+		prev = _mm_sha256msg1_epu32(prev, cur);
+}
+
+BC_SHA_TARGET void compressShaNi(uint32_t state[8], const uint32_t words[16]) {
+	//the rounds instruction wants the state as ABEF and CDGH
+	__m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+	__m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+	__m128i abef = _mm_alignr_epi8(dcba, efgh, 8);
+	__m128i cdgh = _mm_blend_epi16(efgh, dcba, 0xf0);
+	__m128i abefIn = abef, cdghIn = cdgh;
+
+	__m128i m0 = _mm_loadu_si128((const __m128i *)&words[0]);
+	__m128i m1 = _mm_loadu_si128((const __m128i *)&words[4]);
+	__m128i m2 = _mm_loadu_si128((const __m128i *)&words[8]);
+	__m128i m3 = _mm_loadu_si128((const __m128i *)&words[12]);
+	quadRound<0>(abef, cdgh, m0, m1, m3);
+	quadRound<1>(abef, cdgh, m1, m2, m0);
+	quadRound<2>(abef, cdgh, m2, m3, m1);
+	quadRound<3>(abef, cdgh, m3, m0, m2);
+	quadRound<4>(abef, cdgh, m0, m1, m3);
+	quadRound<5>(abef, cdgh, m1, m2, m0);
+	quadRound<6>(abef, cdgh, m2, m3, m1);
+	quadRound<7>(abef, cdgh, m3, m0, m2);
+	quadRound<8>(abef, cdgh, m0, m1, m3);
+	quadRound<9>(abef, cdgh, m1, m2, m0);
+	quadRound<10>(abef, cdgh, m2, m3, m1);
+	quadRound<11>(abef, cdgh, m3, m0, m2);
+	quadRound<12>(abef, cdgh, m0, m1, m3);
+	quadRound<13>(abef, cdgh, m1, m2, m0);
+	quadRound<14>(abef, cdgh, m2, m3, m1);
+	quadRound<15>(abef, cdgh, m3, m0, m2);
+
+	abef = _mm_add_epi32(abef, abefIn);
+	cdgh = _mm_add_epi32(cdgh, cdghIn);
+	__m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+	__m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+	_mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(feba, dchg, 0xf0));
+	_mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+
+bool shaNiSupported() {
+	unsigned a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1) || !(c & bit_SSSE3))
+		return false;
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		return false;
+	return (b & (1u << 29)) != 0; //CPUID.(EAX=7,ECX=0):EBX.SHA
+}
+#endif
+
+typedef void (*CompressFunc)(uint32_t state[8], const uint32_t words[16]);
+
+bool kernelSupported(Sha256::Kernel kernel) {
+#if BC_SHA_NI
+	if (kernel == Sha256::KERNEL_SHANI)
+		return shaNiSupported();
+#endif
+	return kernel == Sha256::KERNEL_PORTABLE;
+}
+
+CompressFunc kernelFunc(Sha256::Kernel kernel) {
+#if BC_SHA_NI
+	if (kernel == Sha256::KERNEL_SHANI)
+		return compressShaNi;
+#endif
+	return compressPortable;
+}
+
+std::atomic<int> activeKernel(-1);
+std::atomic<CompressFunc> activeFunc(NULL);
+
+CompressFunc compressFunc() {
+	CompressFunc f = activeFunc.load(std::memory_order_relaxed);
+	if (f == NULL) {
+		Sha256::kernel();
+		f = activeFunc.load(std::memory_order_relaxed);
+	}
+	return f;
+}
+
+}
+
+
+
+void Sha256::compress(uint32_t state[8], const uint32_t words[16]) {
+	compressFunc()(state, words);
+}
+
+void Sha256::digest(const void *data, size_t len, uint8_t out[32]) {
+	const uint8_t *p = (const uint8_t *)data;
+	CompressFunc f = compressFunc();
+	uint32_t state[8];
+	uint32_t w[16];
+	memcpy(state, IV, sizeof(state));
+	size_t left = len;
+	for (; left >= 64; left -= 64, p += 64) {
+		for (unsigned i = 0; i < 16; i++)
+			w[i] = loadBig(p + 4 * i);
+		f(state, w);
+	}
+	//the tail, 0x80, zeros and the bit length, one block or two if the length doesn't fit after the tail
+	uint8_t last[128] = {};
+	memcpy(last, p, left);
+	last[left] = 0x80;
+	size_t blocks = left + 9 <= 64 ? 1 : 2;
+	uint64_t bits = (uint64_t)len * 8;
+	for (unsigned i = 0; i < 8; i++)
+		last[blocks * 64 - 1 - i] = bits >> (8 * i);
+	for (size_t b = 0; b < blocks; b++) {
+		for (unsigned i = 0; i < 16; i++)
+			w[i] = loadBig(last + b * 64 + 4 * i);
+		f(state, w);
+	}
+	for (unsigned i = 0; i < 8; i++)
+		storeBig(out + 4 * i, state[i]);
+}
+
+Sha256::Kernel Sha256::kernel() {
+	int k = activeKernel.load(std::memory_order_relaxed);
+	if (k < 0) {
+		k = kernelSupported(KERNEL_SHANI) ? KERNEL_SHANI : KERNEL_PORTABLE;
+		activeFunc.store(kernelFunc((Kernel)k), std::memory_order_relaxed);
+		activeKernel.store(k, std::memory_order_relaxed);
+	}
+	return (Kernel)k;
+}
+
+bool Sha256::useKernel(Kernel kernel) {
+	if (!kernelSupported(kernel))
+		return false;
+	activeFunc.store(kernelFunc(kernel), std::memory_order_relaxed);
+	activeKernel.store(kernel, std::memory_order_relaxed);
+	return true;
+}
+
+const char *Sha256::kernelName(Kernel kernel) {
+	return kernel == KERNEL_SHANI ? "sha-ni" : "portable";
+}
+
+bool Sha256::selfTest(std::string *failure) {
+	struct Vector {
+		const char *message;
+		size_t repeat;
+		const char *digest;
+	};
+	//FIPS 180-2 appendix B and the NIST example set
+	static const Vector vectors[] = {
+		{"abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+		{"", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+		{"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+		{"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1,
+			"cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+		{"a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+	};
+	auto hex = [](const uint8_t *d) {
+		static const char digits[] = "0123456789abcdef";
+		std::string s;
+		for (unsigned i = 0; i < 32; i++) {
+			s += digits[d[i] >> 4];
+			s += digits[d[i] & 15];
+		}
+		return s;
+	};
+	Kernel active = kernel();
+	bool ok = true;
+	for (int k = KERNEL_PORTABLE; k <= KERNEL_SHANI && ok; k++) {
+		if (!useKernel((Kernel)k))
+			continue;
+		const char *name = kernelName((Kernel)k);
+		for (const Vector &v : vectors) {
+			std::string message;
+			for (size_t r = 0; r < v.repeat; r++)
+				message += v.message;
+			uint8_t out[32];
+			digest(message.data(), message.size(), out);
+			if (hex(out) != v.digest) {
+				if (failure)
+					*failure = std::string(name) + ": sha256 of \"" + (v.repeat > 1 ? std::string(v.message) + "\" x" + std::to_string(v.repeat) : std::string(v.message) + "\"")
+						+ " is " + hex(out) + ", expected " + v.digest;
+				ok = false;
+				break;
+			}
+		}
+		//the midstate path against hashing the whole header twice
+		for (size_t nonce : {(size_t)0, (size_t)1, (size_t)0x0123456789abcdefULL, SIZE_MAX}) {
+			if (!ok)
+				break;
+			uint8_t header[Sha256d::HEADER_BYTES], inner[32], expected[32], got[32];
+			Sha256d::header(42, 0xfedcba9876543210ULL, nonce, header);
+			digest(header, sizeof(header), inner);
+			digest(inner, sizeof(inner), expected);
+			Sha256d(42, 0xfedcba9876543210ULL).digest(nonce, got);
+			if (memcmp(got, expected, 32) != 0) {
+				if (failure)
+					*failure = std::string(name) + ": sha256d midstate of nonce " + std::to_string(nonce) + " is " + hex(got) + ", expected " + hex(expected);
+				ok = false;
+			}
+		}
+	}
+	useKernel(active);
+	return ok;
+}
+
+
+
+Sha256d::Sha256d(unsigned id, size_t previousHash) {
+	uint8_t first[64] = {};
+	storeLittle(first, VERSION, 4);
+	storeLittle(first + 4, id, 4);
+	storeLittle(first + 8, previousHash, 8);
+	uint32_t w[16];
+	for (unsigned i = 0; i < 16; i++)
+		w[i] = loadBig(first + 4 * i);
+	memcpy(m_mid, Sha256::IV, sizeof(m_mid));
+	Sha256::compress(m_mid, w);
+}
+
+void Sha256d::header(unsigned id, size_t previousHash, size_t nonce, uint8_t out[HEADER_BYTES]) {
+	memset(out, 0, HEADER_BYTES);
+	storeLittle(out, VERSION, 4);
+	storeLittle(out + 4, id, 4);
+	storeLittle(out + 8, previousHash, 8);
+	storeLittle(out + 64, nonce, 8);
+}
+
+void Sha256d::finish(size_t nonce, uint32_t state[8]) const {
+	CompressFunc f = compressFunc();
+	//header bytes 64 .. 79 then the padding for an 80 byte message
+	uint32_t w[16] = {swap32((uint32_t)nonce), swap32((uint32_t)(nonce >> 32)), 0, 0, 0x80000000u, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, HEADER_BYTES * 8};
+	uint32_t inner[8];
+	memcpy(inner, m_mid, sizeof(inner));
+	f(inner, w);
+	//the inner digest's words are already the outer message's big endian words, padded for 32 bytes
+	uint32_t outer[16] = {inner[0], inner[1], inner[2], inner[3], inner[4], inner[5], inner[6], inner[7], 0x80000000u, 0, 0, 0, 0, 0, 0, 256};
+	memcpy(state, Sha256::IV, 8 * sizeof(uint32_t));
+	f(state, outer);
+}
+
+size_t Sha256d::hash(size_t nonce) const {
+	uint32_t state[8];
+	finish(nonce, state);
+	return (size_t)state[0] << 32 | state[1];
+}
+
+void Sha256d::digest(size_t nonce, uint8_t out[32]) const {
+	uint32_t state[8];
+	finish(nonce, state);
+	for (unsigned i = 0; i < 8; i++)
+		storeBig(out + 4 * i, state[i]);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//SHA-256 (FIPS 180-4), with the block compression picked from cpuid on first use: the x86 SHA extensions
+//when the cpu reports them, portable code otherwise. digest() hashes whole messages, compress() is the
+//bare block step for callers that keep their own midstate and lay out their padded blocks as words
+class Sha256 {
+public:
+
+	enum Kernel { KERNEL_PORTABLE, KERNEL_SHANI };
+
+	static const uint32_t IV[8];
+
+	//one 64 byte block given as its 16 big endian words, already loaded
+	static void compress(uint32_t state[8], const uint32_t words[16]);
+	static void digest(const void *data, size_t len, uint8_t out[32]);
+
+	//useKernel returns false if unsupported here
+	static Kernel kernel();
+	static bool useKernel(Kernel kernel);
+	static const char *kernelName(Kernel kernel);
+
+	//runs the FIPS 180-2 example messages and Sha256d's midstate path through every kernel this cpu has
+	//returns false with the first mismatch in failure, the active kernel is left as it was
+	static bool selfTest(std::string *failure = NULL);
+
+};
+
+//double SHA-256 of an 80 byte header, all fields little endian:
+//  0 version (1)  4 id  8 previousHash  16 zeros  64 nonce  72 zeros
+//the first 64 bytes don't depend on the nonce, so their compression is done once here and each nonce
+//costs two compressions, the second half of the header and the 32 byte inner digest
+class Sha256d {
+
+	uint32_t m_mid[8];
+
+	void finish(size_t nonce, uint32_t state[8]) const;
+
+public:
+
+	static const unsigned HEADER_BYTES = 80;
+	static const uint32_t VERSION = 1;
+
+	Sha256d(unsigned id, size_t previousHash);
+
+	static void header(unsigned id, size_t previousHash, size_t nonce, uint8_t out[HEADER_BYTES]);
+
+	void digest(size_t nonce, uint8_t out[32]) const;
+	//first 8 digest bytes read big endian, so leading zero bits of the hash are leading zeros of the hex digest
+	size_t hash(size_t nonce) const;
+
+	static size_t hash(unsigned id, size_t previousHash, size_t nonce) { return Sha256d(id, previousHash).hash(nonce); }
+
+};
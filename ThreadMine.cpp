@@ -0,0 +1,237 @@
+#include "ThreadMine.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include "Governor.hpp"
+#include "HashPolicy.hpp"
+#include "NonceHasher.hpp"
+#include "Trace.hpp"
+
+static thread_local BlockPhases lastPhases;
+static thread_local bool lastPublished;
+static std::atomic<bool> specialized(true);
+
+template<class Hash, class Target>
+static void mineWith(const Block &b, NonceScheduler &scheduler, unsigned threadNum, MineRun &run, ThreadCounters *counters, NonceCheckpoint *checkpoint, const Target &target);
+
+MineRun::MineRun() : cancelled(false), halted(0), bestNonce(NO_NONCE), publishedAt(0) {}
+
+void MineRun::reset() {
+	cancelled.store(false, std::memory_order_relaxed);
+	halted.store(0, std::memory_order_relaxed);
+	bestNonce.store(NO_NONCE, std::memory_order_relaxed);
+	publishedAt.store(0, std::memory_order_relaxed);
+	phases = BlockPhases();
+}
+
+//lock free minimum, the first publisher also raises the cancel flag and stamps the time
+void MineRun::publish(size_t nonce) {
+	size_t best = bestNonce.load(std::memory_order_relaxed);
+	while (nonce < best && !bestNonce.compare_exchange_weak(best, nonce, std::memory_order_relaxed))
+		;
+	int64_t none = 0;
+	publishedAt.compare_exchange_strong(none, MinerPool::now(), std::memory_order_relaxed);
+	cancelled.store(true, std::memory_order_release);
+}
+
+void MineRun::halt(int reason) {
+	int none = 0;
+	halted.compare_exchange_strong(none, reason, std::memory_order_relaxed);
+}
+
+int threadMine(Block &block, MinerPool &pool, NonceScheduler &scheduler, int mode, MinerMetrics *metrics, NonceCheckpoint *checkpoint) {
+	MineRun run;
+	run.mode = mode;
+	return threadMine(block, pool, scheduler, run, metrics, checkpoint);
+}
+
+int threadMine(Block &block, MinerPool &pool, NonceScheduler &scheduler, MineRun &mineRun, MinerMetrics *metrics, NonceCheckpoint *checkpoint) {
+	BC_TRACE_SPAN_ARG("threadMine", block.getId());
+	//a token cancelled or a deadline passed before the search even started
+	if (mineRun.stop && mineRun.stop->load(std::memory_order_relaxed))
+		mineRun.halt(MINE_CANCELLED);
+	else if (mineRun.deadline && MinerPool::now() >= mineRun.deadline)
+		mineRun.halt(MINE_DEADLINE);
+	scheduler.trackProgress(checkpoint != NULL);
+	if (checkpoint) {
+		scheduler.reset(checkpoint->resumePoint(block));
+		checkpoint->begin();
+	} else {
+		scheduler.reset();
+	}
+	int64_t started = MinerPool::now();
+	if (!mineRun.stopping())
+		pool.run([&block, &scheduler, &mineRun, metrics, checkpoint](unsigned threadNum, unsigned) {
+			mineBlockTS(block, scheduler, threadNum, mineRun, metrics ? &metrics->counters(threadNum) : NULL, checkpoint);
+		});
+	int64_t joined = MinerPool::now();
+	//a solution can be published before the last worker even started, that block had no search phase of its own
+	MinerPool::RunTimes run = pool.lastRun();
+	if (run.dispatched < started) //never ran, everything was the check above
+		run = {started, started, started, started};
+	int64_t published = mineRun.publishedAt.load(std::memory_order_relaxed);
+	int64_t searched = published ? std::min(std::max(published, run.allStarted), run.lastFinished) : run.lastFinished;
+	BlockPhases &phases = mineRun.phases;
+	phases.dispatch = run.allStarted - started;
+	phases.search = searched - run.allStarted;
+	phases.cancel = run.lastFinished - searched;
+	phases.join = joined - run.lastFinished;
+	lastPhases = phases;
+	lastPublished = published != 0;
+	if (metrics) {
+		//whatever a thread didn't spend hashing, scheduling or paced it spent parked or waiting on the others
+		for (unsigned i = 0; i < pool.size(); i++) {
+			ThreadCounters &c = metrics->counters(i);
+			c.steals += scheduler.steals(i);
+			c.idleNanos += (joined - started) - c.busyNanos - c.schedNanos - c.throttleNanos - c.governorNanos;
+			metrics->flush(i);
+		}
+		metrics->recordBlock(joined - started, &phases);
+	}
+	//in lowest nonce mode a halted search may not have finished every chunk below the best so far
+	size_t nonce = mineRun.bestNonce.load(std::memory_order_relaxed);
+	int halted = mineRun.halted.load(std::memory_order_relaxed);
+	if (halted && (nonce == MineRun::NO_NONCE || mineRun.mode == MINE_LOWEST_NONCE))
+		return halted; //the checkpoint keeps what was searched
+	if (nonce != MineRun::NO_NONCE)
+		block.tryNonce(nonce); //plug in found nonce
+	else
+		block.setNoSolution();
+	if (checkpoint)
+		checkpoint->clear();
+	return nonce != MineRun::NO_NONCE ? MINE_SOLVED : MINE_NO_SOLUTION;
+}
+
+void mineBlockTS(const Block &b, NonceScheduler &scheduler, unsigned threadNum, MineRun &run, ThreadCounters *counters, NonceCheckpoint *checkpoint) {
+	withHashPolicy(b.getHashPolicy(), [&](auto policy) {
+		using Hash = decltype(policy);
+		if (!specialized.load(std::memory_order_relaxed))
+			return mineWith<Hash>(b, scheduler, threadNum, run, counters, checkpoint, RuntimeTarget{b.getThreshold()});
+		withTarget(b.getThreshold(), [&](auto target) {
+			mineWith<Hash>(b, scheduler, threadNum, run, counters, checkpoint, target);
+		});
+	});
+}
+
+void specializeTargets(bool on) {
+	specialized.store(on, std::memory_order_relaxed);
+}
+
+//the worker loop, one copy per hash policy and target so the scan inlines with the target check folded in
+template<class Hash, class Target>
+static void mineWith(const Block &b, NonceScheduler &scheduler, unsigned threadNum, MineRun &run, ThreadCounters *counters, NonceCheckpoint *checkpoint, const Target &target) {
+	typename Hash::Cursor hasher(b.getPreviousHash(), b.getId());
+	NonceChunk chunk;
+	ThreadCounters local; //kept in registers/stack while mining, copied out once at the end
+	//in lowest mode a thread can stop at the first chunk that starts past the best solution: each lane's owner
+	//finishes its own queue in ascending order and thieves only take the top of one, so every chunk below the best
+	//is still left to a thread that reaches it before anything higher
+	//a cancelled token or passed deadline stops every mode, and whoever notices records why, so a search cut
+	//short is never mistaken for a finished one
+	bool lowest = run.mode == MINE_LOWEST_NONCE;
+	auto done = [lowest, &run](size_t at) {
+		if (lowest ? at >= run.bestNonce.load(std::memory_order_relaxed) : run.cancelled.load(std::memory_order_relaxed))
+			return true;
+		if (!run.stopping())
+			return false;
+		run.halt(MINE_CANCELLED); //keeps MINE_DEADLINE if that came first
+		return true;
+	};
+	//the governor needs each chunk's busy time whether or not anyone keeps the counters
+	bool timed = counters || run.governor;
+	int64_t mark = timed ? MinerPool::now() : 0;
+	//the governor's cost is the time it takes to charge plus the cpu its sleeps burn, the rest of a pause is the pacing itself
+	auto pay = [&](int64_t wait, int64_t t, auto stop) {
+		int64_t cpu = Governor::threadCpuNanos();
+		run.governor->pause(wait, stop);
+		cpu = Governor::threadCpuNanos() - cpu;
+		int64_t woke = MinerPool::now();
+		local.governorNanos += cpu;
+		local.throttleNanos += woke - t - cpu;
+		return woke;
+	};
+	//debt the last search left behind is paid before this one hashes anything: its deciding chunk wasn't slept off
+	//and its pauses could be cut short, so without this a chain of quick blocks would never wait at all
+	//only a cancel or the deadline cuts this pause short
+	if (run.governor) {
+		int64_t wait = run.governor->charge(0, 0, mark);
+		int64_t t = MinerPool::now();
+		local.governorNanos += t - mark;
+		if (wait)
+			t = pay(wait, t, [&run] { return run.stopping() || (run.deadline && MinerPool::now() >= run.deadline); });
+		mark = t;
+	}
+	while (scheduler.next(threadNum, chunk)) {
+		if (timed) {
+			int64_t t = MinerPool::now();
+			local.schedNanos += t - mark;
+			mark = t;
+		}
+		if (run.deadline && MinerPool::now() >= run.deadline)
+			run.halt(MINE_DEADLINE);
+		if (done(chunk.begin))
+			break;
+		BC_TRACE_SPAN_ARG("chunk", chunk.begin);
+		local.chunks++;
+		size_t tried = local.noncesTried;
+		//chunks are contiguous, so the hasher only rewrites the low digits between batches
+		hasher.seek(chunk.begin);
+		bool stop = false;
+		bool cut = false;
+		for (size_t i = chunk.begin; i < chunk.end && !stop; i += NonceHasher::MAX_BATCH) {
+			if (done(i)) {
+				cut = true;
+				break;
+			}
+			unsigned count = chunk.end - i < NonceHasher::MAX_BATCH ? (unsigned)(chunk.end - i) : NonceHasher::MAX_BATCH;
+			size_t hash;
+			unsigned hit = hasher.scan(count, target, hash);
+			if (hit < count) {
+				run.publish(i + hit);
+				local.noncesTried += hit + 1;
+				local.hits++;
+				stop = true;
+			} else {
+				local.noncesTried += count;
+			}
+		}
+		int64_t busy = 0;
+		if (timed) {
+			int64_t t = MinerPool::now();
+			busy = t - mark;
+			local.busyNanos += busy;
+			mark = t;
+		}
+		//the winning chunk is charged like any other, but its debt is left for the next search to pay
+		//so the solution isn't held up, and a pause cut short by the block being decided leaves the rest the same way
+		if (run.governor) {
+			int64_t wait = run.governor->charge(local.noncesTried - tried, busy, mark);
+			int64_t t = MinerPool::now();
+			local.governorNanos += t - mark;
+			if (wait && !stop)
+				t = pay(wait, t, [&] { return done(chunk.end); });
+			mark = t;
+		}
+		if (stop)
+			break;
+		//a chunk cut short doesn't count as searched
+		if (checkpoint && !cut) {
+			scheduler.complete(chunk);
+			checkpoint->poll(b, scheduler);
+		}
+		if (done(chunk.end))
+			break;
+	}
+	if (counters) {
+		local.schedNanos += MinerPool::now() - mark;
+		counters->add(local);
+	}
+}
+
+int64_t lastCancelToJoin() {
+	return lastPublished ? lastPhases.cancel + lastPhases.join : 0;
+}
+
+BlockPhases lastBlockPhases() {
+	return lastPhases;
+}
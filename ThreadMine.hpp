@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "Block.hpp"
+#include "Metrics.hpp"
+#include "MinerPool.hpp"
+#include "NonceCheckpoint.hpp"
+#include "NonceScheduler.hpp"
+
+class Governor;
+
+//first found: every worker stops as soon as any of them solves the block, the winner depends on scheduling
+//lowest nonce: workers finish every chunk below the best solution so far, so the result is the lowest
+//valid nonce and matches mineBlock no matter how many threads are used
+const int MINE_FIRST_FOUND = 0;
+const int MINE_LOWEST_NONCE = 1;
+
+//how a search ended: cancelled and deadline leave the block unsolved, with a checkpoint kept for a later resume
+const int MINE_SOLVED = 0;
+const int MINE_NO_SOLUTION = 1;
+const int MINE_CANCELLED = 2;
+const int MINE_DEADLINE = 3;
+
+//everything one search shares between its workers, so searches on different pools never touch each other
+//the fields the workers poll every batch sit on their own cache lines, away from anything written often
+class MineRun {
+public:
+	static const size_t NO_NONCE = SIZE_MAX; //never handed out by the scheduler
+
+	int mode = MINE_LOWEST_NONCE;
+	const std::atomic<bool> *stop = NULL; //polled every batch alongside halted, a CancelToken's flag
+	int64_t deadline = 0;                 //MinerPool::now() nanoseconds, checked every chunk; 0 for none
+	Governor *governor = NULL;            //paces every chunk when set, and can be shared between runs
+
+	alignas(64) std::atomic<bool> cancelled; //a solution was published, first found mode stops on it
+	std::atomic<int> halted;                 //0, or MINE_CANCELLED or MINE_DEADLINE once it has to give up
+	alignas(64) std::atomic<size_t> bestNonce;
+	alignas(64) std::atomic<int64_t> publishedAt;
+	BlockPhases phases;
+
+	MineRun();
+	MineRun(const MineRun&) = delete;
+	MineRun& operator=(const MineRun&) = delete;
+
+	void reset(); //for the next block, keeps mode, stop, deadline and governor
+	void publish(size_t nonce);
+	void halt(int reason); //from any thread, the first reason sticks
+	bool stopping() const { return halted.load(std::memory_order_relaxed) || (stop && stop->load(std::memory_order_relaxed)); }
+};
+
+//mines block on every worker of pool, each taking contiguous nonce chunks from scheduler
+//scheduler must have one lane per pool thread; if no nonce solves the block it is marked as having no solution
+//metrics, if given, must also have one slot per pool thread and gets every thread's counters plus the block latency
+//checkpoint, if given, restarts the search where a checkpoint for this block left off and keeps saving progress
+//any state lives in run (or a local one), so separate pools can mine at the same time from different threads
+//run must be new or reset(): it isn't reset here, so a halt() that lands before the search starts still counts
+int threadMine(Block &block, MinerPool &pool, NonceScheduler &scheduler, MineRun &run, MinerMetrics *metrics = NULL, NonceCheckpoint *checkpoint = NULL);
+int threadMine(Block &block, MinerPool &pool, NonceScheduler &scheduler, int mode = MINE_LOWEST_NONCE, MinerMetrics *metrics = NULL, NonceCheckpoint *checkpoint = NULL);
+
+//runs the loop instantiated for the block's hash policy and, when its threshold is a whole difficulty, for that
+//difficulty as a compile time leading zero test
+void mineBlockTS(const Block &b, NonceScheduler &scheduler, unsigned threadNum, MineRun &run, ThreadCounters *counters = NULL, NonceCheckpoint *checkpoint = NULL);
+//off makes every block use the runtime threshold loop, for comparing the two (default on)
+void specializeTargets(bool on);
+
+//nanoseconds from the first solution being published until every worker of the calling thread's last threadMine
+//had returned, 0 if none was found
+int64_t lastCancelToJoin();
+//dispatch, search, cancel and join time of the calling thread's last threadMine, they add up to its whole call
+BlockPhases lastBlockPhases();
@@ -0,0 +1,215 @@
+#include "Topology.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char *const Topology::SYSFS_CPU = "/sys/devices/system/cpu";
+
+//from linux/mempolicy.h, which numaif.h wraps; spelled out so there's no libnuma dependency
+static const int BC_MPOL_PREFERRED = 1;
+static const unsigned BC_MPOL_MF_MOVE = 1 << 1;
+
+//first unsigned in a sysfs file, fallback if it's missing (package and core ids on some VMs)
+static unsigned readNumber(const std::string &path, unsigned fallback) {
+	FILE *f = fopen(path.c_str(), "r");
+	if (f == NULL)
+		return fallback;
+	unsigned v;
+	if (fscanf(f, "%u", &v) != 1)
+		v = fallback;
+	fclose(f);
+	return v;
+}
+
+//a cpu's node shows up as a nodeN entry in its sysfs directory
+static unsigned readNode(const std::string &dir) {
+	DIR *d = opendir(dir.c_str());
+	if (d == NULL)
+		return 0;
+	unsigned node = 0;
+	while (struct dirent *e = readdir(d)) {
+		unsigned n;
+		char rest;
+		if (sscanf(e->d_name, "node%u%c", &n, &rest) == 1) {
+			node = n;
+			break;
+		}
+	}
+	closedir(d);
+	return node;
+}
+
+Topology::Topology() {
+	m_cores = 0;
+	m_packages = 0;
+	m_nodes = 0;
+}
+
+Topology Topology::detect() {
+	return detect(SYSFS_CPU, allowedCpus());
+}
+
+Topology Topology::detect(const std::string &root, const Array<unsigned> &cpus) {
+	struct Raw {
+		unsigned cpu, node, package, coreId;
+	};
+	std::vector<Raw> raw;
+	for (unsigned cpu : cpus) {
+		std::string dir = root + "/cpu" + std::to_string(cpu);
+		raw.push_back({cpu, readNode(dir), readNumber(dir + "/topology/physical_package_id", 0), readNumber(dir + "/topology/core_id", cpu)});
+	}
+	std::sort(raw.begin(), raw.end(), [](const Raw &a, const Raw &b) {
+		return std::tie(a.node, a.package, a.coreId, a.cpu) < std::tie(b.node, b.package, b.coreId, b.cpu);
+	});
+
+	//core ids repeat across packages, so a core is a (package, core id) pair
+	Topology t;
+	t.m_cpus = Array<Cpu>(raw.size());
+	std::map<std::pair<unsigned, unsigned>, unsigned> cores;
+	std::map<unsigned, unsigned> packages, nodes;
+	for (size_t i = 0; i < raw.size(); i++) {
+		auto key = std::make_pair(raw[i].package, raw[i].coreId);
+		bool first = cores.find(key) == cores.end();
+		if (first)
+			cores[key] = (unsigned)cores.size();
+		packages[raw[i].package] = 0;
+		nodes[raw[i].node] = 0;
+		Cpu &c = t.m_cpus[i];
+		c.cpu = raw[i].cpu;
+		c.core = cores[key];
+		c.package = raw[i].package;
+		c.node = raw[i].node;
+		c.sibling = first ? 0 : t.m_cpus[i - 1].sibling + 1;
+	}
+	t.m_cores = (unsigned)cores.size();
+	t.m_packages = (unsigned)packages.size();
+	t.m_nodes = (unsigned)nodes.size();
+	return t;
+}
+
+Array<unsigned> Topology::allowedCpus() {
+	Array<unsigned> cpus;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		for (long i = 0; i < n; i++)
+			cpus.push_back((unsigned)i);
+		return cpus;
+	}
+	for (unsigned i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &set))
+			cpus.push_back(i);
+	return cpus;
+}
+
+size_t Topology::cpus() const { return m_cpus.size(); }
+unsigned Topology::cores() const { return m_cores; }
+unsigned Topology::packages() const { return m_packages; }
+unsigned Topology::nodes() const { return m_nodes; }
+const Topology::Cpu &Topology::cpu(size_t i) const { return m_cpus[i]; }
+
+int Topology::nodeOf(unsigned cpu) const {
+	for (const Cpu &c : m_cpus)
+		if (c.cpu == cpu)
+			return (int)c.node;
+	return -1;
+}
+
+Array<unsigned> Topology::placement(unsigned threads, int policy) const {
+	Array<unsigned> out;
+	if (policy == PIN_NONE || m_cpus.empty())
+		return out;
+
+	//m_cpus is already node, core, sibling order, which is what PIN_SMT wants
+	std::vector<const Cpu *> order;
+	for (const Cpu &c : m_cpus)
+		order.push_back(&c);
+	//every core's first sibling, then every core's second, ...
+	auto bySibling = [](const Cpu *a, const Cpu *b) {
+		return std::tie(a->sibling, a->node, a->core) < std::tie(b->sibling, b->node, b->core);
+	};
+	if (policy == PIN_CORES)
+		std::stable_sort(order.begin(), order.end(), bySibling);
+
+	if (policy == PIN_NODES) {
+		//node n gets threads n * threads / nodes up to the next node's share, each node filled by core
+		std::map<unsigned, std::vector<const Cpu *>> byNode;
+		for (const Cpu *c : order)
+			byNode[c->node].push_back(c);
+		unsigned n = 0;
+		for (auto &node : byNode) {
+			std::stable_sort(node.second.begin(), node.second.end(), bySibling);
+			unsigned first = (unsigned)((size_t)threads * n / byNode.size());
+			unsigned last = (unsigned)((size_t)threads * (n + 1) / byNode.size());
+			for (unsigned i = first; i < last; i++)
+				out.push_back(node.second[(i - first) % node.second.size()]->cpu);
+			n++;
+		}
+		return out;
+	}
+
+	for (unsigned i = 0; i < threads; i++)
+		out.push_back(order[i % order.size()]->cpu);
+	return out;
+}
+
+std::string Topology::toString() const {
+	char buf[128];
+	snprintf(buf, sizeof(buf), "cpus=%zu  cores=%u  packages=%u  nodes=%u", m_cpus.size(), m_cores, m_packages, m_nodes);
+	return buf;
+}
+
+int Topology::parsePolicy(const char *name) {
+	for (int p = PIN_NONE; p <= PIN_NODES; p++)
+		if (name != NULL && !strcmp(name, policyName(p)))
+			return p;
+	return -1;
+}
+
+const char *Topology::policyName(int policy) {
+	switch (policy) {
+	case PIN_CORES: return "cores";
+	case PIN_SMT: return "smt";
+	case PIN_NODES: return "nodes";
+	default: return "none";
+	}
+}
+
+bool Topology::pin(unsigned cpu) {
+	if (cpu >= CPU_SETSIZE)
+		return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool Topology::placeSlots(const void *base, size_t slotBytes, size_t count, const Array<int> &slotNodes) {
+#ifdef SYS_mbind
+	const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t begin = ((uintptr_t)base + page - 1) / page * page;
+	uintptr_t end = ((uintptr_t)base + slotBytes * count) / page * page;
+	bool ok = true;
+	for (uintptr_t p = begin; p < end; p += page) {
+		size_t slot = (p - (uintptr_t)base) / slotBytes;
+		int node = slot < slotNodes.size() ? slotNodes[slot] : -1;
+		if (node < 0 || node >= 64)
+			continue;
+		unsigned long mask = 1UL << node;
+		ok = syscall(SYS_mbind, (void *)p, (unsigned long)page, BC_MPOL_PREFERRED, &mask, 64UL, BC_MPOL_MF_MOVE) == 0 && ok;
+	}
+	return ok;
+#else
+	return false;
+#endif
+}
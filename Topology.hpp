@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "Array.hpp"
+
+//where this process may run, read from sysfs: logical cpus grouped into physical cores (SMT siblings),
+//sockets and NUMA nodes, restricted to the cpus in the affinity mask
+//placement() turns that into one cpu per mining thread so the kernel stops moving workers between cores,
+//siblings and sockets; more threads than cpus wrap around
+class Topology {
+
+public:
+
+	struct Cpu {
+		unsigned cpu;     //logical cpu number
+		unsigned core;    //physical core, numbered 0 .. cores() - 1 across every package
+		unsigned package;
+		unsigned node;    //NUMA node
+		unsigned sibling; //index among the core's SMT threads, 0 for the first
+	};
+
+	static const int PIN_NONE = 0;  //no affinity, the scheduler decides
+	static const int PIN_CORES = 1; //one thread per physical core first, second siblings only once every core has one
+	static const int PIN_SMT = 2;   //fill both siblings of a core before moving to the next
+	static const int PIN_NODES = 3; //threads split evenly across NUMA nodes, by core within each node
+
+	static const char *const SYSFS_CPU; //"/sys/devices/system/cpu"
+
+private:
+
+	Array<Cpu> m_cpus; //by node, package, core, sibling
+	unsigned m_cores;
+	unsigned m_packages;
+	unsigned m_nodes;
+
+public:
+
+	Topology();
+
+	//the machine this runs on, or a sysfs cpu tree under root for the given cpus
+	static Topology detect();
+	static Topology detect(const std::string &root, const Array<unsigned> &cpus);
+	static Array<unsigned> allowedCpus(); //sched_getaffinity
+
+	size_t cpus() const;
+	unsigned cores() const;
+	unsigned packages() const;
+	unsigned nodes() const;
+	const Cpu &cpu(size_t i) const;
+	int nodeOf(unsigned cpu) const; //-1 if cpu isn't one of ours
+
+	//cpu for each of threads threads, empty for PIN_NONE
+	Array<unsigned> placement(unsigned threads, int policy) const;
+
+	std::string toString() const;
+
+	static int parsePolicy(const char *name); //-1 if it isn't none, cores, smt or nodes
+	static const char *policyName(int policy);
+
+	//pins the calling thread to cpu
+	static bool pin(unsigned cpu);
+	//asks the kernel to keep each whole page of count slots of slotBytes on the node slotNodes gives the
+	//page's first slot (-1 leaves a page alone), moving pages that are already elsewhere; for per-thread
+	//state whose threads are placed in runs on the same node, which every policy but PIN_NONE does
+	static bool placeSlots(const void *base, size_t slotBytes, size_t count, const Array<int> &slotNodes);
+
+};
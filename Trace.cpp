@@ -0,0 +1,197 @@
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define BC_TRACE_TSC 1
+#else
+#define BC_TRACE_TSC 0
+#endif
+
+namespace trace {
+
+std::atomic<bool> enabled(false);
+
+namespace {
+
+//written only by its thread; head counts every span ever recorded, slot head % RING_EVENTS is the next one
+struct Ring {
+	Event events[RING_EVENTS];
+	std::atomic<size_t> head;
+	unsigned tid;
+	std::string name; //under registryMtx
+};
+
+std::mutex registryMtx;
+std::vector<std::unique_ptr<Ring>> rings; //a ring outlives its thread so its spans still get exported
+thread_local Ring *mine = NULL;
+thread_local std::string threadName;
+
+int64_t steadyNanos() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//cpuid leaf 0x80000007 edx bit 8, a tsc that ticks at one rate through frequency changes and sleep states
+bool invariantTsc() {
+#if BC_TRACE_TSC
+	unsigned a, b, c, d;
+	return __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1 << 8));
+#else
+	return false;
+#endif
+}
+
+const bool useTsc = invariantTsc();
+
+//a tick and steady_clock reading taken together when tracing is first enabled, paired with another on export
+std::atomic<int64_t> calibrationTicks(0);
+std::atomic<int64_t> calibrationNanos(0);
+
+//rings are only made for threads that record something, naming a thread costs nothing until then
+Ring *ring() {
+	if (mine == NULL) {
+		std::lock_guard<std::mutex> guard(registryMtx);
+		rings.emplace_back(new Ring());
+		mine = rings.back().get();
+		mine->head = 0;
+		mine->tid = (unsigned)rings.size();
+		mine->name = threadName.empty() ? "thread " + std::to_string(mine->tid) : threadName;
+	}
+	return mine;
+}
+
+void escaped(FILE *f, const char *s) {
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', f);
+		if ((unsigned char)*s >= 0x20)
+			fputc(*s, f);
+	}
+}
+
+}
+
+bool compiledIn() {
+	return BC_TRACE != 0;
+}
+
+void enable(bool on) {
+	if (on && calibrationTicks.load() == 0) {
+		calibrationNanos.store(steadyNanos());
+		calibrationTicks.store(now());
+	}
+	enabled.store(on, std::memory_order_relaxed);
+}
+
+int64_t now() {
+#if BC_TRACE_TSC
+	if (useTsc)
+		return (int64_t)__rdtsc();
+#endif
+	return steadyNanos();
+}
+
+void nameThread(const std::string &name) {
+	threadName = name;
+	if (mine) {
+		std::lock_guard<std::mutex> guard(registryMtx);
+		mine->name = name;
+	}
+}
+
+void record(const char *name, int64_t begin, int64_t end, uint64_t arg) {
+	Ring *r = ring();
+	size_t h = r->head.load(std::memory_order_relaxed);
+	Event &e = r->events[h % RING_EVENTS];
+	e.name = name;
+	e.begin = begin;
+	e.end = end;
+	e.arg = arg;
+	r->head.store(h + 1, std::memory_order_release);
+}
+
+size_t recorded() {
+	std::lock_guard<std::mutex> guard(registryMtx);
+	size_t n = 0;
+	for (auto &r : rings)
+		n += r->head.load(std::memory_order_acquire);
+	return n;
+}
+
+size_t dropped() {
+	std::lock_guard<std::mutex> guard(registryMtx);
+	size_t n = 0;
+	for (auto &r : rings) {
+		size_t h = r->head.load(std::memory_order_acquire);
+		n += h > RING_EVENTS ? h - RING_EVENTS : 0;
+	}
+	return n;
+}
+
+//each ring is copied out, then anything its thread could have overwritten during the copy is skipped
+bool writeChrome(const std::string &path) {
+	std::lock_guard<std::mutex> guard(registryMtx);
+	double nanosPerTick = 1;
+	if (useTsc && calibrationTicks.load() != 0) {
+		//a short trace still needs a couple of ms between the two readings for a usable rate
+		while (steadyNanos() - calibrationNanos.load() < 2000000)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		int64_t ticks = now() - calibrationTicks.load();
+		nanosPerTick = ticks > 0 ? (steadyNanos() - calibrationNanos.load()) / (double)ticks : 1;
+	}
+	std::vector<std::vector<Event>> copies(rings.size());
+	int64_t origin = INT64_MAX;
+	for (size_t t = 0; t < rings.size(); t++) {
+		Ring &r = *rings[t];
+		size_t end = r.head.load(std::memory_order_acquire);
+		size_t begin = end > RING_EVENTS ? end - RING_EVENTS : 0;
+		std::vector<Event> &out = copies[t];
+		out.reserve(end - begin);
+		for (size_t i = begin; i < end; i++)
+			out.push_back(r.events[i % RING_EVENTS]);
+		size_t after = r.head.load(std::memory_order_acquire);
+		if (after + 1 > begin + RING_EVENTS)
+			out.erase(out.begin(), out.begin() + std::min(out.size(), after + 1 - RING_EVENTS - begin));
+		for (const Event &e : out)
+			origin = e.begin < origin ? e.begin : origin;
+	}
+
+	std::string tmp = path + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "w");
+	if (f == NULL)
+		return false;
+	fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	bool first = true;
+	for (size_t t = 0; t < rings.size(); t++) {
+		fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"", first ? "" : ",\n", rings[t]->tid);
+		escaped(f, rings[t]->name.c_str());
+		fprintf(f, "\"}}");
+		first = false;
+		for (const Event &e : copies[t]) {
+			fprintf(f, ",\n{\"name\": \"");
+			escaped(f, e.name);
+			fprintf(f, "\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"arg\": %llu}}",
+				rings[t]->tid, (e.begin - origin) * nanosPerTick / 1e3, (e.end - e.begin) * nanosPerTick / 1e3, (unsigned long long)e.arg);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	bool ok = !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	return ok && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+//only safe while no thread is recording
+void clear() {
+	std::lock_guard<std::mutex> guard(registryMtx);
+	for (auto &r : rings)
+		r->head.store(0, std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+//scoped spans for looking at the miner as a timeline, exported in chrome's trace event format
+//(chrome://tracing or ui.perfetto.dev)
+//every thread appends to its own ring, so recording a span is two clock reads and a store with no locks;
+//a ring keeps its thread's newest RING_EVENTS spans and overwrites the oldest
+//the clock is the invariant TSC where the cpu has one, steady_clock otherwise, converted to time on export
+//spans are compiled in unless NDEBUG is defined, -DBC_TRACE=0 or 1 overrides that either way,
+//and even compiled in they record nothing until enable(true)
+#ifndef BC_TRACE
+#ifdef NDEBUG
+#define BC_TRACE 0
+#else
+#define BC_TRACE 1
+#endif
+#endif
+
+#define BC_TRACE_CONCAT2(a, b) a##b
+#define BC_TRACE_CONCAT(a, b) BC_TRACE_CONCAT2(a, b)
+#if BC_TRACE
+//name must be a string literal or otherwise outlive the export, arg shows up in the event's args
+#define BC_TRACE_SPAN(name) trace::Span BC_TRACE_CONCAT(bcTraceSpan, __LINE__)(name)
+#define BC_TRACE_SPAN_ARG(name, arg) trace::Span BC_TRACE_CONCAT(bcTraceSpan, __LINE__)(name, (uint64_t)(arg))
+#else
+#define BC_TRACE_SPAN(name) ((void)0)
+#define BC_TRACE_SPAN_ARG(name, arg) ((void)0)
+#endif
+
+namespace trace {
+
+static const size_t RING_EVENTS = 1 << 14; //per thread, 512 KB
+
+struct Event {
+	const char *name;
+	int64_t begin; //now() ticks
+	int64_t end;
+	uint64_t arg;
+};
+
+extern std::atomic<bool> enabled;
+
+bool compiledIn(); //whether this build has spans at all
+void enable(bool on);
+int64_t now();     //ticks, only meaningful relative to each other
+
+//labels the calling thread in the export
+void nameThread(const std::string &name);
+//appends a finished span to the calling thread's ring
+void record(const char *name, int64_t begin, int64_t end, uint64_t arg);
+
+//spans recorded so far by every thread that is or was tracing, and how many were overwritten before export
+size_t recorded();
+size_t dropped();
+
+//writes every ring as complete ("X") events, through a temporary file; threads can keep tracing meanwhile
+bool writeChrome(const std::string &path);
+void clear();
+
+class Span {
+
+	const char *m_name;
+	uint64_t m_arg;
+	int64_t m_begin;
+
+public:
+
+	explicit Span(const char *name, uint64_t arg = 0) : m_name(name), m_arg(arg) {
+		m_begin = enabled.load(std::memory_order_relaxed) ? now() : 0;
+	}
+	~Span() {
+		if (m_begin)
+			record(m_name, m_begin, now(), m_arg);
+	}
+
+	Span(const Span&) = delete;
+	Span& operator=(const Span&) = delete;
+
+};
+
+}
@@ -0,0 +1,766 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "timer.hpp"
+#include "Arena.hpp"
+#include "Array.hpp"
+#define COMPARE_BLOCK_STRUCT
+#include "Block.hpp"
+#include "BlockIndex.hpp"
+#include "HashPolicy.hpp"
+#include "ChainColumns.hpp"
+#include "ChainVerifier.hpp"
+#include "Metrics.hpp"
+#include "Miner.hpp"
+#include "MinerPool.hpp"
+#include "NonceHasher.hpp"
+#include "NonceScheduler.hpp"
+#include "Sha256.hpp"
+#include "ThreadMine.hpp"
+#include "Trace.hpp"
+
+//benchmark suite for the mining hot paths
+//usage: bench [options]
+//  --suite all|hash|mine|scale|miner|chain|trace|policy   what to run (default all)
+//  --min-diff N --max-diff N     difficulty range for mine and scale (default 0 .. 8, at most 16)
+//  --blocks N                    blocks per chain (default 20)
+//  --threads N                   highest thread count for scale, and miner's thread count (default hardware_concurrency)
+//  --reps N --warmup N           measured and discarded repetitions (default 5 and 1)
+//  --policy fixed|guided|adaptive --chunk N   scheduler chunk policy for scale
+//  --chain-blocks N              chain length for the chain suite (default 1048576)
+//  --csv FILE --json FILE        also write every result there
+//exits 0, 1 if a check came back DIFFER or WRONG or a results file couldn't be written, 2 for bad usage
+//every repetition mines the same chains, scale checks each chain against mineBlock and reports speedup and
+//efficiency against one thread at the same difficulty
+//miner mines the same chains through Miner, waiting on each block's future or submitting the next block from the
+//completion callback, and one chain per lane on a 4-lane Miner, then times how long a job that can't be solved
+//takes to come back after its token is cancelled, after its deadline and after cancelAll, and the same for a
+//cancel or deadline on a job queued behind a busy lane
+//chain runs the same scans over a vector of Blocks and over ChainColumns, with cache misses per block where
+//perf events are allowed (perf_event_paranoid, containers often block them), then builds a BlockIndex over it
+//and times lookups by solved hash and by id
+//policy mines the same chain with every hash policy, with the threshold read at run time and as a compile time
+//leading zero test, on one worker of a pool
+//hash also times Sha256d's midstate path per nonce on each SHA-256 kernel the cpu has
+//trace times one empty span with tracing off and on, in this build whether or not BC_TRACE compiled them in
+
+namespace {
+
+struct Options {
+	std::string suite = "all";
+	unsigned minDiff = 0;
+	unsigned maxDiff = 8;
+	unsigned blocks = 20;
+	unsigned maxThreads = std::thread::hardware_concurrency();
+	unsigned reps = 5;
+	unsigned warmup = 1;
+	ChunkPolicy policy;
+	size_t chainBlocks = 1 << 20;
+	std::string csvPath;
+	std::string jsonPath;
+};
+
+struct Stats {
+	double mean = 0;
+	double stddev = 0;
+	double min = 0;
+	double max = 0;
+
+	static Stats of(const std::vector<double> &samples) {
+		Stats s;
+		if (samples.empty())
+			return s;
+		s.min = s.max = samples[0];
+		for (double v : samples) {
+			s.mean += v;
+			s.min = v < s.min ? v : s.min;
+			s.max = v > s.max ? v : s.max;
+		}
+		s.mean /= samples.size();
+		for (double v : samples)
+			s.stddev += (v - s.mean) * (v - s.mean);
+		s.stddev = samples.size() > 1 ? std::sqrt(s.stddev / (samples.size() - 1)) : 0;
+		return s;
+	}
+};
+
+struct Result {
+	std::string bench;
+	std::string variant; //kernel or chunk policy
+	int difficulty;      //-1 where it doesn't apply
+	unsigned threads;
+	std::string unit;
+	Stats stats;
+	unsigned reps;
+	double speedup;      //scale only, mean hashrate over the one thread mean
+	double efficiency;
+	std::string check;   //scale and miner, whether the chain matched mineBlock or the job ended as it should
+};
+
+std::vector<Result> results;
+bool failed = false; //a check came back DIFFER or WRONG, main exits 1
+
+//runs body warmup + reps times and keeps the measured samples
+template<class F>
+Stats measure(const Options &opt, F body) {
+	std::vector<double> samples;
+	for (unsigned r = 0; r < opt.warmup + opt.reps; r++) {
+		double v = body();
+		if (r >= opt.warmup)
+			samples.push_back(v);
+	}
+	return Stats::of(samples);
+}
+
+void report(const Result &r) {
+	results.push_back(r);
+	if (r.check == "DIFFER" || r.check == "WRONG")
+		failed = true;
+	printf("%-10s %-15s %4s %7u  %12.3f %-9s +- %10.3f  (min %.3f, max %.3f, cv %5.1f%%)", r.bench.c_str(), r.variant.c_str(),
+		r.difficulty < 0 ? "-" : std::to_string(r.difficulty).c_str(), r.threads, r.stats.mean, r.unit.c_str(), r.stats.stddev, r.stats.min, r.stats.max,
+		r.stats.mean != 0 ? 100 * r.stats.stddev / r.stats.mean : 0.0);
+	if (r.speedup > 0)
+		printf("  speedup %5.2f  efficiency %5.1f%%  %s", r.speedup, 100 * r.efficiency, r.check.c_str());
+	else if (!r.check.empty())
+		printf("  %s", r.check.c_str());
+	printf("\n");
+}
+
+const char *policyName(int mode) {
+	return mode == ChunkPolicy::FIXED ? "fixed" : mode == ChunkPolicy::GUIDED ? "guided" : "adaptive";
+}
+
+void benchHash(const Options &opt) {
+	const size_t N = 1 << 22;
+	const size_t prev = 0x1234567890abcdefULL;
+	auto nsPerHash = [N](Timer &t) { return t.end_us() * 1000.0 / N; };
+
+	Block block(1, prev, 16); //nothing solves difficulty 16 in practice, so every nonce gets hashed
+	report({"tryNonce", "block", -1, 1, "ns/hash", measure(opt, [&] {
+		Timer t;
+		size_t solved = 0;
+		for (size_t i = 0; i < N; i++)
+			solved += static_cast<const Block &>(block).tryNonce(i);
+		double v = nsPerHash(t);
+		return v + (solved > N ? 1 : 0); //keep the loop alive
+	}), opt.reps, 0, 0, ""});
+
+	report({"digest", "cursor", -1, 1, "ns/hash", measure(opt, [&] {
+		NonceHasher h(prev);
+		Timer t;
+		size_t acc = 0;
+		for (size_t i = 0; i < N; i++, h.advance())
+			acc += h.digest() == 0;
+		return nsPerHash(t) + (acc > N ? 1 : 0);
+	}), opt.reps, 0, 0, ""});
+
+	NonceHasher::BatchKernel active = NonceHasher::batchKernel();
+	for (int k = NonceHasher::KERNEL_SCALAR; k <= NonceHasher::KERNEL_AVX512; k++) {
+		NonceHasher::BatchKernel kernel = (NonceHasher::BatchKernel)k;
+		if (!NonceHasher::useBatchKernel(kernel))
+			continue;
+		report({"scan", NonceHasher::kernelName(kernel), -1, 1, "ns/hash", measure(opt, [&] {
+			NonceHasher h(prev);
+			size_t hash;
+			Timer t;
+			size_t hits = 0;
+			for (size_t i = 0; i < N; i += NonceHasher::MAX_BATCH)
+				hits += h.scan(NonceHasher::MAX_BATCH, 0, hash) != NonceHasher::MAX_BATCH;
+			return nsPerHash(t) + (hits > N ? 1 : 0);
+		}), opt.reps, 0, 0, ""});
+	}
+	NonceHasher::useBatchKernel(active);
+
+	Sha256::Kernel activeSha = Sha256::kernel();
+	for (int k = Sha256::KERNEL_PORTABLE; k <= Sha256::KERNEL_SHANI; k++) {
+		Sha256::Kernel kernel = (Sha256::Kernel)k;
+		if (!Sha256::useKernel(kernel))
+			continue;
+		report({"sha256d", Sha256::kernelName(kernel), -1, 1, "ns/hash", measure(opt, [&] {
+			Sha256d header(1, prev);
+			Timer t;
+			size_t acc = 0;
+			for (size_t i = 0; i < N / 16; i++)
+				acc += header.hash(i) == 0;
+			return t.end_us() * 1000.0 * 16 / N + (acc > N ? 1 : 0);
+		}), opt.reps, 0, 0, ""});
+	}
+	Sha256::useKernel(activeSha);
+}
+
+void benchMine(const Options &opt) {
+	for (unsigned diff = opt.minDiff; diff <= opt.maxDiff; diff++) {
+		std::vector<double> rates;
+		Stats ms = measure(opt, [&] {
+			Block b(0, 0, 0, 0, 0, 0);
+			size_t nonces = 0;
+			Timer t;
+			for (unsigned i = 0; i < opt.blocks; i++) {
+				b = Block(i, b.getSolvedHash(), diff);
+				mineBlock(b);
+				nonces += b.getNonce() + 1; //mineBlock walks up from 0
+			}
+			double us = (double)t.end_us();
+			rates.push_back(nonces / us);
+			return us / 1000.0 / opt.blocks;
+		});
+		const char *kernel = NonceHasher::kernelName(NonceHasher::batchKernel());
+		report({"mineBlock", kernel, (int)diff, 1, "ms/block", ms, opt.reps, 0, 0, ""});
+		report({"mineBlock", kernel, (int)diff, 1, "Mhash/s", Stats::of(std::vector<double>(rates.begin() + opt.warmup, rates.end())), opt.reps, 0, 0, ""});
+	}
+}
+
+//the tip of a chain of blocks mined one after another with mineBlock, which lowest nonce mode has to reproduce exactly
+size_t serialTip(unsigned diff, unsigned blocks, size_t startHash = 0) {
+	Block b(0, 0, startHash, 0, 0, 0);
+	for (unsigned i = 0; i < blocks; i++) {
+		b = Block(i, b.getSolvedHash(), diff);
+		mineBlock(b);
+	}
+	return b.getSolvedHash();
+}
+
+void benchScale(const Options &opt) {
+	for (unsigned diff = opt.minDiff; diff <= opt.maxDiff; diff++) {
+		size_t serialTip = ::serialTip(diff, opt.blocks);
+		double base = 0;
+		for (unsigned threads = 1; threads <= opt.maxThreads; threads++) {
+			MinerPool pool(threads);
+			NonceScheduler scheduler(threads, opt.policy);
+			bool matched = true;
+			std::vector<double> rates;
+			Stats ms = measure(opt, [&] {
+				MinerMetrics metrics(threads);
+				Block b(0, 0, 0, 0, 0, 0);
+				Timer t;
+				for (unsigned i = 0; i < opt.blocks; i++) {
+					b = Block(i, b.getSolvedHash(), diff);
+					threadMine(b, pool, scheduler, MINE_LOWEST_NONCE, &metrics);
+				}
+				double us = (double)t.end_us();
+				matched = matched && b.getSolvedHash() == serialTip;
+				rates.push_back(metrics.total().noncesTried / us);
+				return us / 1000.0 / opt.blocks;
+			});
+			Stats rate = Stats::of(std::vector<double>(rates.begin() + opt.warmup, rates.end()));
+			if (threads == 1)
+				base = rate.mean;
+			double speedup = base > 0 ? rate.mean / base : 0;
+			report({"threadMine", policyName(opt.policy.mode), (int)diff, threads, "ms/block", ms, opt.reps, 0, 0, ""});
+			report({"threadMine", policyName(opt.policy.mode), (int)diff, threads, "Mhash/s", rate, opt.reps, speedup, speedup / threads, matched ? "match" : "DIFFER"});
+		}
+	}
+}
+
+const unsigned LANES = 4; //for benchMiner's side by side chains
+
+void benchMiner(const Options &opt) {
+	Miner miner(opt.maxThreads);
+	for (unsigned diff = opt.minDiff; diff <= opt.maxDiff; diff++) {
+		size_t serialTip = ::serialTip(diff, opt.blocks);
+		for (bool callback : {false, true}) {
+			bool matched = true;
+			Stats ms = measure(opt, [&] {
+				Block tip(0, 0, 0, 0, 0, 0);
+				Timer t;
+				if (callback) {
+					//the callback runs on the lane's thread and queues the block built on the one it was handed
+					std::promise<Block> last;
+					std::function<void(const MineResult &)> next = [&](const MineResult &r) {
+						unsigned i = r.block.getId() + 1;
+						if (i == opt.blocks || r.status != MINE_SOLVED)
+							last.set_value(r.block);
+						else
+							miner.submit(Block(i, r.block.getSolvedHash(), diff), next);
+					};
+					miner.submit(Block(0, 0, diff), next);
+					tip = last.get_future().get();
+				} else {
+					for (unsigned i = 0; i < opt.blocks; i++)
+						tip = miner.submit(Block(i, tip.getSolvedHash(), diff)).get().block;
+				}
+				double us = (double)t.end_us();
+				matched = matched && tip.getSolvedHash() == serialTip;
+				return us / 1000.0 / opt.blocks;
+			});
+			report({"Miner", callback ? "callback" : "future", (int)diff, miner.threads(), "ms/block", ms, opt.reps, 0, 0, matched ? "match" : "DIFFER"});
+		}
+	}
+
+	//one chain per lane mined side by side, each block of every chain submitted before any is waited on
+	Miner laned(opt.maxThreads > LANES ? opt.maxThreads : LANES, LANES);
+	for (unsigned diff = opt.minDiff; diff <= opt.maxDiff; diff++) {
+		size_t serialTips[LANES];
+		for (unsigned c = 0; c < LANES; c++)
+			serialTips[c] = ::serialTip(diff, opt.blocks, c);
+		bool matched = true;
+		Stats ms = measure(opt, [&] {
+			Block tips[LANES];
+			for (unsigned c = 0; c < LANES; c++)
+				tips[c] = Block(0, 0, c, 0, 0, 0);
+			Timer t;
+			for (unsigned i = 0; i < opt.blocks; i++) {
+				std::future<MineResult> jobs[LANES];
+				for (unsigned c = 0; c < LANES; c++)
+					jobs[c] = laned.submit(Block(i, tips[c].getSolvedHash(), diff));
+				for (unsigned c = 0; c < LANES; c++)
+					tips[c] = jobs[c].get().block;
+			}
+			double us = (double)t.end_us();
+			for (unsigned c = 0; c < LANES; c++)
+				matched = matched && tips[c].getSolvedHash() == serialTips[c];
+			return us / 1000.0 / opt.blocks / LANES;
+		});
+		report({"Miner", std::to_string(LANES) + "-lanes", (int)diff, laned.threads(), "ms/block", ms, opt.reps, 0, 0, matched ? "match" : "DIFFER"});
+	}
+
+	//difficulty 16 needs a hash of 0, so these jobs only ever end by being stopped
+	Block hopeless(0, 0, 16);
+	auto started = [&] {
+		while (miner.running() == 0)
+			std::this_thread::yield();
+	};
+	bool ok = true;
+	Stats cancel = measure(opt, [&] {
+		MineOptions o;
+		std::future<MineResult> f = miner.submit(hopeless, o);
+		started();
+		int64_t asked = MinerPool::now();
+		o.token.cancel();
+		ok = f.get().status == MINE_CANCELLED && ok;
+		return (MinerPool::now() - asked) / 1e3;
+	});
+	report({"Miner", "cancel", -1, miner.threads(), "us", cancel, opt.reps, 0, 0, ok ? "ok" : "WRONG"});
+	ok = true;
+	Stats late = measure(opt, [&] {
+		MineOptions o;
+		o.deadline = Miner::in(1000000);
+		ok = miner.submit(hopeless, o).get().status == MINE_DEADLINE && ok;
+		return (MinerPool::now() - o.deadline) / 1e3;
+	});
+	report({"Miner", "deadline", -1, miner.threads(), "us late", late, opt.reps, 0, 0, ok ? "ok" : "WRONG"});
+	//one job running and three queued behind it on the only lane
+	ok = true;
+	Stats all = measure(opt, [&] {
+		std::vector<std::future<MineResult>> jobs;
+		for (int i = 0; i < 4; i++)
+			jobs.push_back(miner.submit(hopeless));
+		started();
+		int64_t asked = MinerPool::now();
+		miner.cancelAll();
+		for (std::future<MineResult> &f : jobs)
+			ok = f.get().status == MINE_CANCELLED && ok;
+		return (MinerPool::now() - asked) / 1e3;
+	});
+	report({"Miner", "cancelAll", -1, miner.threads(), "us", all, opt.reps, 0, 0, ok ? "ok" : "WRONG"});
+	//the only lane stays busy, so these have to be finished while still queued
+	ok = true;
+	Stats queuedCancel = measure(opt, [&] {
+		MineOptions busy, o;
+		std::future<MineResult> running = miner.submit(hopeless, busy);
+		std::future<MineResult> f = miner.submit(hopeless, o);
+		started();
+		int64_t asked = MinerPool::now();
+		o.token.cancel();
+		ok = f.get().status == MINE_CANCELLED && ok;
+		int64_t back = MinerPool::now();
+		ok = running.wait_for(std::chrono::seconds(0)) == std::future_status::timeout && ok;
+		busy.token.cancel();
+		running.get();
+		return (back - asked) / 1e3;
+	});
+	report({"Miner", "queued-cancel", -1, miner.threads(), "us", queuedCancel, opt.reps, 0, 0, ok ? "ok" : "WRONG"});
+	ok = true;
+	Stats queuedLate = measure(opt, [&] {
+		MineOptions busy, o;
+		std::future<MineResult> running = miner.submit(hopeless, busy);
+		o.deadline = Miner::in(1000000);
+		std::future<MineResult> f = miner.submit(hopeless, o);
+		ok = f.get().status == MINE_DEADLINE && ok;
+		int64_t back = MinerPool::now();
+		ok = running.wait_for(std::chrono::seconds(0)) == std::future_status::timeout && ok;
+		busy.token.cancel();
+		running.get();
+		return (back - o.deadline) / 1e3;
+	});
+	report({"Miner", "queued-deadline", -1, miner.threads(), "us late", queuedLate, opt.reps, 0, 0, ok ? "ok" : "WRONG"});
+}
+
+//hardware cache misses of the calling thread
+class CacheMisses {
+
+	int m_fd;
+
+public:
+
+	CacheMisses() {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		m_fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	~CacheMisses() {
+		if (m_fd >= 0)
+			close(m_fd);
+	}
+
+	bool available() const { return m_fd >= 0; }
+
+	void start() {
+		if (m_fd < 0)
+			return;
+		ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	long long stop() {
+		long long count = -1;
+		if (m_fd < 0)
+			return count;
+		ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(m_fd, &count, sizeof(count)) != sizeof(count))
+			count = -1;
+		return count;
+	}
+
+};
+
+//BlockIndex over the chain's records: build time on one thread and on --threads, then lookups by solved hash and
+//by id in a scattered order, for blocks that are there and keys that aren't, each hit checked against the chain
+void benchIndex(const Options &opt, const std::vector<Block> &blocks) {
+	size_t n = blocks.size();
+	std::vector<BlockRecord> records;
+	records.reserve(n);
+	for (const Block &x : blocks)
+		records.push_back(x.toRecord());
+	auto recordAt = [&](size_t pos) -> const BlockRecord & { return records[pos]; };
+
+	BlockIndex index;
+	for (unsigned threads : {1u, opt.maxThreads}) {
+		report({"index", "build", -1, threads, "ns/block", measure(opt, [&] {
+			Timer t;
+			index.build(records.data(), n, threads);
+			return t.end_us() * 1000.0 / n;
+		}), opt.reps, 0, 0, ""});
+		if (opt.maxThreads == 1)
+			break;
+	}
+
+	const size_t LOOKUPS = 1 << 20;
+	std::vector<size_t> at(LOOKUPS);
+	for (size_t i = 0; i < LOOKUPS; i++)
+		at[i] = (i * 2654435761u) % n;
+	//a hit only has to find a block with that key, the chain can repeat a hash
+	auto lookups = [&](const char *variant, bool hit, bool byId) {
+		bool ok = true;
+		Stats ns = measure(opt, [&] {
+			size_t wrong = 0;
+			Timer t;
+			for (size_t i = 0; i < LOOKUPS; i++) {
+				const BlockRecord &r = records[at[i]];
+				if (byId) {
+					unsigned id = hit ? r.id : (unsigned)(n + at[i]);
+					size_t pos = index.findId(id, recordAt);
+					wrong += hit ? pos == BlockIndex::NPOS || records[pos].id != id : pos != BlockIndex::NPOS;
+				} else {
+					uint64_t hash = hit ? r.solvedHash : ~r.solvedHash;
+					size_t pos = index.findSolvedHash(hash, recordAt);
+					wrong += hit ? pos == BlockIndex::NPOS || records[pos].solvedHash != hash : 0;
+				}
+			}
+			double v = t.end_us() * 1000.0 / LOOKUPS;
+			ok = ok && wrong == 0;
+			return v;
+		});
+		report({"index", variant, -1, 1, "ns/lookup", ns, opt.reps, 0, 0, ok ? "ok" : "WRONG"});
+	};
+	lookups("hash-hit", true, false);
+	lookups("hash-miss", false, false);
+	lookups("id-hit", true, true);
+	lookups("id-miss", false, true);
+}
+
+void benchChain(const Options &opt) {
+	//difficulty 0 takes one hash a block, so building a long chain is quick
+	size_t n = opt.chainBlocks;
+	std::vector<Block> blocks;
+	blocks.reserve(n);
+	ChainColumns columns;
+	columns.reserve(n);
+	Block b(0, 0, 0, 0, 0, 0);
+	for (size_t i = 0; i < n; i++) {
+		b = Block((unsigned)i, b.getSolvedHash(), 0);
+		mineBlock(b);
+		blocks.push_back(b);
+		columns.append(b);
+	}
+	MinerPool pool(1);
+	CacheMisses misses;
+	if (!misses.available())
+		printf("(cache misses unavailable: perf_event_open refused)\n");
+
+	//each scan returns something derived from what it read so it can't be optimised away
+	auto run = [&](const char *bench, const char *variant, std::function<size_t()> scan) {
+		std::vector<double> missRates;
+		Stats ns = measure(opt, [&] {
+			Timer t;
+			misses.start();
+			size_t sink = scan();
+			long long m = misses.stop();
+			double v = t.end_us() * 1000.0 / n;
+			missRates.push_back(m < 0 ? -1.0 : (double)m / n);
+			return v + (sink == SIZE_MAX ? 1 : 0);
+		});
+		report({bench, variant, -1, 1, "ns/block", ns, opt.reps, 0, 0, ""});
+		if (misses.available())
+			report({bench, variant, -1, 1, "miss/blk", Stats::of(std::vector<double>(missRates.begin() + opt.warmup, missRates.end())), opt.reps, 0, 0, ""});
+	};
+
+	unsigned missing = (unsigned)n + 7; //not in the chain, so both have to look at every id
+	run("findId", "aos", [&] {
+		for (size_t i = 0; i < n; i++)
+			if (blocks[i].getId() == missing)
+				return i;
+		return (size_t)0;
+	});
+	run("findId", "soa", [&] { return columns.findId(missing) == ChainColumns::NPOS ? (size_t)0 : (size_t)1; });
+
+	run("stats", "aos", [&] {
+		double hashes = 0, nanos = 0;
+		for (size_t i = 0; i < n; i++) {
+			hashes += (double)blocks[i].getNonce() + 1;
+			nanos += (double)blocks[i].getSolveNanos();
+		}
+		return (size_t)(hashes + nanos);
+	});
+	run("stats", "soa", [&] {
+		ChainStats s = columns.stats();
+		return (size_t)(s.hashes + s.meanSolveNanos);
+	});
+
+	run("verify", "aos", [&] {
+		for (size_t i = 1; i < n; i++) {
+			const Block &x = blocks[i];
+			if (x.getPreviousHash() != blocks[i - 1].getSolvedHash() || NonceHasher::hash(x.getPreviousHash(), x.getNonce()) != x.getSolvedHash()
+				|| x.getSolvedHash() > x.getThreshold())
+				return i;
+		}
+		return (size_t)0;
+	});
+	run("verify", "soa", [&] { return verifyChain(columns, pool).firstInvalid; });
+
+	//a scrambled copy of the chain (a permutation when the length is a power of two) sorted back into id order
+	Array<Block> shuffled;
+	shuffled.reserve(n);
+	for (size_t i = 0; i < n; i++)
+		shuffled.push_back(blocks[(i * 2654435761u) % n]);
+	//each repetition's working copy lives in an arena that is dropped as a whole afterwards, like a batch of chains
+	Arena arena(n * sizeof(Block) + alignof(Block));
+	for (unsigned threads = 1; threads <= opt.maxThreads; threads *= 2) {
+		report({"sort", "by-id", -1, threads, "ns/block", measure(opt, [&] {
+			arena.release();
+			Array<Block, ArenaAllocator<Block>> work{ArenaAllocator<Block>(arena)};
+			work.reserve(n);
+			for (const Block &x : shuffled)
+				work.push_back(x);
+			Timer t;
+			work.sort(CompareBlock{CompareBlock::COMPARE_ID}, threads);
+			return t.end_us() * 1000.0 / n + (work[0].getId() == 1 ? 1 : 0);
+		}), opt.reps, 0, 0, ""});
+	}
+
+	benchIndex(opt, blocks);
+}
+
+void benchTrace(const Options &opt) {
+	const size_t N = 1 << 20;
+	for (bool on : {false, true}) {
+		trace::enable(on);
+		report({"span", on ? "on" : "off", -1, 1, "ns/span", measure(opt, [&] {
+			Timer t;
+			for (size_t i = 0; i < N; i++)
+				trace::Span span("bench", i);
+			return t.end_us() * 1000.0 / N;
+		}), opt.reps, 0, 0, ""});
+	}
+	trace::enable(false);
+	trace::clear();
+}
+
+void benchPolicy(const Options &opt) {
+	MinerPool pool(1);
+	NonceScheduler scheduler(1, opt.policy);
+	for (unsigned diff = opt.minDiff; diff <= opt.maxDiff; diff++) {
+		for (int policy = 0; policy < HASH_POLICIES; policy++) {
+			for (bool specialized : {false, true}) {
+				specializeTargets(specialized);
+				std::vector<double> rates;
+				measure(opt, [&] {
+					Block b(0, 0, 0, 0, 0, 0);
+					size_t nonces = 0;
+					Timer t;
+					for (unsigned i = 0; i < opt.blocks; i++) {
+						b = Block(i, b.getSolvedHash(), diff);
+						b.setHashPolicy(policy);
+						threadMine(b, pool, scheduler, MINE_LOWEST_NONCE);
+						nonces += b.getNonce() + 1;
+					}
+					double us = (double)t.end_us();
+					rates.push_back(nonces / us);
+					return us;
+				});
+				std::string variant = std::string(hashPolicyName(policy)) + (specialized ? "/const" : "/runtime");
+				report({"policy", variant, (int)diff, 1, "Mhash/s", Stats::of(std::vector<double>(rates.begin() + opt.warmup, rates.end())), opt.reps, 0, 0, ""});
+			}
+		}
+	}
+	specializeTargets(true);
+}
+
+bool writeCsv(const std::string &path) {
+	std::string out = "bench,variant,difficulty,threads,unit,mean,stddev,min,max,reps,speedup,efficiency,check\n";
+	char line[512];
+	for (const Result &r : results) {
+		snprintf(line, sizeof(line), "%s,%s,%d,%u,%s,%.6f,%.6f,%.6f,%.6f,%u,%.4f,%.4f,%s\n", r.bench.c_str(), r.variant.c_str(), r.difficulty, r.threads,
+			r.unit.c_str(), r.stats.mean, r.stats.stddev, r.stats.min, r.stats.max, r.reps, r.speedup, r.efficiency, r.check.c_str());
+		out += line;
+	}
+	if (MinerMetrics::writeFile(path, out))
+		return true;
+	fprintf(stderr, "cannot write %s\n", path.c_str());
+	return false;
+}
+
+bool writeJson(const std::string &path) {
+	std::string out = "[\n";
+	char line[768];
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		snprintf(line, sizeof(line), "  {\"bench\": \"%s\", \"variant\": \"%s\", \"difficulty\": %d, \"threads\": %u, \"unit\": \"%s\", \"mean\": %.6f, \"stddev\": %.6f, \"min\": %.6f, \"max\": %.6f, \"reps\": %u, \"speedup\": %.4f, \"efficiency\": %.4f, \"check\": \"%s\"}%s\n",
+			r.bench.c_str(), r.variant.c_str(), r.difficulty, r.threads, r.unit.c_str(), r.stats.mean, r.stats.stddev, r.stats.min, r.stats.max, r.reps, r.speedup, r.efficiency, r.check.c_str(),
+			i + 1 < results.size() ? "," : "");
+		out += line;
+	}
+	out += "]\n";
+	if (MinerMetrics::writeFile(path, out))
+		return true;
+	fprintf(stderr, "cannot write %s\n", path.c_str());
+	return false;
+}
+
+const char *const SUITES[] = {"all", "hash", "mine", "scale", "miner", "chain", "trace", "policy"};
+
+void printUsage(FILE *out, const char *prog) {
+	fprintf(out,
+		"usage: %s [options]\n"
+		"  --suite all|hash|mine|scale|miner|chain|trace|policy   what to run (default all)\n"
+		"  --min-diff N --max-diff N     difficulty range for mine and scale (default 0 .. 8, at most 16)\n"
+		"  --blocks N                    blocks per chain (default 20)\n"
+		"  --threads N                   highest thread count for scale, and miner's thread count (default hardware_concurrency)\n"
+		"  --reps N --warmup N           measured and discarded repetitions (default 5 and 1)\n"
+		"  --policy fixed|guided|adaptive --chunk N   scheduler chunk policy for scale\n"
+		"  --chain-blocks N              chain length for the chain suite (default 1048576)\n"
+		"  --csv FILE --json FILE        also write every result there\n"
+		"exit status: 0 ok, 1 a check failed or a results file couldn't be written, 2 bad usage\n",
+		prog);
+}
+
+bool parse(int argc, char **argv, Options &opt) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			fprintf(stderr, "missing value for %s\n", arg.c_str());
+			return false;
+		}
+		const char *val = argv[++i];
+		if (arg == "--suite") opt.suite = val;
+		else if (arg == "--min-diff") opt.minDiff = atoi(val);
+		else if (arg == "--max-diff") opt.maxDiff = atoi(val);
+		else if (arg == "--blocks") opt.blocks = atoi(val);
+		else if (arg == "--threads") opt.maxThreads = atoi(val);
+		else if (arg == "--reps") opt.reps = atoi(val);
+		else if (arg == "--warmup") opt.warmup = atoi(val);
+		else if (arg == "--chunk") opt.policy.fixedChunk = strtoull(val, NULL, 10);
+		else if (arg == "--chain-blocks") opt.chainBlocks = strtoull(val, NULL, 10);
+		else if (arg == "--csv") opt.csvPath = val;
+		else if (arg == "--json") opt.jsonPath = val;
+		else if (arg == "--policy") {
+			if (strcmp(val, "fixed") == 0)
+				opt.policy.mode = ChunkPolicy::FIXED;
+			else if (strcmp(val, "guided") == 0)
+				opt.policy.mode = ChunkPolicy::GUIDED;
+			else
+				opt.policy.mode = ChunkPolicy::ADAPTIVE;
+		} else {
+			fprintf(stderr, "unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+	bool knownSuite = false;
+	for (const char *suite : SUITES)
+		knownSuite = knownSuite || opt.suite == suite;
+	if (!knownSuite) {
+		fprintf(stderr, "unknown suite %s\n", opt.suite.c_str());
+		return false;
+	}
+	if (opt.maxDiff > 16)
+		opt.maxDiff = 16;
+	if (opt.maxThreads == 0)
+		opt.maxThreads = 1;
+	if (opt.reps == 0)
+		opt.reps = 1;
+	if (opt.blocks == 0)
+		opt.blocks = 1;
+	if (opt.chainBlocks < 2)
+		opt.chainBlocks = 2;
+	return true;
+}
+
+}
+
+int main(int argc, char **argv) {
+
+	Options opt;
+	if (!parse(argc, argv, opt)) {
+		printUsage(stderr, argv[0]);
+		return 2;
+	}
+
+	printf("kernel=%s  blocks=%u  reps=%u  warmup=%u\n", NonceHasher::kernelName(NonceHasher::batchKernel()), opt.blocks, opt.reps, opt.warmup);
+	printf("bench      variant         diff threads          mean unit            stddev\n");
+	if (opt.suite == "all" || opt.suite == "hash")
+		benchHash(opt);
+	if (opt.suite == "all" || opt.suite == "mine")
+		benchMine(opt);
+	if (opt.suite == "all" || opt.suite == "scale")
+		benchScale(opt);
+	if (opt.suite == "all" || opt.suite == "miner")
+		benchMiner(opt);
+	if (opt.suite == "all" || opt.suite == "chain")
+		benchChain(opt);
+	if (opt.suite == "all" || opt.suite == "policy")
+		benchPolicy(opt);
+	if (opt.suite == "all" || opt.suite == "trace")
+		benchTrace(opt);
+
+	bool written = opt.csvPath.empty() || writeCsv(opt.csvPath);
+	written = (opt.jsonPath.empty() || writeJson(opt.jsonPath)) && written;
+	if (failed)
+		fprintf(stderr, "some checks failed, see the DIFFER and WRONG rows\n");
+	return failed || !written ? 1 : 0;
+}
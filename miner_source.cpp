@@ -1,32 +1,140 @@
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
 #include <thread>
-#include <mutex>
 #include "ConsoleStall.h"
 #include "timer.hpp"
 #include "Array.hpp"
 #include "Block.hpp"
+#include "BatchMiner.hpp"
+#include "BlockWriter.hpp"
+#include "ChainStore.hpp"
+#include "ChainVerifier.hpp"
+#include "Coordinator.hpp"
+#include "Governor.hpp"
+#include "HashPolicy.hpp"
+#include "LeaseWorker.hpp"
+#include "Metrics.hpp"
+#include "MinerPool.hpp"
+#include "NonceCheckpoint.hpp"
+#include "NonceHasher.hpp"
+#include "NonceScheduler.hpp"
+#include "RetargetController.hpp"
+#include "ThreadMine.hpp"
+#include "Topology.hpp"
+#include "Trace.hpp"
 
 #define GET_MAX_THREADS() std::thread::hardware_concurrency()
 const unsigned BC_MIN_THREAD_COUNT = 1;
 const unsigned BC_MAX_THREAD_COUNT = 
 	GET_MAX_THREADS() == 0 ? 2 : GET_MAX_THREADS();
 
+//process exit codes for headless runs
+const int BC_EXIT_OK = 0;
+const int BC_EXIT_FAILED = 1; //a block had no solution, or a file couldn't be read
+const int BC_EXIT_USAGE = 2;
+
 using uchar = unsigned char;
 using uint = unsigned int;
 
-//for multithreading
-std::mutex mtx;
-volatile bool nonceFound;
-size_t nonceVal;
+struct MinerOptions {
+	unsigned difficulty = DEFAULT_DIFFICULTY;
+	double bits = -1;       //fractional difficulty in bits, overrides difficulty when set
+	unsigned targetMs = 0;  //retarget every block to hold this block time, 0 => fixed difficulty
+	unsigned retargetWindow = 16;
+	unsigned chainLength = 0;
+	size_t startHash = 0;
+	unsigned threads = 0; //0 => BC_MAX_THREAD_COUNT
+	int mode = MINE_LOWEST_NONCE;
+	bool quiet = false;
+	const char *jobFile = NULL;
+	const char *storeFile = NULL;
+	const char *verifyFile = NULL;
+	bool findHash = false; //look up findKey by solvedHash in the store
+	bool findId = false;   //or by id
+	size_t findKey = 0;
+	const char *checkpointFile = NULL;
+	unsigned checkpointIntervalMs = NonceCheckpoint::DEFAULT_INTERVAL_MS;
+	const char *metricsJson = NULL;
+	const char *metricsProm = NULL;
+	unsigned metricsIntervalMs = 0;
+	const char *traceFile = NULL;
+	int pin = Topology::PIN_NONE;
+	int hashPolicy = HASH_STD;
+	bool selfTest = false;
+	const char *coordinatorSocket = NULL; //mine through LeaseWorkers connecting here
+	const char *workerSocket = NULL;      //be one of them
+	size_t leaseNonces = Coordinator::DEFAULT_LEASE_NONCES;
+	unsigned leaseMs = Coordinator::DEFAULT_LEASE_MS;
+	const char *outFile = NULL; //stream every block here ("-" for stdout) through a BlockWriter
+	BlockOutputPolicy output;
+	GovernorPolicy governor; //paced when either limit is set
+};
 
-void threadMine(Block &block, uchar threadCount); 
-void mineBlockTS(Block b, uchar threadNum, uchar threadCount);
-void setNonce(size_t nonce);
+int interactiveMain();
+int headlessMain(const MinerOptions &opts);
+int batchMain(const char *jobFile, unsigned threadCount, const MinerOptions &opts);
+int verifyMain(const MinerOptions &opts);
+bool verifyStore(const ChainStore &store, MinerPool &pool, bool quiet);
+int findMain(const MinerOptions &opts);
+int workerMain(const MinerOptions &opts);
+int parseOptions(int argc, char **argv, MinerOptions &opts);
+void printUsage(FILE *out, const char *prog);
+MetricsExporter *startExporter(MinerMetrics &metrics, const MinerOptions &opts);
+bool startTrace(const MinerOptions &opts);
+Array<unsigned> placeThreads(unsigned threads, const MinerOptions &opts, Array<int> &nodes);
+bool finishTrace(const MinerOptions &opts);
+bool checkSha256(bool quiet);
+bool checkBatchKernels();
+void printBlock(unsigned id, int64_t nanos, const BlockPhases &phases, size_t hash, size_t nonce);
 
 
-int main() {
-	
-	uchar diff, thrCount;
+int main(int argc, char **argv) {
+	if (argc == 1)
+		return interactiveMain();
+
+	MinerOptions opts;
+	//miner <job file> [thread count] mines every chain in the file together
+	if (argv[1][0] != '-') {
+		if (argc > 3) {
+			printUsage(stderr, argv[0]);
+			return BC_EXIT_USAGE;
+		}
+		return batchMain(argv[1], argc > 2 ? atoi(argv[2]) : BC_MAX_THREAD_COUNT, opts);
+	}
+
+	int parsed = parseOptions(argc, argv, opts);
+	if (parsed >= 0)
+		return parsed;
+	if (opts.selfTest) {
+		bool kernels = checkBatchKernels();
+		return checkSha256(false) && kernels ? BC_EXIT_OK : BC_EXIT_FAILED;
+	}
+	if (opts.hashPolicy == HASH_SHA256D && !checkSha256(opts.quiet))
+		return BC_EXIT_FAILED;
+	startTrace(opts);
+	int status;
+	if (opts.verifyFile != NULL)
+		status = verifyMain(opts);
+	else if (opts.findHash || opts.findId)
+		status = findMain(opts);
+	else if (opts.workerSocket != NULL)
+		status = workerMain(opts);
+	else if (opts.jobFile != NULL)
+		status = batchMain(opts.jobFile, opts.threads, opts);
+	else
+		status = headlessMain(opts);
+	if (!finishTrace(opts) && status == BC_EXIT_OK)
+		status = BC_EXIT_FAILED;
+	return status;
+}
+
+int interactiveMain() {
+	uchar diff;
+	uint thrCount;
 	uint chainLen;
 	size_t startHash;
 	
@@ -42,55 +150,626 @@ int main() {
 	scanf("%zu", &startHash);
 	do {
 		printf("Thread count: ");
-		scanf("%hhu", &thrCount);
+		scanf("%u", &thrCount);
 	} while (thrCount < BC_MIN_THREAD_COUNT || thrCount > BC_MAX_THREAD_COUNT);
 	
+	MinerOptions opts;
+	MinerPool pool(thrCount);
+	NonceScheduler scheduler(thrCount);
+	MinerMetrics metrics(thrCount);
+	MetricsExporter *exporter = startExporter(metrics, opts);
 	Block b(0, 0, startHash, 0, 0, 0);
-	Timer processTimer, bt;
+	Timer processTimer;
 	processTimer.start();
 	for (uint i = 0; i < chainLen; i++) {
 		b = Block(i, b.getSolvedHash(), diff);
-		bt.start();
-		threadMine(b, thrCount);
-		bt.end();
-		printf("id=%03u  time-elapsed=%12s  hash=%016zx  nonce=%13zu\n", i, bt.toString(Timer::MILLI, Timer::MINUTE).c_str(), b.getSolvedHash(), b.getNonce());
+		int64_t started = MinerPool::now();
+		threadMine(b, pool, scheduler, MINE_LOWEST_NONCE, &metrics);
+		printBlock(i, MinerPool::now() - started, lastBlockPhases(), b.getSolvedHash(), b.getNonce());
 	}
 	processTimer.end();
 	printf("program runtime: %s\n", processTimer.toString(Timer::MILLI).c_str());
+	printf("dispatch overhead: %.3fms total, %.1fus per block\n", pool.totalDispatchOverhead() / 1e6, pool.totalDispatchOverhead() / 1000.0 / pool.runs());
+	delete exporter;
 	
 	continueConsole(1);
 	return 0;
 }
 
-void threadMine(Block &block, uchar threadCount) {
-	nonceFound = false;
-	Array<std::thread> threadArr(threadCount);
-	uchar i = 0;
-	for (auto &thr : threadArr)
-		thr = std::thread(mineBlockTS, block, i++, threadCount);
-	for (auto &thr : threadArr)
-		thr.join();
-	if (nonceFound)
-		block.tryNonce(nonceVal); //plug in found nonce
+//same chain as the interactive prompts, but from flags, with no console stall and an exit code for scripts
+int headlessMain(const MinerOptions &opts) {
+	unsigned threads = opts.threads ? opts.threads : BC_MAX_THREAD_COUNT;
+	//fully buffered so a long chain of fast blocks doesn't pay for a write per line
+	static char outBuf[1 << 16];
+	setvbuf(stdout, outBuf, _IOFBF, sizeof(outBuf));
+
+	Array<int> nodes;
+	MinerPool pool(threads, placeThreads(threads, opts, nodes));
+	NonceScheduler scheduler(threads);
+	MinerMetrics metrics(threads);
+	if (!nodes.empty()) {
+		scheduler.placeLanes(nodes);
+		metrics.placeCounters(nodes);
+	}
+	Block b(0, 0, opts.startHash, 0, 0, 0);
+	uint firstId = 0;
+
+	//an existing store picks up where its chain left off, --start is only used for a new one
+	ChainStore store;
+	if (opts.storeFile != NULL) {
+		std::string error;
+		if (!store.open(opts.storeFile, error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return BC_EXIT_FAILED;
+		}
+		if (store.recovered()) {
+			//after a crash, make sure nothing but the tail was hurt before building on it
+			fprintf(stderr, "%s: dropped %zu incomplete block(s) from the end\n", opts.storeFile, store.recovered());
+			if (!verifyStore(store, pool, opts.quiet))
+				return BC_EXIT_FAILED;
+		}
+		if (!store.empty()) {
+			b = store.tip();
+			firstId = b.getId() + 1;
+		}
+	}
+
+	//a resumed chain carries on at its tip's difficulty when retargeting
+	double bits = opts.bits >= 0 ? opts.bits : opts.difficulty * 4.0;
+	if (opts.targetMs && firstId > 0)
+		bits = thresholdBits(b.getThreshold());
+	RetargetPolicy policy;
+	policy.targetSeconds = opts.targetMs / 1000.0;
+	policy.window = opts.retargetWindow;
+	RetargetController retarget(bits, policy);
+	auto nextBlock = [&](uint id, size_t previousHash) {
+		Block next(id, previousHash);
+		next.setThreshold(opts.targetMs ? retarget.threshold() : bitsThreshold(bits));
+		next.setHashPolicy(opts.hashPolicy);
+		return next;
+	};
+
+	std::unique_ptr<NonceCheckpoint> checkpoint;
+	if (opts.checkpointFile != NULL) {
+		checkpoint.reset(new NonceCheckpoint(opts.checkpointFile, opts.checkpointIntervalMs));
+		size_t from = checkpoint->resumePoint(nextBlock(firstId, b.getSolvedHash()));
+		if (from)
+			fprintf(stderr, "%s: resuming block %u from nonce %zu\n", opts.checkpointFile, firstId, from);
+	}
+
+	//one run for the whole chain, reset before every block
+	MineRun run;
+	run.mode = opts.mode;
+	std::unique_ptr<Governor> governor;
+	if (opts.governor.maxHashrate > 0 || opts.governor.cpuPercent > 0) {
+		governor.reset(new Governor(opts.governor, threads, Governor::cpuQuota()));
+		run.governor = governor.get();
+		if (!opts.quiet)
+			fprintf(stderr, "governor: max-hashrate=%.0f  cpus=%.2f  cgroup-quota=%.2f\n", governor->hashrateCap(), governor->cpuBudget(), governor->quotaCpus());
+	}
+
+	std::unique_ptr<Coordinator> coordinator;
+	if (opts.coordinatorSocket != NULL) {
+		std::string error;
+		coordinator.reset(new Coordinator(opts.leaseNonces, opts.leaseMs));
+		if (!coordinator->listen(opts.coordinatorSocket, error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return BC_EXIT_FAILED;
+		}
+		if (!opts.quiet)
+			fprintf(stderr, "%s: waiting for workers, leases of %zu nonces expire after %ums\n", opts.coordinatorSocket, opts.leaseNonces, opts.leaseMs);
+	}
+
+	//with --out the blocks go to the writer thread and the summary moves off stdout if that's where they go
+	BlockWriter writer(opts.output);
+	FILE *report = stdout;
+	if (opts.outFile != NULL) {
+		std::string error;
+		if (!writer.open(opts.outFile, error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return BC_EXIT_FAILED;
+		}
+		if (!strcmp(opts.outFile, "-"))
+			report = stderr;
+	}
+
+	MetricsExporter *exporter = startExporter(metrics, opts);
+	int status = BC_EXIT_OK;
+	int64_t started = MinerPool::now();
+	for (uint i = firstId; i < firstId + opts.chainLength; i++) {
+		b = nextBlock(i, b.getSolvedHash());
+		int64_t blockStarted = MinerPool::now();
+		if (coordinator != NULL) {
+			std::string error;
+			if (!coordinator->mine(b, opts.mode, error)) {
+				fprintf(stderr, "%s\n", error.c_str());
+				status = BC_EXIT_FAILED;
+				break;
+			}
+			metrics.recordBlock(MinerPool::now() - blockStarted, &coordinator->lastPhases());
+		} else {
+			run.reset();
+			threadMine(b, pool, scheduler, run, &metrics, checkpoint.get());
+		}
+		//lowest nonce mode searches up from 0, so the nonce is the work the block took
+		if (opts.targetMs)
+			retarget.record((MinerPool::now() - blockStarted) / 1e9, opts.mode == MINE_LOWEST_NONCE ? b.getNonce() + 1.0 : 0);
+		if (writer.isOpen())
+			writer.push(b);
+		else if (!opts.quiet)
+			printBlock(i, MinerPool::now() - blockStarted, coordinator ? coordinator->lastPhases() : lastBlockPhases(), b.getSolvedHash(), b.getNonce());
+		if (store.isOpen() && !store.append(b)) {
+			fprintf(stderr, "cannot write %s\n", opts.storeFile);
+			status = BC_EXIT_FAILED;
+			break;
+		}
+		if (b.hasNoSolution()) {
+			fflush(stdout);
+			fprintf(stderr, "block %u has no solution at %.2f bits\n", i, thresholdBits(b.getThreshold()));
+			status = BC_EXIT_FAILED;
+			break;
+		}
+	}
+	double secs = (MinerPool::now() - started) / 1e9;
+	delete exporter;
+	checkpoint.reset();
+	if (store.isOpen() && !store.sync()) {
+		fprintf(stderr, "cannot write %s\n", opts.storeFile);
+		status = BC_EXIT_FAILED;
+	}
+	std::string writeError;
+	if (!writer.close(writeError)) {
+		fprintf(stderr, "%s\n", writeError.c_str());
+		status = BC_EXIT_FAILED;
+	}
+
+	fprintf(report, "blocks=%zu  threads=%u  runtime=%.3fs  blocks/s=%.1f  tip=%016zx  dispatch=%.1fus/block\n",
+		metrics.blocks(), threads, secs, secs > 0 ? metrics.blocks() / secs : 0, b.getSolvedHash(), pool.runs() ? pool.totalDispatchOverhead() / 1000.0 / pool.runs() : 0);
+	BlockPhases phases = metrics.phases();
+	size_t phased = metrics.phasedBlocks();
+	if (!opts.quiet && phased)
+		fprintf(report, "per-block  dispatch=%.1fus  search=%.3fms  cancel=%.1fus  join=%.1fus\n",
+			phases.dispatch / 1e3 / phased, phases.search / 1e6 / phased, phases.cancel / 1e3 / phased, phases.join / 1e3 / phased);
+	if (opts.targetMs)
+		fprintf(report, "bits=%.2f  target=%.3fs  recent-block=%.3fs  hashrate=%.0f\n", retarget.bits(), policy.targetSeconds, retarget.meanSeconds(), retarget.hashrate());
+	if (coordinator != NULL) {
+		const Coordinator::Stats &cs = coordinator->stats();
+		fprintf(report, "workers=%zu  worker-threads=%u  joined=%zu  lost=%zu  leases=%zu  reassigned=%zu  expired=%zu  stop=%.1fus/block\n",
+			coordinator->workers(), coordinator->workerThreads(), cs.workersJoined, cs.workersLost, cs.leases, cs.reassigned, cs.expired,
+			metrics.blocks() ? cs.stopNanos / 1000.0 / metrics.blocks() : 0);
+		coordinator.reset(); //workers see the socket close and exit
+	}
+	if (governor != NULL) {
+		ThreadCounters t = metrics.total();
+		fprintf(report, "governor  hashrate=%.0f  throttled=%zu  paused=%.3fs  overhead=%.3fms (%.2fus/chunk)\n",
+			secs > 0 ? t.noncesTried / secs : 0, governor->throttled(), t.throttleNanos / 1e9, t.governorNanos / 1e6, t.chunks ? t.governorNanos / 1e3 / t.chunks : 0);
+	}
+	if (opts.outFile != NULL) {
+		BlockWriter::Stats ws = writer.stats();
+		fprintf(report, "out=%s  format=%s  blocks=%zu  bytes=%zu  writes=%zu  syncs=%zu  stalls=%zu  max-queue=%zu\n",
+			opts.outFile, BlockWriter::formatName(opts.output.format), ws.blocks, ws.bytes, ws.writes, ws.syncs, ws.stalls, ws.maxDepth);
+	}
+	fflush(stdout);
+	return status;
+}
+
+//mines leases for a coordinator until it closes the connection
+int workerMain(const MinerOptions &opts) {
+	unsigned threads = opts.threads ? opts.threads : BC_MAX_THREAD_COUNT;
+	//the coordinator picks the hash, and sha256d blocks could come at any point
+	if (!checkSha256(true))
+		return BC_EXIT_FAILED;
+	Array<int> nodes;
+	LeaseWorker worker(threads, placeThreads(threads, opts, nodes));
+	if (!opts.quiet)
+		fprintf(stderr, "%s: mining leases on %u threads\n", opts.workerSocket, threads);
+	std::string error;
+	int64_t started = MinerPool::now();
+	bool ok = worker.run(opts.workerSocket, error);
+	double secs = (MinerPool::now() - started) / 1e9;
+	if (!ok)
+		fprintf(stderr, "%s\n", error.c_str());
+	printf("leases=%zu  solutions=%zu  nonces=%zu  threads=%u  runtime=%.3fs  Mhash/s=%.2f\n",
+		worker.leases(), worker.solutions(), worker.nonces(), threads, secs, secs > 0 ? worker.nonces() / secs / 1e6 : 0);
+	return ok ? BC_EXIT_OK : BC_EXIT_FAILED;
+}
+
+int batchMain(const char *jobFile, unsigned threadCount, const MinerOptions &opts) {
+	Array<ChainJob> jobs;
+	std::string error;
+	if (!loadChainJobs(jobFile, jobs, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return BC_EXIT_FAILED;
+	}
+	if (threadCount < BC_MIN_THREAD_COUNT || threadCount > BC_MAX_THREAD_COUNT)
+		threadCount = BC_MAX_THREAD_COUNT;
+
+	Array<int> nodes;
+	MinerPool pool(threadCount, placeThreads(threadCount, opts, nodes));
+	MinerMetrics metrics(threadCount);
+	if (!nodes.empty())
+		metrics.placeCounters(nodes);
+	MetricsExporter *exporter = startExporter(metrics, opts);
+	Array<ChainResult> results;
+	double secs = mineChains(jobs, results, pool, &metrics);
+	delete exporter;
+
+	size_t blocks = 0;
+	int status = BC_EXIT_OK;
+	for (uint i = 0; i < results.size(); i++) {
+		const ChainResult &r = results[i];
+		blocks += r.blocks;
+		if (r.blocks < jobs[i].length)
+			status = BC_EXIT_FAILED;
+		if (!opts.quiet)
+			printf("chain=%03u  start=%20zu  difficulty=%2u  blocks=%8u  time=%9.3fs  blocks/s=%10.1f  tip=%016zx\n", i, jobs[i].startHash, jobs[i].difficulty, r.blocks, r.seconds, r.blocksPerSec, r.tipHash);
+	}
+	printf("chains=%zu  threads=%u  blocks=%zu  runtime=%.3fs  blocks/s=%.1f\n", (size_t)results.size(), threadCount, blocks, secs, secs > 0 ? blocks / secs : 0);
+	return status;
+}
+
+//audits the file as it is, a missing file, a bad header or a bad tail fails instead of being created or repaired
+int verifyMain(const MinerOptions &opts) {
+	ChainStore store;
+	std::string error;
+	if (!store.openReadOnly(opts.verifyFile, error, 1)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return BC_EXIT_FAILED;
+	}
+	unsigned threads = opts.threads ? opts.threads : BC_MAX_THREAD_COUNT;
+	Array<int> nodes;
+	MinerPool pool(threads, placeThreads(threads, opts, nodes));
+	return verifyStore(store, pool, opts.quiet) ? BC_EXIT_OK : BC_EXIT_FAILED;
+}
+
+bool verifyStore(const ChainStore &store, MinerPool &pool, bool quiet) {
+	size_t count;
+	const BlockRecord *records = store.records(count);
+	if (records == NULL && !store.empty()) {
+		fprintf(stderr, "cannot map %s\n", store.path().c_str());
+		return false;
+	}
+	VerifyResult r = verifyChain(records, count, pool);
+	if (!r.ok) {
+		fprintf(stderr, "%s: block %zu (id %u) is invalid: %s\n", store.path().c_str(), r.firstInvalid, records[r.firstInvalid].id, verifyReasonName(r.reason));
+		return false;
+	}
+	//every whole record checked out, so a partial one after them is the first bad block
+	if (store.tornBytes()) {
+		fprintf(stderr, "%s: block %zu is invalid: torn, %zu of %zu bytes\n", store.path().c_str(), count, store.tornBytes(), sizeof(BlockRecord));
+		return false;
+	}
+	if (!quiet)
+		printf("verified=%zu  threads=%u  runtime=%.3fs  blocks/s=%.0f\n", count, pool.size(), r.seconds, r.seconds > 0 ? count / r.seconds : 0);
+	return true;
+}
+
+//prints the block and its parent, the index is loaded from or saved to <store>.idx so later lookups skip the build
+//the chain itself is only read, a lookup never creates or repairs it
+int findMain(const MinerOptions &opts) {
+	ChainStore store;
+	std::string error;
+	if (!store.openReadOnly(opts.storeFile, error, 1)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return BC_EXIT_FAILED;
+	}
+	if (!store.index(opts.threads ? opts.threads : BC_MAX_THREAD_COUNT)) {
+		fprintf(stderr, "cannot index %s\n", opts.storeFile);
+		return BC_EXIT_FAILED;
+	}
+	size_t pos = opts.findHash ? store.findSolvedHash(opts.findKey) : store.findId((unsigned)opts.findKey);
+	if (pos == BlockIndex::NPOS) {
+		fprintf(stderr, "%s: no block with %s %zx\n", opts.storeFile, opts.findHash ? "hash" : "id", opts.findKey);
+		return BC_EXIT_FAILED;
+	}
+	Block b = store.at(pos);
+	size_t parent = store.findParent(pos);
+	printf("position=%zu  id=%u  previous=%016zx  hash=%016zx  nonce=%zu  parent=", pos, b.getId(), b.getPreviousHash(), b.getSolvedHash(), b.getNonce());
+	if (parent == BlockIndex::NPOS)
+		printf("none\n");
 	else
-		block.setNoSolution();
+		printf("%zu\n", parent);
+	return BC_EXIT_OK;
 }
 
-void mineBlockTS(Block b, uchar threadNum, uchar threadCount) {
-	for (size_t i = (size_t)threadNum; i <= (size_t)-1 && !nonceFound; i += threadCount) {
-		if (b.tryNonce(i)) {
-			setNonce(i); //sets nonceVal and is mutex locked
+static bool parseNumber(const char *text, unsigned long long max, unsigned long long &value) {
+	if (text == NULL || *text == '\0' || *text == '-')
+		return false;
+	char *end;
+	errno = 0;
+	value = strtoull(text, &end, 0);
+	return errno == 0 && *end == '\0' && value <= max;
+}
+
+//returns an exit code if the program should stop (bad usage or --help), -1 to go on mining
+int parseOptions(int argc, char **argv, MinerOptions &opts) {
+	bool haveLength = false;
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		unsigned long long n = 0;
+		bool ok = true;
+		bool takesValue = true;
+		if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+			printUsage(stdout, argv[0]);
+			return BC_EXIT_OK;
+		} else if (!strcmp(arg, "-q") || !strcmp(arg, "--quiet")) {
+			opts.quiet = true;
+			takesValue = false;
+		} else if (!strcmp(arg, "--self-test")) {
+			opts.selfTest = true;
+			takesValue = false;
+		} else if (!strcmp(arg, "-d") || !strcmp(arg, "--difficulty")) {
+			ok = parseNumber(value, 16, n);
+			opts.difficulty = (unsigned)n;
+		} else if (!strcmp(arg, "-b") || !strcmp(arg, "--bits")) {
+			char *end = NULL;
+			opts.bits = value ? strtod(value, &end) : -1;
+			ok = value != NULL && *end == '\0' && opts.bits >= 0 && opts.bits <= 64;
+		} else if (!strcmp(arg, "--target-ms")) {
+			ok = parseNumber(value, 0xffffffffu, n) && n > 0;
+			opts.targetMs = (unsigned)n;
+		} else if (!strcmp(arg, "--retarget-window")) {
+			ok = parseNumber(value, 1 << 20, n) && n > 0;
+			opts.retargetWindow = (unsigned)n;
+		} else if (!strcmp(arg, "-n") || !strcmp(arg, "--length")) {
+			ok = parseNumber(value, 0xffffffffu, n) && n > 0;
+			opts.chainLength = (unsigned)n;
+			haveLength = true;
+		} else if (!strcmp(arg, "-s") || !strcmp(arg, "--start")) {
+			ok = parseNumber(value, SIZE_MAX, n);
+			opts.startHash = (size_t)n;
+		} else if (!strcmp(arg, "-t") || !strcmp(arg, "--threads")) {
+			ok = parseNumber(value, BC_MAX_THREAD_COUNT, n) && n >= BC_MIN_THREAD_COUNT;
+			opts.threads = (unsigned)n;
+		} else if (!strcmp(arg, "-j") || !strcmp(arg, "--jobs")) {
+			ok = value != NULL;
+			opts.jobFile = value;
+		} else if (!strcmp(arg, "--store")) {
+			ok = value != NULL;
+			opts.storeFile = value;
+		} else if (!strcmp(arg, "--verify")) {
+			ok = value != NULL;
+			opts.verifyFile = value;
+		} else if (!strcmp(arg, "--find")) {
+			char *end = NULL;
+			errno = 0;
+			opts.findKey = value ? strtoull(value, &end, 16) : 0;
+			ok = value != NULL && *value != '\0' && *value != '-' && *end == '\0' && errno == 0;
+			opts.findHash = true;
+		} else if (!strcmp(arg, "--find-id")) {
+			ok = parseNumber(value, 0xffffffffu, n);
+			opts.findKey = (size_t)n;
+			opts.findId = true;
+		} else if (!strcmp(arg, "--checkpoint")) {
+			ok = value != NULL;
+			opts.checkpointFile = value;
+		} else if (!strcmp(arg, "--checkpoint-interval")) {
+			ok = parseNumber(value, 0xffffffffu, n) && n > 0;
+			opts.checkpointIntervalMs = (unsigned)n;
+		} else if (!strcmp(arg, "--mode")) {
+			ok = value != NULL && (!strcmp(value, "lowest") || !strcmp(value, "first"));
+			opts.mode = ok && !strcmp(value, "first") ? MINE_FIRST_FOUND : MINE_LOWEST_NONCE;
+		} else if (!strcmp(arg, "--metrics-json")) {
+			ok = value != NULL;
+			opts.metricsJson = value;
+		} else if (!strcmp(arg, "--metrics-prom")) {
+			ok = value != NULL;
+			opts.metricsProm = value;
+		} else if (!strcmp(arg, "--trace")) {
+			ok = value != NULL;
+			opts.traceFile = value;
+		} else if (!strcmp(arg, "--hash")) {
+			opts.hashPolicy = parseHashPolicy(value);
+			ok = opts.hashPolicy >= 0;
+		} else if (!strcmp(arg, "--coordinator")) {
+			ok = value != NULL;
+			opts.coordinatorSocket = value;
+		} else if (!strcmp(arg, "--worker")) {
+			ok = value != NULL;
+			opts.workerSocket = value;
+		} else if (!strcmp(arg, "--lease")) {
+			ok = parseNumber(value, SIZE_MAX, n) && n > 0;
+			opts.leaseNonces = (size_t)n;
+		} else if (!strcmp(arg, "--lease-ms")) {
+			ok = parseNumber(value, 0x7fffffffu, n) && n > 0;
+			opts.leaseMs = (unsigned)n;
+		} else if (!strcmp(arg, "--out")) {
+			ok = value != NULL;
+			opts.outFile = value;
+		} else if (!strcmp(arg, "--out-format")) {
+			ok = BlockWriter::parseFormat(value, opts.output.format);
+		} else if (!strcmp(arg, "--out-sync")) {
+			ok = BlockWriter::parseSync(value, opts.output);
+		} else if (!strcmp(arg, "--max-hashrate")) {
+			char *end = NULL;
+			opts.governor.maxHashrate = value ? strtod(value, &end) : 0;
+			ok = value != NULL && *end == '\0' && opts.governor.maxHashrate > 0;
+		} else if (!strcmp(arg, "--cpu")) {
+			char *end = NULL;
+			opts.governor.cpuPercent = value ? strtod(value, &end) : 0;
+			ok = value != NULL && *end == '\0' && opts.governor.cpuPercent > 0 && opts.governor.cpuPercent <= 100;
+		} else if (!strcmp(arg, "--pin")) {
+			opts.pin = Topology::parsePolicy(value);
+			ok = opts.pin >= 0;
+		} else if (!strcmp(arg, "--metrics-interval")) {
+			ok = parseNumber(value, 0xffffffffu, n) && n > 0;
+			opts.metricsIntervalMs = (unsigned)n;
+		} else {
+			fprintf(stderr, "unknown option %s\n", arg);
+			printUsage(stderr, argv[0]);
+			return BC_EXIT_USAGE;
 		}
-		if (i > i + threadCount) { //overflow
-			return;
+		if (!ok) {
+			fprintf(stderr, value ? "bad value for %s: %s\n" : "%s needs a value\n", arg, value);
+			return BC_EXIT_USAGE;
 		}
-	} 
+		if (takesValue)
+			i++;
+	}
+	if ((opts.findHash || opts.findId) && opts.storeFile == NULL) {
+		fprintf(stderr, "--find and --find-id need --store\n");
+		return BC_EXIT_USAGE;
+	}
+	if (opts.coordinatorSocket != NULL && (opts.jobFile != NULL || opts.checkpointFile != NULL || opts.workerSocket != NULL)) {
+		fprintf(stderr, "--coordinator can't be combined with --jobs, --checkpoint or --worker\n");
+		return BC_EXIT_USAGE;
+	}
+	bool governed = opts.governor.maxHashrate > 0 || opts.governor.cpuPercent > 0;
+	if (governed && (opts.jobFile != NULL || opts.verifyFile != NULL || opts.workerSocket != NULL || opts.coordinatorSocket != NULL)) {
+		fprintf(stderr, "--max-hashrate and --cpu only apply to a chain mined with --length on local threads\n");
+		return BC_EXIT_USAGE;
+	}
+	if (opts.outFile != NULL && (opts.jobFile != NULL || opts.verifyFile != NULL || opts.findHash || opts.findId || opts.workerSocket != NULL)) {
+		fprintf(stderr, "--out only applies to a chain mined with --length\n");
+		return BC_EXIT_USAGE;
+	}
+	if (opts.jobFile == NULL && opts.verifyFile == NULL && !opts.findHash && !opts.findId && !opts.selfTest && opts.workerSocket == NULL && !haveLength) {
+		fprintf(stderr, "one of --length, --jobs or --verify is required\n");
+		printUsage(stderr, argv[0]);
+		return BC_EXIT_USAGE;
+	}
+	return -1;
+}
+
+void printUsage(FILE *out, const char *prog) {
+	fprintf(out,
+		"usage: %s                                 prompt for every setting\n"
+		"       %s <job file> [threads]            mine every chain in the file together\n"
+		"       %s -n <length> [options]           mine one chain without prompting\n"
+		"       %s -j <job file> [options]\n"
+		"       %s --verify <chain file> [-t threads]  check every block of a chain file\n"
+		"       %s --store <chain file> --find <hash> | --find-id <id>  look a block up through <chain file>.idx\n"
+		"       %s --self-test                     check the nonce batch kernels against the scalar hash\n"
+		"                                          and SHA-256 against the FIPS 180-2 vectors, on every kernel\n"
+		"       %s --worker <socket> [-t threads]  mine leases for a --coordinator until it exits\n"
+		"options:\n"
+		"  -d, --difficulty <0-16>     block difficulty (default %d)\n"
+		"  -b, --bits <0-64>           difficulty in leading zero bits, fractions allowed (4 bits = 1 difficulty)\n"
+		"      --target-ms <ms>        retarget after every block to hold this block time, starting from -d/-b\n"
+		"      --retarget-window <n>   blocks the hashrate is measured over (default 16)\n"
+		"      --hash std|fnv1a|mix|sha256d  how nonces are hashed; std matches chains mined before the choice,\n"
+		"                              sha256d is double SHA-256 of a binary block header (default std)\n"
+		"  -n, --length <blocks>       chain length\n"
+		"  -s, --start <hash>          previous hash of the first block (default 0)\n"
+		"  -t, --threads <count>       mining threads (default %u)\n"
+		"      --max-hashrate <n>      pace mining to at most n nonces per second over all threads\n"
+		"      --cpu <percent>         pace mining to this much of the cpus it may use: its threads, or the cgroup's\n"
+		"                              cpu.max quota when that's lower\n"
+		"      --pin none|cores|smt|nodes  pin mining threads: one per physical core first, filling SMT siblings\n"
+		"                              core by core, or split evenly across NUMA nodes (default none)\n"
+		"  -j, --jobs <file>           job file, one '<start hash> <difficulty> <length>' per line\n"
+		"      --coordinator <socket>  mine through --worker processes connecting to this unix socket instead of threads\n"
+		"      --lease <nonces>        nonces per lease handed to a worker (default %zu)\n"
+		"      --lease-ms <ms>         a lease not renewed for this long goes to another worker (default %u)\n"
+		"      --store <file>          append the chain to a chain file, resuming from its last block\n"
+		"      --out <file>|-          stream every block to a file or stdout from a writer thread, in place of the\n"
+		"                              per-block lines; the summary goes to stderr when it's stdout\n"
+		"      --out-format ndjson|binary  one json object per line, or a chain file --verify reads (default ndjson)\n"
+		"      --out-sync close|none|batch|<ms>  fsync the --out file when done, never, after every write or every\n"
+		"                              <ms> milliseconds (default close)\n"
+		"      --checkpoint <file>     save nonce search progress so a killed run resumes mid-block\n"
+		"      --checkpoint-interval <ms>  how often to save it (default %u)\n"
+		"      --mode lowest|first     lowest valid nonce or first one found (default lowest)\n"
+		"  -q, --quiet                 only print the summary\n"
+		"      --metrics-json <file>   keep a json metrics file updated (or BC_METRICS_JSON)\n"
+		"      --metrics-prom <file>   keep a prometheus metrics file updated (or BC_METRICS_PROM)\n"
+		"      --metrics-interval <ms> how often to rewrite them (or BC_METRICS_INTERVAL_MS, default 1000)\n"
+		"      --trace <file>          write a chrome trace of mining and i/o when done (builds without NDEBUG)\n"
+		"exit status: %d ok, %d a block had no solution, a chain failed to verify or a file couldn't be read, %d bad usage\n",
+		prog, prog, prog, prog, prog, prog, prog, prog, DEFAULT_DIFFICULTY, BC_MAX_THREAD_COUNT, Coordinator::DEFAULT_LEASE_NONCES,
+		Coordinator::DEFAULT_LEASE_MS, NonceCheckpoint::DEFAULT_INTERVAL_MS, BC_EXIT_OK, BC_EXIT_FAILED, BC_EXIT_USAGE);
+}
+
+//runs Sha256::selfTest before anything is mined or verified with sha256d, so a broken kernel can't write a chain
+bool checkSha256(bool quiet) {
+	std::string failure;
+	bool ok = Sha256::selfTest(&failure);
+	if (!ok)
+		fprintf(stderr, "sha256 self-test failed: %s\n", failure.c_str());
+	else if (!quiet)
+		fprintf(stderr, "sha256 self-test ok  kernel=%s\n", Sha256::kernelName(Sha256::kernel()));
+	return ok;
+}
+
+//runs NonceHasher::selfTest for --self-test, which checks every kernel this cpu has, not just the one mining picks
+bool checkBatchKernels() {
+	std::string failure;
+	bool ok = NonceHasher::selfTest(&failure);
+	if (!ok)
+		fprintf(stderr, "batch kernel self-test failed: %s\n", failure.c_str());
+	else
+		fprintf(stderr, "batch kernel self-test ok  kernel=%s\n", NonceHasher::kernelName(NonceHasher::batchKernel()));
+	return ok;
+}
+
+//flags win over BC_METRICS_JSON, BC_METRICS_PROM and BC_METRICS_INTERVAL_MS (default 1000)
+MetricsExporter *startExporter(MinerMetrics &metrics, const MinerOptions &opts) {
+	const char *json = opts.metricsJson ? opts.metricsJson : getenv("BC_METRICS_JSON");
+	const char *prom = opts.metricsProm ? opts.metricsProm : getenv("BC_METRICS_PROM");
+	const char *interval = getenv("BC_METRICS_INTERVAL_MS");
+	unsigned intervalMs = opts.metricsIntervalMs ? opts.metricsIntervalMs : interval ? atoi(interval) : 1000;
+	if (json == NULL && prom == NULL)
+		return NULL;
+	return new MetricsExporter(metrics, json ? json : "", prom ? prom : "", intervalMs);
 }
 
-void setNonce(size_t nonce) {
-	std::lock_guard<std::mutex> guard(mtx);
-	if (!nonceFound) {
-		nonceFound = true;
-		nonceVal = nonce;
+//cpu for each thread under opts.pin, and in nodes the NUMA node each one lands on; empty for --pin none
+Array<unsigned> placeThreads(unsigned threads, const MinerOptions &opts, Array<int> &nodes) {
+	nodes.clear();
+	if (opts.pin == Topology::PIN_NONE)
+		return Array<unsigned>();
+	Topology topology = Topology::detect();
+	Array<unsigned> cpus = topology.placement(threads, opts.pin);
+	for (unsigned cpu : cpus)
+		nodes.push_back(topology.nodeOf(cpu));
+	if (!opts.quiet)
+		fprintf(stderr, "%s  pin=%s  threads=%u\n", topology.toString().c_str(), Topology::policyName(opts.pin), threads);
+	return cpus;
+}
+
+//a build with tracing compiled out still runs, it just has nothing to write
+bool startTrace(const MinerOptions &opts) {
+	if (opts.traceFile == NULL)
+		return false;
+	if (!trace::compiledIn()) {
+		fprintf(stderr, "--trace: tracing is compiled out of this build (NDEBUG), %s won't be written\n", opts.traceFile);
+		return false;
+	}
+	trace::nameThread("main");
+	trace::enable(true);
+	return true;
+}
+
+bool finishTrace(const MinerOptions &opts) {
+	if (opts.traceFile == NULL || !trace::compiledIn())
+		return true;
+	trace::enable(false);
+	if (!trace::writeChrome(opts.traceFile)) {
+		fprintf(stderr, "cannot write %s\n", opts.traceFile);
+		return false;
 	}
+	if (trace::dropped())
+		fprintf(stderr, "%s: oldest %zu of %zu spans were overwritten\n", opts.traceFile, trace::dropped(), trace::recorded());
+	return true;
+}
+
+//formats like Timer::toString(MILLI, MINUTE) but into a stack buffer, so there is no allocation between blocks
+static void formatElapsed(char *out, size_t size, int64_t nanos) {
+	size_t ms = nanos > 0 ? (size_t)nanos / 1000000 : 0;
+	size_t mins = ms / 60000;
+	if (mins < 60)
+		snprintf(out, size, "%02zu:%02zu.%03zu", mins, ms / 1000 % 60, ms % 1000);
+	else if (mins < 60 * 24)
+		snprintf(out, size, "%02zu:%02zu:%02zu.%03zu", mins / 60, mins % 60, ms / 1000 % 60, ms % 1000);
+	else
+		snprintf(out, size, "%zu:%02zu:%02zu:%02zu.%03zu", mins / (60 * 24), mins / 60 % 24, mins % 60, ms / 1000 % 60, ms % 1000);
+}
+
+//search is in ms, the other phases are normally a few us
+void printBlock(unsigned id, int64_t nanos, const BlockPhases &phases, size_t hash, size_t nonce) {
+	char elapsed[32];
+	formatElapsed(elapsed, sizeof(elapsed), nanos);
+	printf("id=%03u  time-elapsed=%12s  dispatch=%8.1fus  search=%10.3fms  cancel=%8.1fus  join=%8.1fus  hash=%016zx  nonce=%13zu\n",
+		id, elapsed, phases.dispatch / 1000.0, phases.search / 1e6, phases.cancel / 1000.0, phases.join / 1000.0, hash, nonce);
 }